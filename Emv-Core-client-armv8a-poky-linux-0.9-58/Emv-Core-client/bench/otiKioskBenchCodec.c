@@ -0,0 +1,160 @@
+/*
+ * otiKioskBenchCodec.c
+ *
+ * Compares the JSON and MessagePack encodings (see kiosk_msgpack.h) on the messages a commands client receives
+ * during a transaction: the size of each message and the time the library takes to decode it.
+ *
+ * usage: otiKioskBenchCodec [-n <iterations>]
+ *   -n  number of decodes of each message (default 200000)
+ *
+ * The MessagePack messages are converted from the JSON ones with msgpack_from_json(), as the simulator and the
+ * broker would send them. The mix weighs each message by its count in one transaction seen by a reader pool:
+ * status polls, display messages, reader events and the TransactionComplete.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "src/kiosk_commands.h"
+#include "src/kiosk_msgpack.h"
+
+#define BENCH_MSG_MAX_SIZE 1024
+
+typedef KIOSK_RET (*decode_fn)(const char* msg, int len);
+
+typedef struct {
+  const char* name;
+  const char* json;
+  decode_fn decode;
+  int count; // in the mix
+} bench_msg;
+
+static KIOSK_RET _decode_get_status(const char* msg, int len) {
+  kiosk_envelope env;
+  KIOSK_STATUS status;
+  KIOSK_RET ret = parse_envelope(msg, len, &env);
+  return ret != KIOSK_RET_OK ? ret : parse_get_status(msg, &env, 1, &status);
+}
+
+static KIOSK_RET _decode_response_ok(const char* msg, int len) {
+  kiosk_envelope env;
+  KIOSK_RET ret = parse_envelope(msg, len, &env);
+  return ret != KIOSK_RET_OK ? ret : check_response_ok(msg, &env, 2);
+}
+
+// the steps of the library's reader event handler
+static KIOSK_RET _decode_reader_event(const char* msg, int len) {
+  static const char* const keys[] = {"index", "line1", "line2"};
+  kiosk_envelope env;
+  kiosk_json_span spans[3];
+  char line1[64], line2[64];
+  int index;
+
+  KIOSK_RET ret = parse_envelope(msg, len, &env);
+  if(ret != KIOSK_RET_OK)
+    return ret;
+  if(!envelope_method_is(msg, &env, KIOSK_EVENT_READER_MESSAGE))
+    return KIOSK_RET_PARSING_ERROR;
+  const char* params = msg + env.params.off;
+  ret = scan_members(params, env.params.len, env.binary, keys, spans, 3);
+  if(ret != KIOSK_RET_OK)
+    return ret;
+  if(!decode_int(env.binary, spans[0].tok, params + spans[0].off, spans[0].len, &index) ||
+     decode_string(env.binary, params + spans[1].off, spans[1].len, line1, sizeof(line1)) < 0 ||
+     decode_string(env.binary, params + spans[2].off, spans[2].len, line2, sizeof(line2)) < 0)
+    return KIOSK_RET_PARSING_ERROR;
+  return KIOSK_RET_OK;
+}
+
+static KIOSK_RET _decode_transaction_complete(const char* msg, int len) {
+  kiosk_envelope env;
+  otiKioskPaymentResponse resp;
+  KIOSK_RET ret = parse_envelope(msg, len, &env);
+  return ret != KIOSK_RET_OK ? ret : parse_transaction_complete(msg, &env, &resp);
+}
+
+static bench_msg _messages[] = {
+  {"GetStatus response", "{\"jsonrpc\":\"2.0\",\"result\":\"Ready\",\"id\":1}", _decode_get_status, 20},
+  {"ShowMessage response", "{\"jsonrpc\":\"2.0\",\"result\":true,\"id\":2}", _decode_response_ok, 2},
+  {"ReaderMessageEvent", "{\"jsonrpc\":\"2.0\",\"method\":\"ReaderMessageEvent\","
+      "\"params\":{\"index\":3,\"line1\":\"Present card\",\"line2\":\"Amount 12.50\"}}", _decode_reader_event, 4},
+  {"TransactionComplete", "{\"jsonrpc\":\"2.0\",\"method\":\"TransactionComplete\",\"params\":{\"status\":\"OK\","
+      "\"errorDescription\":\"\",\"errorCode\":0,\"authorizationDetails\":{\"AmountAuthorized\":12.5,"
+      "\"AmountRequested\":12.5,\"Transaction_Referance\":\"4f1c2a9e-0b7d-4c35-9a61-d2e8f3b07c44\","
+      "\"PartialPan\":\"1234\",\"CardType\":\"VISA\",\"Card_ID\":\"0F3A9C21\",\"CardToken\":"
+      "\"tok_9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08dGhpcyBpcyBhIGxvbmcgY2FyZCB0b2tlbiBm"
+      "b3IgdGhlIGJlbmNobWFyaw\"}},\"id\":12}", _decode_transaction_complete, 1},
+};
+
+#define NB_MESSAGES (int)(sizeof(_messages)/sizeof(_messages[0]))
+
+static double _now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ns per decode, or a negative value if the message doesn't decode
+static double _bench(decode_fn decode, const char* msg, int len, unsigned int nb_iterations) {
+  if(decode(msg, len) != KIOSK_RET_OK)
+    return -1;
+  double start = _now_s();
+  for(unsigned int i = 0; i < nb_iterations; i++)
+    decode(msg, len);
+  return (_now_s() - start) * 1e9 / nb_iterations;
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-n <iterations>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int nb_iterations = 200000;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    switch(opt) {
+    case 'n': nb_iterations = strtoul(optarg, NULL, 0); break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(nb_iterations == 0) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  printf("%u decodes per message\n", nb_iterations);
+  printf("%-22s %10s %10s %12s %12s\n", "", "JSON B", "MsgPack B", "JSON ns", "MsgPack ns");
+  int mix_json_len = 0, mix_msgpack_len = 0;
+  double mix_json_ns = 0, mix_msgpack_ns = 0;
+  for(int i = 0; i < NB_MESSAGES; i++) {
+    const bench_msg* m = &_messages[i];
+    int json_len = (int)strlen(m->json);
+    static char msgpack[BENCH_MSG_MAX_SIZE];
+    struct msgpack_out out = MSGPACK_OUT(msgpack, sizeof(msgpack));
+    if(msgpack_from_json(m->json, json_len, &out) < 0 || out.overflow) {
+      fprintf(stderr, "%s: failed to convert to MessagePack\n", m->name);
+      return 1;
+    }
+
+    double json_ns = _bench(m->decode, m->json, json_len, nb_iterations);
+    double msgpack_ns = _bench(m->decode, msgpack, out.len, nb_iterations);
+    if(json_ns < 0 || msgpack_ns < 0) {
+      fprintf(stderr, "%s: failed to decode the %s message\n", m->name, json_ns < 0 ? "JSON" : "MessagePack");
+      return 1;
+    }
+    printf("%-22s %10d %10d %12.0f %12.0f\n", m->name, json_len, out.len, json_ns, msgpack_ns);
+
+    mix_json_len += m->count * json_len;
+    mix_msgpack_len += m->count * out.len;
+    mix_json_ns += m->count * json_ns;
+    mix_msgpack_ns += m->count * msgpack_ns;
+  }
+  printf("%-22s %10d %10d %12.0f %12.0f\n", "transaction mix", mix_json_len, mix_msgpack_len, mix_json_ns, mix_msgpack_ns);
+  return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * otiKioskBenchCommands.c
+ *
+ * Times build_command(), which formats a command with mjson into a caller buffer, against the path it replaced:
+ * vsnprintf() once to size the command, calloc(), vsprintf() again and free() once sent.
+ *
+ * usage: otiKioskBenchCommands [-n <iterations>]
+ *   -n  number of serializations of each command (default 200000)
+ *
+ * The commands are the TransactionComplete ack and the commands with parameters, with plain strings so that both
+ * paths must produce the same bytes (the old one didn't escape strings). The program exits with 1 otherwise.
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "src/kiosk_commands.h"
+
+// the serializer before build_command(), the caller frees the command
+static char* _build_command_old(const char* template, ...) {
+  va_list args;
+
+  va_start(args, template);
+  int len = vsnprintf(NULL, 0, template, args) + 1;
+  va_end(args);
+
+  char* cmd = calloc(len, 1);
+  if(cmd == NULL)
+    return NULL;
+
+  va_start(args, template);
+  vsprintf(cmd, template, args);
+  va_end(args);
+  return cmd;
+}
+
+// each command serialized by both paths, from the same values
+static int _ack_new(char* out, int size) {
+  return build_command(out, size, "{\"jsonrpc\": \"2.0\", \"result\": true, \"id\": %d}", 12);
+}
+
+static char* _ack_old(void) {
+  return _build_command_old("{\"jsonrpc\": \"2.0\", \"result\": true, \"id\": %d}", 12);
+}
+
+static int _show_message_new(char* out, int size) {
+  return build_command(out, size, "{\"jsonrpc\":\"2.0\",\"method\":\"ShowMessage\",\"params\":{\"strLine1\":%Q,\"strLine2\":%Q},\"id\":2}",
+      "Welcome", "Present card to pay");
+}
+
+static char* _show_message_old(void) {
+  return _build_command_old("{\"jsonrpc\":\"2.0\",\"method\":\"ShowMessage\",\"params\":{\"strLine1\":\"%s\",\"strLine2\":\"%s\"},\"id\":2}",
+      "Welcome", "Present card to pay");
+}
+
+static int _pay_transaction_new(char* out, int size) {
+  return build_command(out, size, "{\"jsonrpc\":\"2.0\",\"method\":\"PayTransaction\",\"params\":{\"amount\":%d,\"currency\":%d,"
+      "\"timeout\":%d,\"fee\":%d,\"productID\":%d,\"continuous\":%B},\"id\":7}", 1250, 978, 60, 0, 42, 0);
+}
+
+static char* _pay_transaction_old(void) {
+  return _build_command_old("{\"jsonrpc\":\"2.0\",\"method\":\"PayTransaction\",\"params\":{\"amount\":%d,\"currency\":%d,"
+      "\"timeout\":%d,\"fee\":%d,\"productID\":%d,\"continuous\":%s},\"id\":7}", 1250, 978, 60, 0, 42, "false");
+}
+
+static int _confirm_transaction_new(char* out, int size) {
+  return build_command(out, size, "{\"jsonrpc\":\"2.0\",\"method\":\"ConfirmTransaction\",\"params\":{\"amount\":%d,\"fee\":%d,"
+      "\"productID\":%d,\"transaction_Reference\":%Q},\"id\":8}", 1250, 0, 42, "4f1c2a9e-0b7d-4c35-9a61-d2e8f3b07c44");
+}
+
+static char* _confirm_transaction_old(void) {
+  return _build_command_old("{\"jsonrpc\":\"2.0\",\"method\":\"ConfirmTransaction\",\"params\":{\"amount\":%d,\"fee\":%d,"
+      "\"productID\":%d,\"transaction_Reference\":\"%s\"},\"id\":8}", 1250, 0, 42, "4f1c2a9e-0b7d-4c35-9a61-d2e8f3b07c44");
+}
+
+typedef struct {
+  const char* name;
+  int (*build_new)(char* out, int size);
+  char* (*build_old)(void);
+} bench_command;
+
+static const bench_command _commands[] = {
+  {"TransactionComplete ack", _ack_new, _ack_old},
+  {"ShowMessage", _show_message_new, _show_message_old},
+  {"PayTransaction", _pay_transaction_new, _pay_transaction_old},
+  {"ConfirmTransaction", _confirm_transaction_new, _confirm_transaction_old},
+};
+
+#define NB_COMMANDS (int)(sizeof(_commands)/sizeof(_commands[0]))
+
+static double _now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-n <iterations>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int nb_iterations = 200000;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    switch(opt) {
+    case 'n': nb_iterations = strtoul(optarg, NULL, 0); break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(nb_iterations == 0) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  printf("%u serializations per command\n", nb_iterations);
+  printf("%-24s %8s %10s %10s %8s\n", "", "bytes", "old ns", "new ns", "speedup");
+  for(int i = 0; i < NB_COMMANDS; i++) {
+    const bench_command* c = &_commands[i];
+    char cmd[KIOSK_CMD_MAX_SIZE];
+    int len = c->build_new(cmd, sizeof(cmd));
+    char* old_cmd = c->build_old();
+    if(len < 0 || old_cmd == NULL || strcmp(cmd, old_cmd) != 0) {
+      fprintf(stderr, "%s: the serializers disagree\n%s\n%s\n", c->name, len < 0 ? "" : cmd, old_cmd == NULL ? "" : old_cmd);
+      free(old_cmd);
+      return 1;
+    }
+    free(old_cmd);
+
+    double start = _now_s();
+    for(unsigned int n = 0; n < nb_iterations; n++) {
+      // freed once sent, as the command functions did
+      old_cmd = c->build_old();
+      free(old_cmd);
+    }
+    double old_ns = (_now_s() - start) * 1e9 / nb_iterations;
+
+    start = _now_s();
+    for(unsigned int n = 0; n < nb_iterations; n++)
+      c->build_new(cmd, sizeof(cmd));
+    double new_ns = (_now_s() - start) * 1e9 / nb_iterations;
+
+    printf("%-24s %8d %10.0f %10.0f %7.1fx\n", c->name, len, old_ns, new_ns, old_ns / new_ns);
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * otiKioskBenchDecode.c
+ *
+ * Times the single-pass TransactionComplete decoder (parse_envelope() + parse_transaction_complete()) against the
+ * decoder it replaced, which located the id, the method, the params and then each field with a scan of its own.
+ *
+ * usage: otiKioskBenchDecode [-n <iterations>]
+ *   -n  number of decodes of each event (default 200000)
+ *
+ * The events are the ones a reader sends: approved with a long card token, with the '/' of a base64 token escaped,
+ * and declined with an error description. Both decoders must give the same response, the program exits with 1
+ * otherwise. The old decoder runs on the current mjson, so it benefits from the faster string scanning too.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "src/kiosk_commands.h"
+#include "src/mjson.h"
+
+typedef struct {
+  const char* name;
+  const char* json;
+} bench_event;
+
+static const bench_event _events[] = {
+  {"approved", "{\"jsonrpc\":\"2.0\",\"method\":\"TransactionComplete\",\"params\":{\"status\":\"OK\","
+      "\"errorDescription\":\"\",\"errorCode\":0,\"authorizationDetails\":{\"AmountAuthorized\":12.5,"
+      "\"AmountRequested\":12.5,\"Transaction_Referance\":\"4f1c2a9e-0b7d-4c35-9a61-d2e8f3b07c44\","
+      "\"PartialPan\":\"1234\",\"CardType\":\"VISA\",\"Card_ID\":\"0F3A9C21\",\"CardToken\":"
+      "\"tok_9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08dGhpcyBpcyBhIGxvbmcgY2FyZCB0b2tlbiBm"
+      "b3IgdGhlIGJlbmNobWFyaw\"}},\"id\":12}"},
+  {"approved, escaped token", "{\"jsonrpc\":\"2.0\",\"method\":\"TransactionComplete\",\"params\":{\"status\":\"OK\","
+      "\"errorDescription\":\"\",\"errorCode\":0,\"authorizationDetails\":{\"AmountAuthorized\":3.99,"
+      "\"AmountRequested\":3.99,\"Transaction_Referance\":\"MDB-000187-2026\",\"PartialPan\":\"9876\","
+      "\"CardType\":\"MASTERCARD\",\"Card_ID\":\"7AC01B5E\",\"CardToken\":"
+      "\"q8Ft\\/Zr3kLm0pXw9+Yb2\\/NcV7sJd4Hg6TeUa1\\/Oi5RyQz8WxKv3Lm0pXw9+Yb2\\/NcV7sJd4Hg6TeUa1Oi5RyQz8WxKv3L"
+      "m0pXw9+Yb2\\/NcV7sJd4Hg6TeUa1Q==\"}},\"id\":13}"},
+  {"declined", "{\"jsonrpc\":\"2.0\",\"method\":\"TransactionComplete\",\"params\":{\"status\":\"Declined\","
+      "\"errorDescription\":\"Card declined by issuer (05 - do not honour)\",\"errorCode\":5,"
+      "\"authorizationDetails\":{\"AmountAuthorized\":0,\"AmountRequested\":250,\"Transaction_Referance\":\"\","
+      "\"PartialPan\":\"4321\",\"CardType\":\"AMEX\",\"Card_ID\":\"\",\"CardToken\":\"\"}},\"id\":14}"},
+};
+
+#define NB_EVENTS (int)(sizeof(_events)/sizeof(_events[0]))
+
+// the decoder before the single pass, one scan per field
+static bool _get_string(const char* json, int len, const char* path, char* out, int out_size) {
+  int n = mjson_get_string(json, len, path, out, out_size - 1);
+  if(n < 0)
+    return false;
+  out[n] = '\0';
+  return true;
+}
+
+static KIOSK_RET _decode_old(const char* json, int json_len, otiKioskPaymentResponse* out) {
+  static const char* const status_names[] = {"OK", "Declined", "Error", "Timeout", "Cancelled", "Void", "LocalMifare"};
+  static const otiTransactionStatus statuses[] = {otiTransactionStatus_OK, otiTransactionStatus_Declined,
+      otiTransactionStatus_Error, otiTransactionStatus_Timeout, otiTransactionStatus_Cancelled,
+      otiTransactionStatus_Voided, otiTransactionStatus_LocalMifare};
+  double d;
+  const char* p;
+  int n;
+
+  if(mjson_get_number(json, json_len, "$.id", &d) != 1)
+    return KIOSK_RET_PARSING_ERROR;
+  memset(out, 0, sizeof(*out));
+  if(mjson_find(json, json_len, "$.method", &p, &n) != MJSON_TOK_STRING || n != (int)strlen("\"TransactionComplete\"") ||
+     memcmp("\"TransactionComplete\"", p, n) != 0)
+    return KIOSK_RET_PARSING_ERROR;
+  if(mjson_find(json, json_len, "$.params", &p, &n) != MJSON_TOK_OBJECT)
+    return KIOSK_RET_PARSING_ERROR;
+
+  char status[32];
+  if(!_get_string(p, n, "$.status", status, sizeof(status)) ||
+     !_get_string(p, n, "$.errorDescription", out->error_message, sizeof(out->error_message)))
+    return KIOSK_RET_PARSING_ERROR;
+  if(mjson_get_number(p, n, "$.errorCode", &d) == 0 || d - (int)d != 0)
+    return KIOSK_RET_PARSING_ERROR;
+  out->error_code = (int)d;
+  if(mjson_get_number(p, n, "$.authorizationDetails.AmountAuthorized", &out->amount_authorized) == 0 ||
+     mjson_get_number(p, n, "$.authorizationDetails.AmountRequested", &out->amount_requested) == 0)
+    return KIOSK_RET_PARSING_ERROR;
+  if(!_get_string(p, n, "$.authorizationDetails.Transaction_Referance", out->transaction_reference, sizeof(out->transaction_reference)) ||
+     !_get_string(p, n, "$.authorizationDetails.PartialPan", out->partial_PAN, sizeof(out->partial_PAN)) ||
+     !_get_string(p, n, "$.authorizationDetails.CardType", out->card_type, sizeof(out->card_type)) ||
+     !_get_string(p, n, "$.authorizationDetails.Card_ID", out->card_id, sizeof(out->card_id)) ||
+     !_get_string(p, n, "$.authorizationDetails.CardToken", out->card_token, sizeof(out->card_token)))
+    return KIOSK_RET_PARSING_ERROR;
+
+  for(int i = 0; i < (int)(sizeof(statuses)/sizeof(statuses[0])); i++) {
+    if(strcmp(status, status_names[i]) == 0) {
+      out->status = statuses[i];
+      return KIOSK_RET_OK;
+    }
+  }
+  return KIOSK_RET_PARSING_ERROR;
+}
+
+static KIOSK_RET _decode_new(const char* json, int json_len, otiKioskPaymentResponse* out) {
+  kiosk_envelope env;
+  KIOSK_RET ret = parse_envelope(json, json_len, &env);
+  return ret != KIOSK_RET_OK ? ret : parse_transaction_complete(json, &env, out);
+}
+
+static bool _same_response(const otiKioskPaymentResponse* a, const otiKioskPaymentResponse* b) {
+  return a->status == b->status && a->error_code == b->error_code &&
+      strcmp(a->error_message, b->error_message) == 0 &&
+      fabs(a->amount_authorized - b->amount_authorized) < 0.005 &&
+      fabs(a->amount_requested - b->amount_requested) < 0.005 &&
+      strcmp(a->transaction_reference, b->transaction_reference) == 0 &&
+      strcmp(a->partial_PAN, b->partial_PAN) == 0 && strcmp(a->card_type, b->card_type) == 0 &&
+      strcmp(a->card_id, b->card_id) == 0 && strcmp(a->card_token, b->card_token) == 0;
+}
+
+static double _now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ns per decode
+static double _bench(KIOSK_RET (*decode)(const char*, int, otiKioskPaymentResponse*), const char* json, int len,
+    unsigned int nb_iterations) {
+  otiKioskPaymentResponse resp;
+  double start = _now_s();
+  for(unsigned int i = 0; i < nb_iterations; i++)
+    decode(json, len, &resp);
+  return (_now_s() - start) * 1e9 / nb_iterations;
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-n <iterations>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int nb_iterations = 200000;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    switch(opt) {
+    case 'n': nb_iterations = strtoul(optarg, NULL, 0); break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(nb_iterations == 0) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  printf("%u decodes per event\n", nb_iterations);
+  printf("%-24s %8s %10s %10s %8s\n", "", "bytes", "old ns", "new ns", "speedup");
+  for(int i = 0; i < NB_EVENTS; i++) {
+    const bench_event* e = &_events[i];
+    int len = (int)strlen(e->json);
+    otiKioskPaymentResponse old_resp, new_resp;
+    if(_decode_old(e->json, len, &old_resp) != KIOSK_RET_OK || _decode_new(e->json, len, &new_resp) != KIOSK_RET_OK) {
+      fprintf(stderr, "%s: failed to decode\n", e->name);
+      return 1;
+    }
+    if(!_same_response(&old_resp, &new_resp)) {
+      fprintf(stderr, "%s: the decoders disagree\n", e->name);
+      return 1;
+    }
+
+    double old_ns = _bench(_decode_old, e->json, len, nb_iterations);
+    double new_ns = _bench(_decode_new, e->json, len, nb_iterations);
+    printf("%-24s %8d %10.0f %10.0f %7.1fx\n", e->name, len, old_ns, new_ns, old_ns / new_ns);
+  }
+  return 0;
+}
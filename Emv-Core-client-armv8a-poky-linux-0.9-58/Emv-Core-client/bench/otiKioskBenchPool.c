@@ -0,0 +1,114 @@
+/*
+ * otiKioskBenchPool.c
+ *
+ * Measures how long back-to-back payments wait for a reader of a pool (see libotikiosk_pool.h): each payment is
+ * started as soon as the TransactionComplete of the previous one is received, and the time PayTransaction takes,
+ * queueing included, is reported.
+ *
+ * usage: otiKioskBenchPool -u <dir> [-n <payments>] [-p <status poll ms>]
+ *   -u  Kiosk Core Unix sockets directory, of one reader (a simulator: otiKioskSimulator -u <dir>)
+ *   -n  number of payments (default 10)
+ *   -p  status poll period of the pool (default 1000)
+ *
+ * The reader must finish each transaction by itself, as the simulator does. A reader that stays unroutable until
+ * the next status poll shows up as waits of up to the poll period. Exits with 1 if a payment fails.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libotikiosk_pool.h"
+
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _cond = PTHREAD_COND_INITIALIZER;
+static unsigned int _completed;
+
+static double _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void _trans_complete(LibOtiKiosk_Pool* pool, int reader_index, otiKioskPaymentResponse* resp, void* user_data) {
+  pthread_mutex_lock(&_mutex);
+  _completed++;
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+static void _wait_completed(unsigned int n) {
+  pthread_mutex_lock(&_mutex);
+  while(_completed < n)
+    pthread_cond_wait(&_cond, &_mutex);
+  pthread_mutex_unlock(&_mutex);
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s -u <dir> [-n <payments>] [-p <status poll ms>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* unix_dir = NULL;
+  unsigned int nb_payments = 10;
+  unsigned int status_poll_ms = 1000;
+  int opt;
+
+  while((opt = getopt(argc, argv, "u:n:p:")) != -1) {
+    switch(opt) {
+    case 'u': unix_dir = optarg; break;
+    case 'n': nb_payments = strtoul(optarg, NULL, 0); break;
+    case 'p': status_poll_ms = strtoul(optarg, NULL, 0); break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(unix_dir == NULL || nb_payments == 0) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  LibOtiKiosk_Enable_Debug_Logs(false);
+  LibOtiKiosk_PoolEndpoint endpoint = {unix_dir, true};
+  LibOtiKiosk_Pool* pool = LibOtiKiosk_Pool_Create(&endpoint, 1, status_poll_ms, 1);
+  if(pool == NULL) {
+    fprintf(stderr, "failed to create the pool\n");
+    return 1;
+  }
+  LibOtiKiosk_Pool_Register_TransactionComplete_Callback(pool, _trans_complete, NULL);
+
+  otiKioskPaymentParameters params;
+  memset(&params, 0, sizeof(params));
+  params.amount_cents = 100;
+  params.currency_code = 978;
+  params.timeout_sec = 60;
+
+  // the first payment waits for the first poll, it isn't counted
+  int ret = LibOtiKiosk_Pool_PayTransaction(pool, &params, status_poll_ms * 3, NULL);
+  double total_ms = 0, max_ms = 0;
+  for(unsigned int i = 1; i <= nb_payments && ret == KIOSK_RET_OK; i++) {
+    _wait_completed(i);
+    double start = _now_ms();
+    ret = LibOtiKiosk_Pool_PayTransaction(pool, &params, status_poll_ms * 3, NULL);
+    double wait_ms = _now_ms() - start;
+    total_ms += wait_ms;
+    if(wait_ms > max_ms)
+      max_ms = wait_ms;
+  }
+  if(ret == KIOSK_RET_OK)
+    _wait_completed(nb_payments + 1);
+  LibOtiKiosk_Pool_Destroy(pool);
+
+  if(ret != KIOSK_RET_OK) {
+    fprintf(stderr, "payment failed: %d\n", ret);
+    return 1;
+  }
+  printf("%u payments, status poll %u ms: PayTransaction took %.1f ms on average, %.1f ms at most\n", nb_payments,
+      status_poll_ms, total_ms / nb_payments, max_ms);
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * otiKioskBenchScan.c
+ *
+ * Checks the bulk string scanners of mjson (mjson_find_special(), mjson_ascii_run() and mjson_pass_string() built
+ * on them) against the byte-by-byte loops they replaced, then times both.
+ *
+ * usage: otiKioskBenchScan [-n <checks>] [-r <seed>]
+ *   -n  number of random strings checked (default 1000000)
+ *   -r  seed of the random strings (default 1)
+ *
+ * mjson.c is compiled into the program, with the same target flags, so the code path checked is the one selected
+ * for this build: AVX2 (-mavx2), SSE2 (x86_64), NEON (aarch64) or the scalar loop. The random strings are placed
+ * at every alignment, with lengths around the 16 and 32 byte blocks, and with each special byte at every position
+ * of a block. Exits with 1 on the first mismatch.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "src/mjson.c"
+
+#if defined(__AVX2__)
+#define SCAN_PATH "AVX2"
+#elif defined(__SSE2__)
+#define SCAN_PATH "SSE2"
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define SCAN_PATH "NEON"
+#else
+#define SCAN_PATH "scalar"
+#endif
+
+#define MAX_LEN 256
+#define BENCH_LEN 4096
+#define BENCH_ROUNDS 20000
+
+static uint32_t _seed = 1;
+
+static uint32_t _random(void) {
+  // xorshift32, reproducible on every target
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  return _seed;
+}
+
+// the loops the scanners replaced
+static int _find_special_ref(const char* s, int len) {
+  int i;
+  for(i = 0; i < len; i++) {
+    if(s[i] == '"' || s[i] == '\\' || s[i] == '\0')
+      break;
+  }
+  return i;
+}
+
+static int _ascii_run_ref(const char* s, int len) {
+  int i;
+  for(i = 0; i < len; i++) {
+    if((unsigned char) s[i] >= 0x80)
+      break;
+  }
+  return i;
+}
+
+static int _pass_string_ref(const char* s, int len) {
+  int i;
+  for(i = 0; i < len; i++) {
+    if(s[i] == '\\' && i + 1 < len && mjson_esc(s[i + 1], 1)) {
+      i++;
+    } else if(s[i] == '\0') {
+      return MJSON_ERROR_INVALID_INPUT;
+    } else if(s[i] == '"') {
+      return i;
+    }
+  }
+  return MJSON_ERROR_INVALID_INPUT;
+}
+
+static char _random_char(void) {
+  static const char specials[] = "\"\\\0nu/\x80\xc3\xff";
+  uint32_t r = _random() % 100;
+  if(r < 85)
+    return (char)('!' + _random() % 94); // printable ASCII, quotes and backslashes included
+  return specials[_random() % (sizeof(specials) - 1)];
+}
+
+// dense: any byte anywhere, sparse: a plain run with at most one special byte, to hit every lane of a block
+static void _fill(char* s, int len, bool dense) {
+  for(int i = 0; i < len; i++)
+    s[i] = dense ? _random_char() : (char)('A' + _random() % 26);
+  if(!dense && len > 0 && _random() % 8 != 0) {
+    static const char specials[] = "\"\\\0\x80\xff";
+    s[_random() % len] = specials[_random() % (sizeof(specials) - 1)];
+  }
+}
+
+static bool _check(const char* name, const char* s, int len, int got, int expected) {
+  if(got == expected)
+    return true;
+  printf("%s mismatch: got %d expected %d, len %d, offset %d:", name, got, expected, len, (int)((uintptr_t) s % 32));
+  for(int i = 0; i < len; i++)
+    printf(" %02x", (unsigned char) s[i]);
+  printf("\n");
+  return false;
+}
+
+static bool _run_checks(unsigned int nb_checks) {
+  static char buf[MAX_LEN + 64];
+  for(unsigned int n = 0; n < nb_checks; n++) {
+    int offset = _random() % 32;
+    // mostly around the block sizes, where the SIMD loops hand over to the tail
+    int len = _random() % 4 == 0 ? (int)(_random() % MAX_LEN) : (int)(_random() % 72);
+    char* s = buf + offset;
+    _fill(s, len, n % 2 == 0);
+    // bytes past the end must never be looked at
+    memset(s + len, '"', sizeof(buf) - offset - len);
+
+    if(!_check("mjson_find_special", s, len, mjson_find_special(s, len), _find_special_ref(s, len)) ||
+       !_check("mjson_ascii_run", s, len, mjson_ascii_run(s, len), _ascii_run_ref(s, len)) ||
+       !_check("mjson_pass_string", s, len, mjson_pass_string(s, len), _pass_string_ref(s, len)))
+      return false;
+  }
+  return true;
+}
+
+static double _now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _bench(const char* name, int (*fn)(const char*, int), const char* s, int len) {
+  volatile int sink = 0;
+  double start = _now_s();
+  for(int r = 0; r < BENCH_ROUNDS; r++)
+    sink += fn(s, len);
+  double elapsed = _now_s() - start;
+  (void) sink;
+  printf("  %-22s %8.0f MB/s\n", name, (double) len * BENCH_ROUNDS / elapsed / 1e6);
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-n <checks>] [-r <seed>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int nb_checks = 1000000;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch(opt) {
+    case 'n': nb_checks = strtoul(optarg, NULL, 0); break;
+    case 'r': _seed = strtoul(optarg, NULL, 0); if(_seed == 0) _seed = 1; break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+
+  printf("scan path: %s\n", SCAN_PATH);
+  if(!_run_checks(nb_checks))
+    return 1;
+  printf("%u random strings, identical results\n", nb_checks);
+
+  // a long string of card token characters, as in the TransactionComplete events
+  static char token[BENCH_LEN + 1];
+  for(int i = 0; i < BENCH_LEN; i++)
+    token[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[_random() % 64];
+  token[BENCH_LEN] = '"';
+
+  printf("%d byte string, %d rounds:\n", BENCH_LEN, BENCH_ROUNDS);
+  _bench("mjson_find_special", mjson_find_special, token, BENCH_LEN);
+  _bench("byte loop", _find_special_ref, token, BENCH_LEN);
+  _bench("mjson_ascii_run", mjson_ascii_run, token, BENCH_LEN);
+  _bench("byte loop", _ascii_run_ref, token, BENCH_LEN);
+  _bench("mjson_pass_string", mjson_pass_string, token, BENCH_LEN + 1);
+  _bench("byte loop", _pass_string_ref, token, BENCH_LEN + 1);
+  return 0;
+}
@@ -0,0 +1,709 @@
+/*
+ * otiKioskBroker.c
+ *
+ * Shares the Kiosk Core connection between several local processes (UI, telemetry agent, maintenance tools).
+ * The broker holds the only upstream connection, through libotikiosk, and serves its clients on Unix sockets laid
+ * out like the Kiosk Core ones: the clients use libotikiosk unchanged, pointed at the broker directory.
+ *
+ * usage: otiKioskBroker [options] -L <dir>
+ *   -L <dir>      listen on <dir>/socket_cmd and <dir>/socket_events
+ *   -u <dir>      Kiosk Core Unix sockets directory
+ *   -t <address>  Kiosk Core TCP address, on the default ports
+ *   -s <ms>       maximum age of a cached GetStatus result (default 500)
+ *   -T <ms>       timeout of the upstream calls (default 1000)
+ *   -v            print the messages
+ *
+ * Requests are sent upstream one at a time with an id of the broker, and the response gets the client's id back.
+ * GetKioskID and GetVersion are answered from the result of the first call, GetStatus from a result at most -s ms
+ * old, so the upstream load doesn't grow with the number of clients. The cache is dropped when the upstream
+ * connection is lost, and the status when a command or an event may have changed it.
+ *
+ * Events are forwarded as received: TransactionComplete to all the commands clients, ReaderMessageEvent to all the
+ * events clients. Kiosk Core is acknowledged by the broker, the acknowledgements of the clients are dropped.
+ * MessagePack requests (see kiosk_msgpack.h) are sent upstream in JSON, and answered in MessagePack.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "libotikiosk.h"
+#include "src/mjson.h"
+#include "src/kiosk_commands.h"
+#include "src/kiosk_msgpack.h"
+
+#define BRK_MAX_CLIENTS 32
+#define BRK_IN_BUF_SIZE 4096
+#define BRK_RESP_MAX_SIZE 4096
+#define BRK_CACHE_SIZE 8
+#define BRK_CACHE_KEY_SIZE 128
+#define BRK_CACHE_RESULT_SIZE 256
+#define BRK_SEND_TIMEOUT_MS 1000
+
+typedef struct {
+  int fd; // -1 when the slot is free
+  bool is_commands;
+  uint32_t serial; // tells the successive clients of a slot apart
+  struct msgpack_framer framer;
+  char in[BRK_IN_BUF_SIZE];
+} BrkClient;
+
+// request for the upstream thread, or message for the clients
+typedef struct BrkMsg {
+  struct BrkMsg* next;
+  int slot; // client slot, -1 for all the clients of a kind
+  bool is_commands; // kind of clients of a broadcast
+  uint32_t serial;
+  bool binary; // request received in MessagePack, to be answered in MessagePack
+  int len;
+  char data[];
+} BrkMsg;
+
+typedef struct {
+  BrkMsg* head;
+  BrkMsg* tail;
+} BrkQueue;
+
+// result of a cacheable request
+typedef struct {
+  bool valid;
+  uint32_t epoch; // upstream connection the result came from
+  uint64_t stamp_us;
+  int key_len;
+  char key[BRK_CACHE_KEY_SIZE]; // method and params of the request
+  int result_len;
+  char result[BRK_CACHE_RESULT_SIZE]; // JSON result
+} BrkCacheEntry;
+
+static struct {
+  bool verbose;
+  unsigned int status_max_age_ms;
+  unsigned int timeout_ms;
+} _config = {false, 500, 1000};
+
+static struct {
+  uint64_t requests;
+  uint64_t upstream_calls;
+  uint64_t cache_hits;
+  uint64_t upstream_errors;
+  uint64_t events;
+  uint64_t acks;
+} _stats;
+
+static volatile sig_atomic_t _running = 1;
+static BrkClient _clients[BRK_MAX_CLIENTS];
+static uint32_t _next_serial = 1;
+static LibOtiKiosk_Context* _upstream;
+static int _next_upstream_id = 1000; // upstream thread only
+
+// requests, from the main loop to the upstream thread
+static pthread_mutex_t _requests_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _requests_cond = PTHREAD_COND_INITIALIZER;
+static BrkQueue _requests;
+
+// messages for the clients, from the upstream and library threads to the main loop, which is woken by the pipe
+static pthread_mutex_t _outbox_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BrkQueue _outbox;
+static int _wake_pipe[2] = {-1, -1};
+
+static pthread_mutex_t _cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BrkCacheEntry _cache[BRK_CACHE_SIZE];
+
+static const char* const _request_keys[] = {"id", "method", "params"};
+enum {
+  REQ_ID,
+  REQ_METHOD,
+  REQ_PARAMS,
+  REQ_NB_MEMBERS
+};
+
+static uint64_t _now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void _sig_handler(int sig) {
+  _running = 0;
+}
+
+static BrkMsg* _msg_new(int slot, uint32_t serial, bool binary, const char* data, int len) {
+  BrkMsg* msg = malloc(sizeof(BrkMsg) + len);
+  if(msg == NULL) {
+    fprintf(stderr, "failed to allocate %d bytes\n", len);
+    return NULL;
+  }
+  msg->next = NULL;
+  msg->slot = slot;
+  msg->is_commands = true;
+  msg->serial = serial;
+  msg->binary = binary;
+  msg->len = len;
+  memcpy(msg->data, data, len);
+  return msg;
+}
+
+static void _queue_push(BrkQueue* q, BrkMsg* msg) {
+  if(q->tail != NULL)
+    q->tail->next = msg;
+  else
+    q->head = msg;
+  q->tail = msg;
+}
+
+static BrkMsg* _queue_pop(BrkQueue* q) {
+  BrkMsg* msg = q->head;
+  if(msg != NULL) {
+    q->head = msg->next;
+    if(q->head == NULL)
+      q->tail = NULL;
+  }
+  return msg;
+}
+
+static void _queue_free(BrkQueue* q) {
+  BrkMsg* msg;
+  while((msg = _queue_pop(q)) != NULL)
+    free(msg);
+}
+
+static void _post(BrkMsg* msg) {
+  if(msg == NULL)
+    return;
+  pthread_mutex_lock(&_outbox_mutex);
+  _queue_push(&_outbox, msg);
+  pthread_mutex_unlock(&_outbox_mutex);
+  char c = 0;
+  if(write(_wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+    fprintf(stderr, "failed to wake the main loop: %s\n", strerror(errno));
+}
+
+// queues a JSON response for a client, converted to MessagePack if the request was
+static void _post_reply(int slot, uint32_t serial, bool binary, const char* json, int len) {
+  if(_config.verbose)
+    printf("-> %d: %s%.*s\n", slot, binary ? "(msgpack) " : "", len, json);
+  if(!binary) {
+    _post(_msg_new(slot, serial, false, json, len));
+    return;
+  }
+
+  char* buf;
+  int n = msgpack_from_json_alloc(json, len, &buf);
+  if(n < 0)
+    fprintf(stderr, "failed to encode %.*s\n", len, json);
+  else
+    _post(_msg_new(slot, serial, true, buf, n));
+  free(buf);
+}
+
+// JSON-RPC response to a request, id being the JSON token of the request id
+static void _post_result(int slot, uint32_t serial, bool binary, const char* id, int id_len, const char* result, int result_len) {
+  char* buf = NULL;
+  struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(&buf);
+  int len = mjson_printf(&out, "{%Q:%Q,%Q:%.*s,%Q:%.*s}", "jsonrpc", "2.0", "result", result_len, result, "id", id_len, id);
+  _post_reply(slot, serial, binary, buf, len);
+  free(buf);
+}
+
+static void _post_error(int slot, uint32_t serial, bool binary, const char* id, int id_len, const char* message) {
+  char* buf = NULL;
+  struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(&buf);
+  int len = mjson_printf(&out, "{%Q:%Q,%Q:{%Q:%d,%Q:%Q},%Q:%.*s}", "jsonrpc", "2.0", "error", "code", -32000, "message", message,
+      "id", id_len, id);
+  _post_reply(slot, serial, binary, buf, len);
+  free(buf);
+}
+
+// changes on every loss of the upstream connection, the cached results are only valid for the connection they came from
+static uint32_t _upstream_epoch(void) {
+  LibOtiKiosk_Stats stats;
+  if(LibOtiKiosk_Ctx_Get_Stats(_upstream, &stats) != KIOSK_RET_OK)
+    return 0;
+  return stats.connect_failures + stats.reconnects + stats.failovers;
+}
+
+static bool _method_is(const char* json, const kiosk_json_span* method, const char* name) {
+  int len = strlen(name);
+  return method->tok == MJSON_TOK_STRING && method->len == len + 2 && memcmp(json + method->off + 1, name, len) == 0;
+}
+
+// maximum age of the cached results of a request, 0 if they never expire, false if it isn't cacheable
+static bool _cache_max_age_us(const char* json, const kiosk_json_span* spans, uint64_t* out_max_age_us) {
+  const kiosk_json_span* method = &spans[REQ_METHOD];
+  if(_method_is(json, method, KIOSK_METHOD_GET_STATUS)) {
+    *out_max_age_us = (uint64_t)_config.status_max_age_ms * 1000;
+    return _config.status_max_age_ms > 0;
+  }
+  *out_max_age_us = 0;
+  return _method_is(json, method, KIOSK_METHOD_GET_KIOSK_ID) || _method_is(json, method, KIOSK_METHOD_GET_VERSION);
+}
+
+// method and params of a request, the results of GetVersion depend on the component
+static int _cache_key(const char* json, const kiosk_json_span* spans, char* out_key) {
+  const kiosk_json_span* method = &spans[REQ_METHOD];
+  const kiosk_json_span* params = &spans[REQ_PARAMS];
+  if(method->len + params->len > BRK_CACHE_KEY_SIZE)
+    return -1;
+  memcpy(out_key, json + method->off, method->len);
+  memcpy(out_key + method->len, json + params->off, params->len);
+  return method->len + params->len;
+}
+
+static BrkCacheEntry* _cache_find(const char* key, int key_len) {
+  for(int i = 0; i < BRK_CACHE_SIZE; i++) {
+    if(_cache[i].valid && _cache[i].key_len == key_len && memcmp(_cache[i].key, key, key_len) == 0)
+      return &_cache[i];
+  }
+  return NULL;
+}
+
+// answers a request from the cache, false if it has to go upstream
+static bool _cache_reply(int slot, uint32_t serial, bool binary, const char* json, const kiosk_json_span* spans) {
+  uint64_t max_age_us;
+  char key[BRK_CACHE_KEY_SIZE];
+  int key_len;
+  if(!_cache_max_age_us(json, spans, &max_age_us) || (key_len = _cache_key(json, spans, key)) < 0)
+    return false;
+
+  uint32_t epoch = _upstream_epoch();
+  char result[BRK_CACHE_RESULT_SIZE];
+  int result_len = 0;
+  pthread_mutex_lock(&_cache_mutex);
+  BrkCacheEntry* entry = _cache_find(key, key_len);
+  if(entry != NULL && entry->epoch == epoch && (max_age_us == 0 || _now_us() - entry->stamp_us <= max_age_us)) {
+    result_len = entry->result_len;
+    memcpy(result, entry->result, result_len);
+  }
+  pthread_mutex_unlock(&_cache_mutex);
+
+  if(result_len == 0)
+    return false;
+  _post_result(slot, serial, binary, json + spans[REQ_ID].off, spans[REQ_ID].len, result, result_len);
+  __atomic_add_fetch(&_stats.cache_hits, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+static void _cache_store(const char* json, const kiosk_json_span* spans, uint32_t epoch, const char* result, int result_len) {
+  char key[BRK_CACHE_KEY_SIZE];
+  int key_len = _cache_key(json, spans, key);
+  if(key_len < 0 || result_len > BRK_CACHE_RESULT_SIZE)
+    return;
+
+  pthread_mutex_lock(&_cache_mutex);
+  BrkCacheEntry* entry = _cache_find(key, key_len);
+  for(int i = 0; entry == NULL && i < BRK_CACHE_SIZE; i++) {
+    if(!_cache[i].valid)
+      entry = &_cache[i];
+  }
+  if(entry != NULL) {
+    entry->valid = true;
+    entry->epoch = epoch;
+    entry->stamp_us = _now_us();
+    entry->key_len = key_len;
+    memcpy(entry->key, key, key_len);
+    entry->result_len = result_len;
+    memcpy(entry->result, result, result_len);
+  }
+  pthread_mutex_unlock(&_cache_mutex);
+}
+
+// the status changes with the transactions
+static void _cache_drop_status(void) {
+  static const char key[] = "\"" KIOSK_METHOD_GET_STATUS "\"";
+  pthread_mutex_lock(&_cache_mutex);
+  for(int i = 0; i < BRK_CACHE_SIZE; i++) {
+    if(_cache[i].valid && _cache[i].key_len >= (int)sizeof(key) - 1 && memcmp(_cache[i].key, key, sizeof(key) - 1) == 0)
+      _cache[i].valid = false;
+  }
+  pthread_mutex_unlock(&_cache_mutex);
+}
+
+// copy of a JSON message with the value of a member replaced
+static char* _replace_value(const char* json, int len, const kiosk_json_span* span, const char* value, int value_len, int* out_len) {
+  *out_len = len - span->len + value_len;
+  char* out = malloc(*out_len);
+  if(out == NULL)
+    return NULL;
+  memcpy(out, json, span->off);
+  memcpy(out + span->off, value, value_len);
+  memcpy(out + span->off + value_len, json + span->off + span->len, len - span->off - span->len);
+  return out;
+}
+
+// sends a request upstream with an id of the broker, and gives the response the id of the request
+static void _forward_request(const BrkMsg* req) {
+  kiosk_json_span spans[REQ_NB_MEMBERS];
+  if(scan_members(req->data, req->len, false, _request_keys, spans, REQ_NB_MEMBERS) != KIOSK_RET_OK)
+    return;
+  const char* id = req->data + spans[REQ_ID].off;
+  int id_len = spans[REQ_ID].len;
+
+  // requests queued behind the one that filled the cache
+  if(_cache_reply(req->slot, req->serial, req->binary, req->data, spans))
+    return;
+
+  char upstream_id[16];
+  int upstream_id_len = snprintf(upstream_id, sizeof(upstream_id), "%d", _next_upstream_id);
+  _next_upstream_id = _next_upstream_id == INT32_MAX ? 1000 : _next_upstream_id + 1;
+  int cmd_len;
+  char* cmd = _replace_value(req->data, req->len, &spans[REQ_ID], upstream_id, upstream_id_len, &cmd_len);
+  if(cmd == NULL)
+    return;
+
+  uint32_t epoch = _upstream_epoch();
+  char resp[BRK_RESP_MAX_SIZE];
+  int resp_len = sizeof(resp);
+  __atomic_add_fetch(&_stats.upstream_calls, 1, __ATOMIC_RELAXED);
+  KIOSK_RET ret = LibOtiKiosk_Ctx_Call(_upstream, cmd, cmd_len, resp, &resp_len, _config.timeout_ms);
+  free(cmd);
+
+  static const char* const resp_keys[] = {"id", "result"};
+  kiosk_json_span resp_spans[2];
+  if(ret == KIOSK_RET_OK && (resp_len == 0 || MSGPACK_IS_MAP_HEADER(resp[0]) || scan_members(resp, resp_len, false, resp_keys, resp_spans, 2) != KIOSK_RET_OK))
+    ret = KIOSK_RET_PARSING_ERROR;
+  if(ret != KIOSK_RET_OK) {
+    __atomic_add_fetch(&_stats.upstream_errors, 1, __ATOMIC_RELAXED);
+    _post_error(req->slot, req->serial, req->binary, id, id_len, ret == KIOSK_RET_COMM_ERROR ? "Kiosk Core unreachable" : "invalid Kiosk Core response");
+    return;
+  }
+
+  // only the messages on the display leave the status as it was
+  uint64_t max_age_us;
+  if(!_cache_max_age_us(req->data, spans, &max_age_us)) {
+    if(!_method_is(req->data, &spans[REQ_METHOD], KIOSK_METHOD_SHOW_MESSAGE))
+      _cache_drop_status();
+  } else if(resp_spans[1].len > 0)
+    _cache_store(req->data, spans, epoch, resp + resp_spans[1].off, resp_spans[1].len);
+
+  int reply_len;
+  char* reply = _replace_value(resp, resp_len, &resp_spans[0], id, id_len, &reply_len);
+  if(reply != NULL)
+    _post_reply(req->slot, req->serial, req->binary, reply, reply_len);
+  free(reply);
+}
+
+// upstream calls are serialized by the library anyway, a single thread keeps the main loop responsive
+static void* _upstream_loop(void* arg) {
+  while(true) {
+    pthread_mutex_lock(&_requests_mutex);
+    while(_running && _requests.head == NULL)
+      pthread_cond_wait(&_requests_cond, &_requests_mutex);
+    BrkMsg* req = _running ? _queue_pop(&_requests) : NULL;
+    pthread_mutex_unlock(&_requests_mutex);
+    if(req == NULL)
+      break;
+    _forward_request(req);
+    free(req);
+  }
+  return NULL;
+}
+
+static void _raw_event(LibOtiKiosk_Context* ctx, bool commands_socket, const char* msg, int msg_len, void* user_data) {
+  if(_config.verbose)
+    printf("event: %.*s\n", MSGPACK_IS_MAP_HEADER(msg[0]) ? 0 : msg_len, msg);
+  // a TransactionComplete ends the transaction
+  if(commands_socket)
+    _cache_drop_status();
+
+  BrkMsg* event = _msg_new(-1, 0, false, msg, msg_len);
+  if(event != NULL) {
+    event->is_commands = commands_socket;
+    _post(event);
+  }
+}
+
+static void _client_close(BrkClient* c) {
+  if(_config.verbose)
+    printf("%s client %d disconnected\n", c->is_commands ? "commands" : "events", (int)(c - _clients));
+  close(c->fd);
+  c->fd = -1;
+}
+
+static void _client_send(BrkClient* c, const char* data, int len) {
+  int off = 0;
+  while(off < len) {
+    int n = send(c->fd, data + off, len - off, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0) {
+      fprintf(stderr, "failed to send to %s client %d: %s\n", c->is_commands ? "commands" : "events", (int)(c - _clients), strerror(errno));
+      _client_close(c);
+      return;
+    }
+    off += n;
+  }
+}
+
+static void _flush_outbox(void) {
+  char drain[64];
+  while(read(_wake_pipe[0], drain, sizeof(drain)) > 0);
+
+  pthread_mutex_lock(&_outbox_mutex);
+  BrkQueue outbox = _outbox;
+  _outbox.head = _outbox.tail = NULL;
+  pthread_mutex_unlock(&_outbox_mutex);
+
+  BrkMsg* msg;
+  while((msg = _queue_pop(&outbox)) != NULL) {
+    if(msg->slot >= 0) {
+      // the client may have left while its request was upstream
+      BrkClient* c = &_clients[msg->slot];
+      if(c->fd >= 0 && c->serial == msg->serial)
+        _client_send(c, msg->data, msg->len);
+    } else {
+      for(int i = 0; i < BRK_MAX_CLIENTS; i++) {
+        if(_clients[i].fd >= 0 && _clients[i].is_commands == msg->is_commands) {
+          _client_send(&_clients[i], msg->data, msg->len);
+          _stats.events++;
+        }
+      }
+    }
+    free(msg);
+  }
+}
+
+static void _handle_frame(BrkClient* c, const char* frame, int len) {
+  if(!c->is_commands)
+    return;
+
+  // requests are handled in JSON, MessagePack ones are converted
+  bool binary = MSGPACK_IS_MAP_HEADER(frame[0]);
+  char* json = NULL;
+  if(binary) {
+    struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(&json);
+    len = msgpack_to_json(frame, len, &out);
+    frame = json;
+  }
+  kiosk_json_span spans[REQ_NB_MEMBERS];
+  if(len < 0 || scan_members(frame, len, false, _request_keys, spans, REQ_NB_MEMBERS) != KIOSK_RET_OK) {
+    fprintf(stderr, "invalid message from client %d dropped\n", (int)(c - _clients));
+    free(json);
+    return;
+  }
+  if(_config.verbose)
+    printf("<- %d: %s%.*s\n", (int)(c - _clients), binary ? "(msgpack) " : "", len, frame);
+
+  int slot = c - _clients;
+  if(spans[REQ_METHOD].len == 0) {
+    // acknowledgement of a forwarded event, Kiosk Core was acknowledged by the broker
+    _stats.acks++;
+  } else if(spans[REQ_ID].len == 0) {
+    fprintf(stderr, "notification from client %d dropped, Kiosk Core only takes requests\n", slot);
+  } else {
+    _stats.requests++;
+    BrkMsg* req;
+    if(!_cache_reply(slot, c->serial, binary, frame, spans) && (req = _msg_new(slot, c->serial, binary, frame, len)) != NULL) {
+      pthread_mutex_lock(&_requests_mutex);
+      _queue_push(&_requests, req);
+      pthread_cond_signal(&_requests_cond);
+      pthread_mutex_unlock(&_requests_mutex);
+    }
+  }
+  free(json);
+}
+
+static bool _client_frame(const char* frame, int len, void* ud) {
+  BrkClient* c = ud;
+  _handle_frame(c, frame, len);
+  return c->fd >= 0;
+}
+
+// same framing as the library: JSON values or MessagePack maps, back to back
+static void _client_read(BrkClient* c) {
+  int n = read(c->fd, c->in + c->framer.filled, sizeof(c->in) - c->framer.filled);
+  if(n < 0 && errno == EINTR)
+    return;
+  if(n <= 0) {
+    _client_close(c);
+    return;
+  }
+
+  if(msgpack_framer_feed(&c->framer, c->in, n, _client_frame, c) < 0) {
+    fprintf(stderr, "invalid data received, closing client %d\n", (int)(c - _clients));
+    _client_close(c);
+    return;
+  }
+  if(c->framer.filled == (int)sizeof(c->in)) {
+    fprintf(stderr, "message longer than %d bytes, closing client %d\n", BRK_IN_BUF_SIZE, (int)(c - _clients));
+    _client_close(c);
+  }
+}
+
+static void _client_accept(int listen_fd, bool is_commands) {
+  int fd = accept(listen_fd, NULL, NULL);
+  if(fd < 0)
+    return;
+
+  for(int i = 0; i < BRK_MAX_CLIENTS; i++) {
+    BrkClient* c = &_clients[i];
+    if(c->fd < 0) {
+      memset(c, 0, sizeof(BrkClient));
+      c->fd = fd;
+      c->is_commands = is_commands;
+      c->serial = _next_serial++;
+      msgpack_framer_init(&c->framer);
+      // a stuck client is dropped rather than stalling the others
+      struct timeval tv = {BRK_SEND_TIMEOUT_MS / 1000, (BRK_SEND_TIMEOUT_MS % 1000) * 1000};
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      if(_config.verbose)
+        printf("%s client %d connected\n", is_commands ? "commands" : "events", i);
+      return;
+    }
+  }
+  fprintf(stderr, "too many clients, connection refused\n");
+  close(fd);
+}
+
+static int _listen_unix(const char* dir, const char* name) {
+  int fd = msgpack_listen_unix(dir, name, BRK_MAX_CLIENTS);
+  if(fd < 0)
+    fprintf(stderr, "failed to listen on %s/%s: %s\n", dir, name, strerror(errno));
+  return fd;
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s -L <dir> (-u <dir> | -t <address>) [-s <status max age ms>] [-T <timeout ms>] [-v]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* listen_dir = NULL;
+  const char* unix_dir = NULL;
+  const char* tcp_address = NULL;
+  int opt;
+
+  while((opt = getopt(argc, argv, "L:u:t:s:T:v")) != -1) {
+    switch(opt) {
+    case 'L': listen_dir = optarg; break;
+    case 'u': unix_dir = optarg; break;
+    case 't': tcp_address = optarg; break;
+    case 's': _config.status_max_age_ms = atoi(optarg); break;
+    case 'T': _config.timeout_ms = atoi(optarg); break;
+    case 'v': _config.verbose = true; break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(listen_dir == NULL || (unix_dir == NULL) == (tcp_address == NULL)) {
+    _usage(argv[0]);
+    return 1;
+  }
+  if(unix_dir != NULL && strcmp(unix_dir, listen_dir) == 0) {
+    fprintf(stderr, "the broker can't listen in the Kiosk Core directory\n");
+    return 1;
+  }
+
+  if(pipe(_wake_pipe) != 0 || fcntl(_wake_pipe[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(_wake_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+    fprintf(stderr, "failed to create the wake up pipe: %s\n", strerror(errno));
+    return 1;
+  }
+
+  int cmd_fd = _listen_unix(listen_dir, "socket_cmd");
+  int evt_fd = _listen_unix(listen_dir, "socket_events");
+  if(cmd_fd < 0 || evt_fd < 0)
+    return 1;
+
+  // the signals are only taken by the main loop, the other threads are started with them blocked
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  _upstream = LibOtiKiosk_Ctx_Create(unix_dir != NULL ? unix_dir : tcp_address, unix_dir != NULL);
+  if(_upstream == NULL) {
+    fprintf(stderr, "failed to create the Kiosk Core connection\n");
+    return 1;
+  }
+  LibOtiKiosk_Ctx_Register_RawEvent_Callback(_upstream, _raw_event, NULL);
+
+  for(int i = 0; i < BRK_MAX_CLIENTS; i++)
+    _clients[i].fd = -1;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = _sig_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  pthread_t upstream_thread;
+  pthread_create(&upstream_thread, NULL, _upstream_loop, NULL);
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+  printf("Kiosk broker ready on %s, status cached for %u ms\n", listen_dir, _config.status_max_age_ms);
+  fflush(stdout);
+  uint64_t start_us = _now_us();
+
+  while(_running) {
+    struct pollfd fds[BRK_MAX_CLIENTS + 3];
+    BrkClient* polled[BRK_MAX_CLIENTS];
+    int nb_fds = 0;
+    fds[nb_fds++] = (struct pollfd){_wake_pipe[0], POLLIN, 0};
+    fds[nb_fds++] = (struct pollfd){cmd_fd, POLLIN, 0};
+    fds[nb_fds++] = (struct pollfd){evt_fd, POLLIN, 0};
+    for(int i = 0; i < BRK_MAX_CLIENTS; i++) {
+      if(_clients[i].fd >= 0) {
+        polled[nb_fds - 3] = &_clients[i];
+        fds[nb_fds++] = (struct pollfd){_clients[i].fd, POLLIN, 0};
+      }
+    }
+
+    if(poll(fds, nb_fds, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      fprintf(stderr, "poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if(fds[1].revents & POLLIN)
+      _client_accept(cmd_fd, true);
+    if(fds[2].revents & POLLIN)
+      _client_accept(evt_fd, false);
+    for(int i = 3; i < nb_fds; i++) {
+      BrkClient* c = polled[i - 3];
+      if(c->fd == fds[i].fd && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        _client_read(c);
+    }
+    // cache hits are answered in the same iteration
+    _flush_outbox();
+  }
+
+  pthread_mutex_lock(&_requests_mutex);
+  pthread_cond_signal(&_requests_cond);
+  pthread_mutex_unlock(&_requests_mutex);
+  pthread_join(upstream_thread, NULL);
+  LibOtiKiosk_Ctx_Destroy(_upstream);
+
+  double elapsed = (_now_us() - start_us) / 1e6;
+  printf("\n%llu requests, %llu upstream calls, %llu answered from the cache, %llu upstream errors, %llu events forwarded, %llu acknowledged in %.1f s\n",
+      (unsigned long long)_stats.requests, (unsigned long long)_stats.upstream_calls, (unsigned long long)_stats.cache_hits,
+      (unsigned long long)_stats.upstream_errors, (unsigned long long)_stats.events, (unsigned long long)_stats.acks, elapsed);
+
+  for(int i = 0; i < BRK_MAX_CLIENTS; i++) {
+    if(_clients[i].fd >= 0)
+      _client_close(&_clients[i]);
+  }
+  _queue_free(&_requests);
+  _queue_free(&_outbox);
+  close(cmd_fd);
+  close(evt_fd);
+  close(_wake_pipe[0]);
+  close(_wake_pipe[1]);
+  char path[256];
+  snprintf(path, sizeof(path), "%s/socket_cmd", listen_dir);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/socket_events", listen_dir);
+  unlink(path);
+  return 0;
+}
@@ -9,10 +9,16 @@
 
 #include "libotikiosk_types.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Initializes the kiosk library and starts the connection to the kiosk sockets.
  * @param is_local: uses Unix domain socket if true, TCP sockets if false
  * @param server_address: for Unix domain sockets, path to the folder containing the sockets (can be NULL). For TCP sockets, IP address or hostname of the server (can be NULL, defaults to localhost).
+ * The callbacks and the codec may be set before or after the call, on the default context as well.
+ * Returns false if the library is already initialized.
  */
 bool LibOtiKiosk_Init(const char* server_address, bool is_local);
 
@@ -34,6 +40,29 @@ void LibOtiKiosk_Register_ReaderEvent_Callback(RdrEventCb_t cb);
  */
 void LibOtiKiosk_Enable_Debug_Logs(bool enabled);
 
+/**
+ * Moves the writing of the library's logs (syslog and stdout) to a background thread, so that logging doesn't slow
+ * down the socket threads, even with the debug logs enabled.
+ * The logs wait in a buffer of nb_logs messages. When it is full, they are dropped if drop_on_overflow is set (see
+ * LibOtiKiosk_Get_Dropped_Logs()), otherwise the logging thread waits for room.
+ * Disabling writes the pending logs before returning.
+ */
+KIOSK_RET LibOtiKiosk_Enable_Async_Logs(bool enabled, unsigned int nb_logs, bool drop_on_overflow);
+
+/**
+ * Number of logs dropped because the buffer of the asynchronous logs was full.
+ */
+unsigned long long LibOtiKiosk_Get_Dropped_Logs(void);
+
+/**
+ * Writes the library's logs to a binary file instead of syslog and stdout. The logs record their arguments without
+ * formatting them, which keeps the debug logs cheap enough for the field. The file is rendered as text by the
+ * otiKioskLogDecode tool. A NULL path closes the file and goes back to the text logs.
+ * With LibOtiKiosk_Enable_Async_Logs(), the file is written by the log thread and flushed whenever it is idle,
+ * otherwise it is buffered and flushed after each error log.
+ */
+KIOSK_RET LibOtiKiosk_Enable_Binary_Logs(const char* path);
+
 /**
  * Ask the Kiosk for its current status.
  */
@@ -86,4 +115,128 @@ KIOSK_RET LibOtiKiosk_VoidTransaction(char* transaction_reference);
  */
 KIOSK_RET LibOtiKiosk_CancelTransaction(void);
 
+/**
+ * Send a raw JSON-RPC command and copy the matching response (same "id") in the provided buffer.
+ * Used by the C++ layer (libotikiosk.hpp), which serializes and parses the messages itself.
+ * @param inout_resp_len: size of out_resp on input, length of the received response on output.
+ */
+KIOSK_RET LibOtiKiosk_Call(const char* cmd, int cmd_len, char* out_resp, int* inout_resp_len, int timeout_ms);
+
+/*
+ * Context API
+ *
+ * Each context holds one connection to a Kiosk Core (command and event sockets, pending response, callbacks),
+ * so a single process can drive several readers. The functions above work on a default context, set up by
+ * LibOtiKiosk_Init, and behave exactly like their LibOtiKiosk_Ctx_ counterparts.
+ */
+
+/**
+ * Creates a context and starts the connection to the kiosk sockets.
+ * Same parameters as LibOtiKiosk_Init. Returns NULL on failure.
+ */
+LibOtiKiosk_Context* LibOtiKiosk_Ctx_Create(const char* server_address, bool is_local);
+
+/**
+ * Closes the connection and releases the context. The default context can't be destroyed.
+ * Must not be called from one of the context's callbacks.
+ */
+void LibOtiKiosk_Ctx_Destroy(LibOtiKiosk_Context* ctx);
+
+/**
+ * Creates a context that connects to the first reachable endpoint of the list, in order of preference.
+ * When the connection to the active endpoint is lost or can't be established, the context switches to the next
+ * healthy one. A failing endpoint is retried after a delay that grows with its consecutive failures.
+ * @param connect_timeout_ms: maximum time spent on a TCP connection attempt (0 defaults to 1000ms)
+ */
+LibOtiKiosk_Context* LibOtiKiosk_Ctx_Create_Endpoints(const LibOtiKiosk_Endpoint* endpoints, int nb_endpoints, unsigned int connect_timeout_ms);
+
+/**
+ * Snapshot of the connection statistics of the context.
+ */
+KIOSK_RET LibOtiKiosk_Ctx_Get_Stats(LibOtiKiosk_Context* ctx, LibOtiKiosk_Stats* out_stats);
+
+/**
+ * Selects the encoding of the commands sent by the context (JSON by default). MessagePack is only understood by our
+ * own simulator and broker. Incoming messages are decoded in either encoding, whatever the setting, and the
+ * TransactionComplete acknowledgement mirrors the encoding of the event. LibOtiKiosk_Ctx_Call() still takes JSON
+ * commands, sent as they are given.
+ */
+KIOSK_RET LibOtiKiosk_Ctx_Set_Codec(LibOtiKiosk_Context* ctx, KIOSK_CODEC codec);
+
+/**
+ * Returns the context used by the context-less functions.
+ */
+LibOtiKiosk_Context* LibOtiKiosk_Default_Context(void);
+
+void LibOtiKiosk_Ctx_Register_TransactionComplete_Callback(LibOtiKiosk_Context* ctx, TransactionCompleteCtxCb_t cb, void* user_data);
+void LibOtiKiosk_Ctx_Register_ReaderEvent_Callback(LibOtiKiosk_Context* ctx, RdrEventCtxCb_t cb, void* user_data);
+KIOSK_RET LibOtiKiosk_Ctx_GetStatus(LibOtiKiosk_Context* ctx, KIOSK_STATUS* out_status);
+KIOSK_RET LibOtiKiosk_Ctx_ShowMessage(LibOtiKiosk_Context* ctx, const char* line1, const char* line2);
+KIOSK_RET LibOtiKiosk_Ctx_GetKioskId(LibOtiKiosk_Context* ctx, char* out_id, int max_out_size);
+KIOSK_RET LibOtiKiosk_Ctx_GetKioskVersion(LibOtiKiosk_Context* ctx, char* out_version, int max_out_size);
+KIOSK_RET LibOtiKiosk_Ctx_GetReaderVersion(LibOtiKiosk_Context* ctx, char* out_version, int max_out_size);
+KIOSK_RET LibOtiKiosk_Ctx_PreAuthorize(LibOtiKiosk_Context* ctx, otiKioskPaymentParameters *params);
+KIOSK_RET LibOtiKiosk_Ctx_PayTransaction(LibOtiKiosk_Context* ctx, otiKioskPaymentParameters *params);
+KIOSK_RET LibOtiKiosk_Ctx_ConfirmTransaction(LibOtiKiosk_Context* ctx, uint32_t amount_cents, uint32_t fee_cents, uint32_t product_id, char* transaction_reference);
+KIOSK_RET LibOtiKiosk_Ctx_VoidTransaction(LibOtiKiosk_Context* ctx, char* transaction_reference);
+KIOSK_RET LibOtiKiosk_Ctx_CancelTransaction(LibOtiKiosk_Context* ctx);
+KIOSK_RET LibOtiKiosk_Ctx_Call(LibOtiKiosk_Context* ctx, const char* cmd, int cmd_len, char* out_resp, int* inout_resp_len, int timeout_ms);
+
+/**
+ * Registers a callback receiving every event (message with a method) as it was received, before it is decoded, for
+ * the applications that forward them. commands_socket tells on which socket it arrived: TransactionComplete comes on
+ * the commands socket, ReaderMessageEvent on the events socket. The message is only valid during the callback, which
+ * runs on the socket thread. The other callbacks are still called and TransactionComplete is still acknowledged.
+ */
+void LibOtiKiosk_Ctx_Register_RawEvent_Callback(LibOtiKiosk_Context* ctx, RawEventCtxCb_t cb, void* user_data);
+
+/*
+ * Transaction view
+ *
+ * Alternative to the TransactionComplete callback, for applications that only need some of the fields: the view
+ * reads the event in place and decodes a field only when it's asked for. It points into the reception buffer and is
+ * only valid during the callback.
+ */
+
+/**
+ * Registers a callback receiving a view of each TransactionComplete event. It can be used together with the
+ * TransactionComplete callback, the event is then fully decoded as well.
+ */
+void LibOtiKiosk_Ctx_Register_TransactionView_Callback(LibOtiKiosk_Context* ctx, TransactionViewCtxCb_t cb, void* user_data);
+
+/**
+ * JSON-RPC id of the event.
+ */
+int LibOtiKiosk_View_Get_Id(LibOtiKiosk_TransactionView* view);
+
+/**
+ * Fields of the event. They return KIOSK_RET_PARSING_ERROR if the field is missing or has an unexpected format.
+ */
+KIOSK_RET LibOtiKiosk_View_Get_Status(LibOtiKiosk_TransactionView* view, otiTransactionStatus* out_status);
+KIOSK_RET LibOtiKiosk_View_Get_ErrorCode(LibOtiKiosk_TransactionView* view, int* out_error_code);
+KIOSK_RET LibOtiKiosk_View_Get_ErrorDescription(LibOtiKiosk_TransactionView* view, char* out_description, int max_out_size);
+KIOSK_RET LibOtiKiosk_View_Get_AmountRequested(LibOtiKiosk_TransactionView* view, uint32_t* out_cents);
+KIOSK_RET LibOtiKiosk_View_Get_AmountAuthorized(LibOtiKiosk_TransactionView* view, uint32_t* out_cents);
+
+/**
+ * Any string of "authorizationDetails" (e.g. "CardToken"), unescaped.
+ */
+KIOSK_RET LibOtiKiosk_View_Get_AuthDetail_String(LibOtiKiosk_TransactionView* view, const char* key, char* out_value, int max_out_size);
+
+/**
+ * Any member of "authorizationDetails", as raw JSON (strings keep their quotes and escapes), or as a raw MessagePack
+ * value if the event was received in MessagePack.
+ * out_json points into the event and is only valid during the callback.
+ */
+KIOSK_RET LibOtiKiosk_View_Get_AuthDetail_Raw(LibOtiKiosk_TransactionView* view, const char* key, const char** out_json, int* out_len);
+
+/**
+ * Decodes all the fields, like for the TransactionComplete callback.
+ */
+KIOSK_RET LibOtiKiosk_View_Decode(LibOtiKiosk_TransactionView* view, otiKioskPaymentResponse* out_resp);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* LIBOTIKIOSK_LIBOTIKIOSK_H_ */
@@ -0,0 +1,300 @@
+/*
+ * libotikiosk.hpp
+ *
+ * Header-only C++17 layer on top of the kiosk library.
+ *
+ * Each Kiosk Core method is a descriptor type carrying its name, request id, parameters and result type.
+ * The static part of every command ({"jsonrpc":"2.0","id":N,"method":"...","params":) is built at compile time,
+ * only the parameter values are serialized at runtime. String results are returned as std::string_view into the
+ * client's buffers, they stay valid until the next call on the same client.
+ *
+ * Usage:
+ *   LibOtiKiosk::Client kiosk; // or kiosk(ctx) for a context created with LibOtiKiosk_Ctx_Create
+ *   auto status = kiosk.Call<LibOtiKiosk::GetStatus>();
+ *   auto id = kiosk.Call<LibOtiKiosk::GetKioskId>();
+ *   auto ret = kiosk.Call<LibOtiKiosk::ShowMessage>({"Welcome", "Please wait"});
+ */
+#ifndef LIBOTIKIOSK_LIBOTIKIOSK_HPP_
+#define LIBOTIKIOSK_LIBOTIKIOSK_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include "libotikiosk.h"
+
+extern "C" {
+#include "src/mjson.h"
+}
+
+namespace LibOtiKiosk {
+
+// size of the command and response buffers of a Client
+constexpr std::size_t kCommandBufferSize = 512;
+constexpr std::size_t kResponseBufferSize = 1024;
+
+namespace detail {
+
+constexpr std::size_t Digits(unsigned int v) {
+  std::size_t n = 1;
+  while(v >= 10) {
+    v /= 10;
+    n++;
+  }
+  return n;
+}
+
+/*
+ * Static command prefix of a method descriptor, built at compile time:
+ * {"jsonrpc":"2.0","id":<M::kId>,"method":"<M::kName>","params":
+ */
+template <class M>
+struct CommandPrefix {
+  static constexpr std::string_view kHead = "{\"jsonrpc\":\"2.0\",\"id\":";
+  static constexpr std::string_view kMethod = ",\"method\":\"";
+  static constexpr std::string_view kParams = "\",\"params\":";
+  static constexpr std::size_t kIdDigits = Digits(M::kId);
+  static constexpr std::size_t kSize = kHead.size() + kIdDigits + kMethod.size() + M::kName.size() + kParams.size();
+
+  static constexpr std::array<char, kSize> Build() {
+    std::array<char, kSize> out{};
+    std::size_t pos = 0;
+    for(char c : kHead)
+      out[pos++] = c;
+    unsigned int id = M::kId;
+    for(std::size_t i = kIdDigits; i > 0; i--) {
+      out[pos + i - 1] = static_cast<char>('0' + id % 10);
+      id /= 10;
+    }
+    pos += kIdDigits;
+    for(char c : kMethod)
+      out[pos++] = c;
+    for(char c : M::kName)
+      out[pos++] = c;
+    for(char c : kParams)
+      out[pos++] = c;
+    return out;
+  }
+
+  static constexpr std::array<char, kSize> kValue = Build();
+  static constexpr std::string_view View() { return std::string_view(kValue.data(), kValue.size()); }
+};
+
+// Appends JSON pieces to a fixed buffer, remembers if anything did not fit
+class Writer {
+ public:
+  Writer(char* buf, std::size_t size) : buf_(buf), size_(size) {}
+
+  void Raw(std::string_view s) {
+    if(s.size() > size_ - len_) {
+      overflow_ = true;
+      return;
+    }
+    for(char c : s)
+      buf_[len_++] = c;
+  }
+
+  void Uint(uint32_t v) {
+    char tmp[10];
+    std::size_t n = 0;
+    do {
+      tmp[n++] = static_cast<char>('0' + v % 10);
+      v /= 10;
+    } while(v != 0);
+    if(n > size_ - len_) {
+      overflow_ = true;
+      return;
+    }
+    while(n > 0)
+      buf_[len_++] = tmp[--n];
+  }
+
+  void Bool(bool v) { Raw(v ? std::string_view("true") : std::string_view("false")); }
+
+  // JSON string with escaping, same rules as mjson's %Q
+  void Quoted(std::string_view s) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    Raw("\"");
+    std::size_t run = 0;
+    for(std::size_t i = 0; i < s.size(); i++) {
+      unsigned char c = static_cast<unsigned char>(s[i]);
+      if(c >= 0x20 && c != '"' && c != '\\')
+        continue;
+      Raw(s.substr(run, i - run));
+      run = i + 1;
+      switch(c) {
+      case '"': Raw("\\\""); break;
+      case '\\': Raw("\\\\"); break;
+      case '\b': Raw("\\b"); break;
+      case '\f': Raw("\\f"); break;
+      case '\n': Raw("\\n"); break;
+      case '\r': Raw("\\r"); break;
+      case '\t': Raw("\\t"); break;
+      default: {
+        const char esc[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+        Raw(std::string_view(esc, sizeof(esc)));
+      }
+      }
+    }
+    Raw(s.substr(run));
+    Raw("\"");
+  }
+
+  std::size_t Length() const { return len_; }
+  bool Overflow() const { return overflow_; }
+
+ private:
+  char* buf_;
+  std::size_t size_;
+  std::size_t len_ = 0;
+  bool overflow_ = false;
+};
+
+// members of the responses, resolved in a single pass without parsing a path string on every call
+enum ResponseMember { kError, kResult, kNbResponseMembers };
+constexpr mjson_path kResponsePaths[kNbResponseMembers] = {
+  {1, {MJSON_PATH_KEY("error")}},
+  {1, {MJSON_PATH_KEY("result")}},
+};
+
+// Kiosk Core string of an enumeration value, see kiosk_descriptors.inc
+template <class T>
+struct EnumName {
+  std::string_view name;
+  T value;
+};
+
+template <class T, std::size_t N>
+constexpr bool DecodeEnum(const EnumName<T> (&names)[N], std::string_view s, T& out) {
+  for(const EnumName<T>& n : names) {
+    if(n.name == s) {
+      out = n.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace detail
+
+// kinds of "result" returned by Kiosk Core
+struct BoolResult {};    // true/false, false being a negative response
+struct StringResult {};  // a string, unescaped and checked for UTF-8 like the C API, returned as a view
+struct StatusResult {};  // a GetStatus string, translated to KIOSK_STATUS
+struct CancelResult {};  // a CancelTransaction string, translated to KIOSK_RET
+
+struct NoParams {
+  void Write(detail::Writer& w) const { w.Raw("{}"); }
+};
+
+// method descriptors, parameters and enumeration tables, generated from schema/kiosk_core.json
+#include "src/kiosk_descriptors.inc"
+
+// typed value of each result kind
+template <class Kind> struct ResultValue;
+template <> struct ResultValue<BoolResult> { using type = bool; };
+template <> struct ResultValue<StringResult> { using type = std::string_view; };
+template <> struct ResultValue<StatusResult> { using type = KIOSK_STATUS; };
+template <> struct ResultValue<CancelResult> { using type = KIOSK_RET; };
+
+template <class M>
+struct Result {
+  using Value = typename ResultValue<typename M::ResultKind>::type;
+
+  KIOSK_RET ret = KIOSK_RET_GENERAL_ERROR;
+  Value value{};
+
+  explicit operator bool() const { return ret == KIOSK_RET_OK; }
+};
+
+class Client {
+ public:
+  // talks to the given context, or to the default one (LibOtiKiosk_Init) if NULL
+  explicit Client(LibOtiKiosk_Context* ctx = nullptr) : ctx_(ctx != nullptr ? ctx : LibOtiKiosk_Default_Context()) {}
+
+  /**
+   * Serializes and sends the command described by M, then decodes its response.
+   * Views in the returned result point into this client's buffers and stay valid until the next call.
+   */
+  template <class M>
+  Result<M> Call(const typename M::Params& params = typename M::Params(), int timeout_ms = 500) {
+    Result<M> res;
+
+    // static prefix + runtime parameters
+    detail::Writer w(tx_.data(), tx_.size());
+    w.Raw(detail::CommandPrefix<M>::View());
+    params.Write(w);
+    w.Raw("}");
+    if(w.Overflow()) {
+      res.ret = KIOSK_RET_MEMORY_ERROR;
+      return res;
+    }
+
+    int rx_len = static_cast<int>(rx_.size());
+    res.ret = LibOtiKiosk_Ctx_Call(ctx_, tx_.data(), static_cast<int>(w.Length()), rx_.data(), &rx_len, timeout_ms);
+    if(res.ret != KIOSK_RET_OK)
+      return res;
+
+    res.ret = Decode<M>(rx_len, res.value);
+    return res;
+  }
+
+ private:
+  template <class M>
+  KIOSK_RET Decode(int rx_len, typename Result<M>::Value& out) {
+    using Kind = typename M::ResultKind;
+    mjson_find_result members[detail::kNbResponseMembers];
+    if(mjson_find_many(rx_.data(), rx_len, detail::kResponsePaths, detail::kNbResponseMembers, members) < 0)
+      return KIOSK_RET_PARSING_ERROR;
+
+    if(members[detail::kError].tok == MJSON_TOK_OBJECT)
+      return KIOSK_RET_NEGATIVE_RESP;
+
+    int tok = members[detail::kResult].tok;
+    const char* p = members[detail::kResult].ptr;
+    int n = members[detail::kResult].len;
+    if constexpr(std::is_same_v<Kind, BoolResult>) {
+      if(tok != MJSON_TOK_TRUE && tok != MJSON_TOK_FALSE)
+        return KIOSK_RET_PARSING_ERROR;
+      out = (tok == MJSON_TOK_TRUE);
+      return out ? KIOSK_RET_OK : KIOSK_RET_NEGATIVE_RESP;
+    } else {
+      if(tok != MJSON_TOK_STRING)
+        return KIOSK_RET_PARSING_ERROR;
+      // drop the quotes, p points into rx_
+      std::string_view s(p + 1, n - 2);
+      if constexpr(std::is_same_v<Kind, StringResult>) {
+        // same decoding as unescape_string() in the C library
+        if(s.find('\\') == std::string_view::npos) {
+          if(!mjson_utf8_valid(s.data(), static_cast<int>(s.size())))
+            return KIOSK_RET_PARSING_ERROR;
+          out = s;
+          return KIOSK_RET_OK;
+        }
+        int len = mjson_unescape(s.data(), static_cast<int>(s.size()), str_.data(), static_cast<int>(str_.size()));
+        if(len < 0 || !mjson_utf8_valid(str_.data(), len))
+          return KIOSK_RET_PARSING_ERROR;
+        out = std::string_view(str_.data(), len);
+        return KIOSK_RET_OK;
+      } else if constexpr(std::is_same_v<Kind, StatusResult>) {
+        return detail::DecodeEnum(detail::kKioskStatusNames, s, out) ? KIOSK_RET_OK : KIOSK_RET_PARSING_ERROR;
+      } else {
+        static_assert(std::is_same_v<Kind, CancelResult>, "unsupported result kind");
+        if(!detail::DecodeEnum(detail::kCancelResultNames, s, out))
+          return KIOSK_RET_PARSING_ERROR;
+        return out;
+      }
+    }
+  }
+
+  LibOtiKiosk_Context* ctx_;
+  std::array<char, kCommandBufferSize> tx_{};
+  std::array<char, kResponseBufferSize> rx_{};
+  std::array<char, kResponseBufferSize> str_{};  // unescaped string results
+};
+
+}  // namespace LibOtiKiosk
+
+#endif /* LIBOTIKIOSK_LIBOTIKIOSK_HPP_ */
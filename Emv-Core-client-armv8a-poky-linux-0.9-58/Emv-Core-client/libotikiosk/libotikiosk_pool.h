@@ -0,0 +1,85 @@
+/*
+ * libotikiosk_pool.h
+ *
+ * Routes payments across several Kiosk Cores (one context per reader).
+ * Each PayTransaction/PreAuthorize goes to the least busy reader that is Ready, or in PaymentTransaction below
+ * max_outstanding, and waits in a queue when all readers are busy. The status comes from the polls, a reader is
+ * Ready again as soon as its last TransactionComplete is received.
+ */
+#ifndef LIBOTIKIOSK_LIBOTIKIOSK_POOL_H_
+#define LIBOTIKIOSK_LIBOTIKIOSK_POOL_H_
+
+#include "libotikiosk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LibOtiKiosk_Pool LibOtiKiosk_Pool;
+
+// one reader of the pool: a single server like LibOtiKiosk_Init, or servers to fail over between
+typedef struct {
+  const char* server_address; // same meaning as in LibOtiKiosk_Init, unused when endpoints is set
+  bool is_local;
+  const LibOtiKiosk_Endpoint* endpoints; // in order of preference, see LibOtiKiosk_Ctx_Create_Endpoints (can be NULL)
+  int nb_endpoints;
+  unsigned int connect_timeout_ms; // for the endpoints list (0 defaults to 1000ms)
+} LibOtiKiosk_PoolEndpoint;
+
+typedef struct {
+  KIOSK_STATUS status; // status returned by the last poll (OK_NO_KIOSK if it failed)
+  unsigned int outstanding; // transactions started on this reader and not completed yet
+  uint32_t started; // transactions started since the pool was created
+  uint32_t completed; // TransactionComplete events received since the pool was created
+  uint64_t busy_ms; // total time spent with at least one outstanding transaction
+  uint32_t utilization_permille; // busy_ms relative to the pool lifetime, 0-1000
+} LibOtiKiosk_ReaderStats;
+
+// called for every completed transaction, reader_index identifies the reader that handled it
+typedef void (*PoolTransactionCompleteCb_t)(LibOtiKiosk_Pool* pool, int reader_index, otiKioskPaymentResponse* resp, void* user_data);
+
+/**
+ * Creates one context per reader and starts polling their status. A reader given an endpoints list fails over
+ * between them like any context, the poll then releases its reservations.
+ * A reader stays reserved until the TransactionComplete of its transaction, or until the poll sees it go from
+ * PaymentTransaction back to Ready or its context reconnect, in case the event was lost.
+ * @param status_poll_ms: period of the GetStatus polling used for routing (0 defaults to 1000ms)
+ * @param max_outstanding: number of transactions a reader handles at once (0 defaults to 1)
+ */
+LibOtiKiosk_Pool* LibOtiKiosk_Pool_Create(const LibOtiKiosk_PoolEndpoint* endpoints, int nb_endpoints, unsigned int status_poll_ms, unsigned int max_outstanding);
+
+/**
+ * Stops the polling and destroys all the contexts of the pool.
+ */
+void LibOtiKiosk_Pool_Destroy(LibOtiKiosk_Pool* pool);
+
+void LibOtiKiosk_Pool_Register_TransactionComplete_Callback(LibOtiKiosk_Pool* pool, PoolTransactionCompleteCb_t cb, void* user_data);
+
+/**
+ * Start a payment (or pre-authorization) on the least busy ready reader.
+ * If no reader is available, waits up to queue_timeout_ms for one (0 fails immediately, negative waits forever).
+ * The index of the selected reader is written to out_reader_index (can be NULL).
+ */
+KIOSK_RET LibOtiKiosk_Pool_PayTransaction(LibOtiKiosk_Pool* pool, otiKioskPaymentParameters *params, int queue_timeout_ms, int* out_reader_index);
+KIOSK_RET LibOtiKiosk_Pool_PreAuthorize(LibOtiKiosk_Pool* pool, otiKioskPaymentParameters *params, int queue_timeout_ms, int* out_reader_index);
+
+/**
+ * Number of readers in the pool.
+ */
+int LibOtiKiosk_Pool_Size(LibOtiKiosk_Pool* pool);
+
+/**
+ * Context of a reader, for the calls that must go to a specific reader (ConfirmTransaction, VoidTransaction, ...).
+ */
+LibOtiKiosk_Context* LibOtiKiosk_Pool_Get_Context(LibOtiKiosk_Pool* pool, int reader_index);
+
+/**
+ * Snapshot of the routing state and utilization of a reader.
+ */
+KIOSK_RET LibOtiKiosk_Pool_Get_Reader_Stats(LibOtiKiosk_Pool* pool, int reader_index, LibOtiKiosk_ReaderStats* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBOTIKIOSK_LIBOTIKIOSK_POOL_H_ */
@@ -36,7 +36,9 @@ typedef struct {
   otiTransactionStatus status;
   int error_code;
   char error_message[100];
-  double amount_requested;
+  uint32_t amount_requested_cents; // exact amounts, as sent in the requests
+  uint32_t amount_authorized_cents;
+  double amount_requested; // same amounts in currency units, derived from the cents
   double amount_authorized;
   char transaction_reference[128];
   char partial_PAN[20];
@@ -67,8 +69,47 @@ typedef enum {
   KIOSK_RET_NEGATIVE_RESP,
 } KIOSK_RET;
 
+// handle on one Kiosk Core connection, see LibOtiKiosk_Ctx_Create()
+typedef struct LibOtiKiosk_Context LibOtiKiosk_Context;
+
+// one Kiosk Core server, see LibOtiKiosk_Ctx_Create_Endpoints()
+typedef struct {
+  bool is_local; // Unix domain sockets if true, the addresses are then socket paths
+  const char* cmd_address; // commands socket path or server address
+  uint16_t cmd_port; // TCP port of the commands socket (0 defaults to 10000)
+  const char* event_address; // events socket path or server address
+  uint16_t event_port; // TCP port of the events socket (0 defaults to 10001)
+} LibOtiKiosk_Endpoint;
+
+// encoding of the messages sent by a context, see LibOtiKiosk_Ctx_Set_Codec()
+typedef enum {
+  KIOSK_CODEC_JSON,
+  KIOSK_CODEC_MSGPACK, // only understood by our own simulator and broker, not by the Kiosk Core itself
+} KIOSK_CODEC;
+
+// connection statistics of a context, see LibOtiKiosk_Ctx_Get_Stats()
+typedef struct {
+  uint32_t connect_failures; // failed connection attempts, including lost connections
+  uint32_t failovers; // switches to another endpoint
+  uint32_t reconnects; // reconnections to the same endpoint after losing it
+  int active_endpoint; // index of the endpoint currently in use
+  uint32_t last_failover_ms; // time between losing an endpoint and being connected to the next one
+  uint32_t max_failover_ms;
+} LibOtiKiosk_Stats;
+
 // callback types
 typedef void (*RdrEventCb_t)(uint8_t msg_index, char* s_line1, char* s_line2);
 typedef void (*TransactionCompleteCb_t)(otiKioskPaymentResponse* resp);
 
+// callback types for the context API, user_data is the pointer given at registration
+typedef void (*RdrEventCtxCb_t)(LibOtiKiosk_Context* ctx, uint8_t msg_index, char* s_line1, char* s_line2, void* user_data);
+typedef void (*TransactionCompleteCtxCb_t)(LibOtiKiosk_Context* ctx, otiKioskPaymentResponse* resp, void* user_data);
+
+// event as received, see LibOtiKiosk_Ctx_Register_RawEvent_Callback()
+typedef void (*RawEventCtxCb_t)(LibOtiKiosk_Context* ctx, bool commands_socket, const char* msg, int msg_len, void* user_data);
+
+// TransactionComplete event read in place, see LibOtiKiosk_Ctx_Register_TransactionView_Callback()
+typedef struct LibOtiKiosk_TransactionView LibOtiKiosk_TransactionView;
+typedef void (*TransactionViewCtxCb_t)(LibOtiKiosk_Context* ctx, LibOtiKiosk_TransactionView* view, void* user_data);
+
 #endif /* LIBOTIKIOSK_LIBOTIKIOSK_TYPES_H_ */
@@ -0,0 +1,404 @@
+#!/usr/bin/env python3
+#
+# gen_kiosk_core.py
+#
+# Generates the Kiosk Core command serializers and the event decoding tables from kiosk_core.json:
+#   kiosk_schema.h: method and event names, included by kiosk_commands.h
+#   kiosk_methods.inc: LibOtiKiosk_Ctx_* functions (JSON and MessagePack), included by libotikiosk.c
+#   kiosk_events.inc: enumeration tables and TransactionComplete fields, included by kiosk_commands.c
+#   kiosk_descriptors.inc: C++ method descriptors and enumeration tables, included by libotikiosk.hpp
+#
+# usage: gen_kiosk_core.py <schema> <output directory>
+#
+# The generated files are checked in, python is only needed when the schema changes.
+
+import json
+import os
+import sys
+
+HEADER = """/*
+ * {name}
+ *
+ * Generated by schema/gen_kiosk_core.py from schema/kiosk_core.json, do not edit.
+ */
+"""
+
+RESP_TIMEOUT_MS = 500
+
+# C type of the decoded value for the event fields
+FIELD_TYPES = {
+  "string": "JSON_TYPE_STRING",
+  "bool": "JSON_TYPE_BOOL",
+  "int": "JSON_TYPE_INT",
+  "double": "JSON_TYPE_DOUBLE",
+  "cents": "JSON_TYPE_CENTS",
+  "enum": "JSON_TYPE_ENUM",
+}
+
+FIELD_SCOPES = {
+  "params": "TC_SCOPE_PARAMS",
+  "authorizationDetails": "TC_SCOPE_AUTH_DETAILS",
+}
+
+ENUM_PARSERS = {
+  "kiosk_status": "parse_get_status",
+  "cancel_result": "parse_cancel_resp",
+}
+
+# C++ members of the descriptor parameters
+CPP_PARAM_TYPES = {
+  "uint": ("uint32_t", " = 0", "Uint"),
+  "bool": ("bool", " = false", "Bool"),
+  "string": ("std::string_view", "", "Quoted"),
+}
+
+# C++ result kind of the descriptors, see libotikiosk.hpp
+CPP_RESULT_KINDS = {
+  "ok": "BoolResult",
+  "string": "StringResult",
+  "kiosk_status": "StatusResult",
+  "cancel_result": "CancelResult",
+}
+
+
+def c_string(s):
+  return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def json_string(s):
+  return json.dumps(s, ensure_ascii=False)
+
+
+def c_bytes(b):
+  """C literal of binary data, the non printable bytes as 3 digit octal escapes."""
+  out = ""
+  for c in b:
+    if c in b'"\\' or c in b"?":
+      out += "\\" + chr(c)
+    elif 0x20 <= c < 0x7f:
+      out += chr(c)
+    else:
+      out += "\\%03o" % c
+  return '"' + out + '"'
+
+
+def msgpack_map(n):
+  return bytes([0x80 | n]) if n < 16 else b"\xde" + n.to_bytes(2, "big")
+
+
+def msgpack_str(s):
+  b = s.encode("utf-8")
+  if len(b) < 32:
+    return bytes([0xa0 | len(b)]) + b
+  if len(b) < 256:
+    return b"\xd9" + bytes([len(b)]) + b
+  return b"\xda" + len(b).to_bytes(2, "big") + b
+
+
+def msgpack_uint(n):
+  if n < 128:
+    return bytes([n])
+  if n < 256:
+    return b"\xcc" + bytes([n])
+  if n < 65536:
+    return b"\xcd" + n.to_bytes(2, "big")
+  return b"\xce" + n.to_bytes(4, "big")
+
+
+class Chunks:
+  """Consecutive constant output is merged into a single literal."""
+
+  def __init__(self):
+    self.items = [] # ("raw", text or bytes) or ("code", line)
+
+  def raw(self, text):
+    if self.items and self.items[-1][0] == "raw":
+      self.items[-1] = ("raw", self.items[-1][1] + text)
+    else:
+      self.items.append(("raw", text))
+
+  def code(self, line):
+    self.items.append(("code", line))
+
+
+def gen_method(m):
+  name = m["function"]
+  args = ", ".join(["LibOtiKiosk_Context* ctx"] + m["args"])
+  result = m["result"]
+  params = m.get("params", [])
+  mid = m["id"]
+
+  chunks = Chunks()
+  chunks.raw('{"jsonrpc":"2.0","method":%s,"params":{' % json_string(m["method"]))
+  for i, p in enumerate(params):
+    chunks.raw(("," if i > 0 else "") + json_string(p["key"]) + ":")
+    t = p["type"]
+    if t == "const":
+      chunks.raw(json_string(p["value"]))
+    elif t == "uint":
+      chunks.code("mjson_print_int(&out, (int)%s, 0);" % p["value"])
+    elif t == "bool":
+      chunks.code("mjson_print_fixed_buf(&out, %s ? \"true\" : \"false\", %s ? 4 : 5);" % (p["value"], p["value"]))
+    elif t == "string":
+      v = p["value"]
+      chunks.code("mjson_print_str(&out, %s == NULL ? \"\" : %s, %s == NULL ? 0 : (int)strlen(%s));" % (v, v, v, v))
+    else:
+      raise ValueError("%s: unsupported param type %s" % (name, t))
+  chunks.raw('},"id":%d}' % mid)
+
+  # same command in MessagePack, the members in the same order
+  mp_chunks = Chunks()
+  mp_chunks.raw(msgpack_map(4) + msgpack_str("jsonrpc") + msgpack_str("2.0") + msgpack_str("method") + msgpack_str(m["method"]))
+  mp_chunks.raw(msgpack_str("params") + msgpack_map(len(params)))
+  for p in params:
+    mp_chunks.raw(msgpack_str(p["key"]))
+    t = p["type"]
+    if t == "const":
+      mp_chunks.raw(msgpack_str(p["value"]))
+    elif t == "uint":
+      mp_chunks.code("msgpack_put_uint(&out, %s);" % p["value"])
+    elif t == "bool":
+      mp_chunks.code("msgpack_put_bool(&out, %s);" % p["value"])
+    elif t == "string":
+      v = p["value"]
+      mp_chunks.code("msgpack_put_str(&out, %s == NULL ? \"\" : %s, %s == NULL ? 0 : (int)strlen(%s));" % (v, v, v, v))
+  mp_chunks.raw(msgpack_str("id") + msgpack_uint(mid))
+
+  lines = []
+  lines.append("// %s, id %d" % (m["method"], mid))
+  lines.append("KIOSK_RET LibOtiKiosk_Ctx_%s(%s) {" % (name, args))
+  lines.append("  char resp_buff[KIOSK_RESP_MAX_SIZE];")
+  lines.append("  int resp_len = sizeof(resp_buff);")
+  lines.append("  kiosk_envelope env;")
+
+  constant = len(chunks.items) == 1
+  if constant:
+    lines.append("  static const char cmd_json[] = %s;" % c_string(chunks.items[0][1]))
+    lines.append("  static const char cmd_msgpack[] = %s;" % c_bytes(mp_chunks.items[0][1]))
+    lines.append("  bool binary = ctx->codec == KIOSK_CODEC_MSGPACK;")
+  else:
+    lines.append("  char cmd[KIOSK_CMD_MAX_SIZE];")
+    lines.append("  int cmd_len;")
+  lines.append("")
+
+  rtype = result["type"]
+  if rtype == "string":
+    lines.append("  memset(%s, 0, %s);" % (result["out"], result["max"]))
+  elif rtype == "enum" and "default" in result:
+    lines.append("  *%s = %s;" % (result["out"], result["default"]))
+
+  if constant:
+    lines.append("  KIOSK_RET ret = send_receive_id(ctx, %d, binary ? cmd_msgpack : cmd_json, binary ? sizeof(cmd_msgpack) - 1 : sizeof(cmd_json) - 1, resp_buff, &resp_len, &env, %d);" % (mid, RESP_TIMEOUT_MS))
+  else:
+    lines.append("  if(ctx->codec == KIOSK_CODEC_MSGPACK) {")
+    lines.append("    struct msgpack_out out = MSGPACK_OUT(cmd, sizeof(cmd));")
+    for kind, item in mp_chunks.items:
+      if kind == "raw":
+        lines.append("    msgpack_put_raw(&out, %s, %d);" % (c_bytes(item), len(item)))
+      else:
+        lines.append("    " + item)
+    lines.append("    if(out.overflow)")
+    lines.append("      return KIOSK_RET_MEMORY_ERROR;")
+    lines.append("    cmd_len = out.len;")
+    lines.append("  } else {")
+    lines.append("    struct mjson_out out = MJSON_OUT_FIXED_BUF(cmd, sizeof(cmd));")
+    for kind, item in chunks.items:
+      if kind == "raw":
+        lines.append("    mjson_print_fixed_buf(&out, %s, %d);" % (c_string(item), len(item.encode("utf-8"))))
+      else:
+        lines.append("    " + item)
+    lines.append("    if(out.u.fixed_buf.overflow)")
+    lines.append("      return KIOSK_RET_MEMORY_ERROR;")
+    lines.append("    cmd_len = out.u.fixed_buf.len;")
+    lines.append("  }")
+    lines.append("")
+    lines.append("  KIOSK_RET ret = send_receive_id(ctx, %d, cmd, cmd_len, resp_buff, &resp_len, &env, %d);" % (mid, RESP_TIMEOUT_MS))
+  lines.append("  if(ret != KIOSK_RET_OK)")
+  lines.append("    return ret;")
+
+  if rtype == "ok":
+    lines.append("  return check_response_ok(resp_buff, &env, %d);" % mid)
+  elif rtype == "string":
+    lines.append("  return parse_resp_result(resp_buff, &env, %d, %s, %s);" % (mid, result["out"], result["max"]))
+  elif rtype == "enum":
+    parser = ENUM_PARSERS[result["enum"]]
+    out_arg = ", " + result["out"] if "out" in result else ""
+    lines.append("  return %s(resp_buff, &env, %d%s);" % (parser, mid, out_arg))
+  else:
+    raise ValueError("%s: unsupported result type %s" % (name, rtype))
+  lines.append("}")
+  return "\n".join(lines) + "\n"
+
+
+def macro_name(prefix, name):
+  return prefix + "".join("_" + c if c.isupper() and i > 0 and not name[i - 1].isupper() else c for i, c in enumerate(name)).upper()
+
+
+def gen_schema_header(schema):
+  out = [HEADER.format(name="kiosk_schema.h")]
+  out.append("#ifndef LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_")
+  out.append("#define LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_")
+  out.append("")
+  out.append("// methods")
+  names = []
+  for m in schema["methods"]:
+    if m["method"] not in names:
+      names.append(m["method"])
+  for name in names:
+    out.append("#define %s %s" % (macro_name("KIOSK_METHOD_", name), c_string(name)))
+  out.append("")
+  out.append("// events")
+  for e in schema["events"]:
+    event = e["method"][:-len("Event")] if e["method"].endswith("Event") else e["method"]
+    out.append("#define %s %s" % (macro_name("KIOSK_EVENT_", event), c_string(e["method"])))
+  out.append("")
+  out.append("#endif /* LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_ */")
+  return "\n".join(out) + "\n"
+
+
+def gen_methods(schema):
+  out = [HEADER.format(name="kiosk_methods.inc")]
+
+  ids = set()
+  for m in schema["methods"]:
+    if m["id"] in ids:
+      raise ValueError("duplicate id %d" % m["id"])
+    ids.add(m["id"])
+    out.append(gen_method(m))
+  return "\n".join(out)
+
+
+def gen_events(schema):
+  out = [HEADER.format(name="kiosk_events.inc")]
+
+  for name, e in schema["enums"].items():
+    out.append("static const struct enum_name %s_names[] = {" % name)
+    for s, value in e["names"].items():
+      out.append("  ENUM_NAME(%s, %s)," % (c_string(s), value))
+    out.append("};")
+    out.append("")
+  for name, e in schema["enums"].items():
+    out.append("static const struct enum_table %s_table = ENUM_TABLE(%s, %s_names);" % (name, c_string(e["what"]), name))
+  out.append("")
+
+  tc = [e for e in schema["events"] if e["method"] == "TransactionComplete"][0]
+  required = []
+  out.append("static const struct tc_field tc_fields[] = {")
+  for i, f in enumerate(tc["fields"]):
+    scope = FIELD_SCOPES[f["scope"]]
+    if f["type"] == "enum":
+      out.append("  TC_ENUM_FIELD(%s, %s, %s_table, %s)," % (scope, c_string(f["key"]), f["enum"], f["member"]))
+    else:
+      out.append("  TC_FIELD(%s, %s, %s, %s)," % (scope, c_string(f["key"]), FIELD_TYPES[f["type"]], f["member"]))
+    if f.get("required", False):
+      required.append(i)
+  out.append("};")
+  out.append("#define TC_NB_FIELDS (int)(sizeof(tc_fields)/sizeof(tc_fields[0]))")
+  out.append("")
+  out.append("// fields that must be present, the string fields are empty when missing")
+  out.append("#define TC_REQUIRED_FIELDS (%s)" % " | ".join("(1u << %d)" % i for i in required))
+  return "\n".join(out) + "\n"
+
+
+def cpp_enum_table(name):
+  return "k" + "".join(w.capitalize() for w in name.split("_")) + "Names"
+
+
+def gen_cpp_params(struct, m, indent):
+  """Params struct of a C++ descriptor: the members and the Write() of their JSON object."""
+  chunks = Chunks()
+  members = []
+  chunks.raw("{")
+  for i, p in enumerate(m["params"]):
+    chunks.raw(("," if i > 0 else "") + json_string(p["key"]) + ":")
+    if p["type"] == "const":
+      chunks.raw(json_string(p["value"]))
+      continue
+    member = p["value"].split("->")[-1]
+    ctype, init, write = CPP_PARAM_TYPES[p["type"]]
+    members.append("%s %s%s;" % (ctype, member, init))
+    chunks.code("w.%s(%s);" % (write, member))
+  chunks.raw("}")
+
+  pad = " " * indent
+  lines = ["%sstruct %s {" % (pad, struct)]
+  lines += ["%s  %s" % (pad, member) for member in members]
+  if len(chunks.items) == 1:
+    lines.append("%s  void Write(detail::Writer& w) const { w.Raw(%s); }" % (pad, c_string(chunks.items[0][1])))
+  else:
+    lines.append("")
+    lines.append("%s  void Write(detail::Writer& w) const {" % pad)
+    for kind, item in chunks.items:
+      lines.append("%s    %s" % (pad, "w.Raw(%s);" % c_string(item) if kind == "raw" else item))
+    lines.append("%s  }" % pad)
+  lines.append("%s};" % pad)
+  return lines
+
+
+def gen_descriptors(schema):
+  out = [HEADER.format(name="kiosk_descriptors.inc")]
+
+  out.append("namespace detail {")
+  out.append("")
+  out.append("// Kiosk Core strings of the enumerations")
+  for name, e in schema["enums"].items():
+    out.append("constexpr EnumName<%s> %s[] = {" % (e["type"], cpp_enum_table(name)))
+    for s, value in e["names"].items():
+      out.append("  {%s, %s}," % (c_string(s), value))
+    out.append("};")
+    out.append("")
+  out.append("}  // namespace detail")
+  out.append("")
+
+  # parameters shared by several methods, declared once
+  shared = {}
+  for m in schema["methods"]:
+    struct = m.get("params_struct")
+    if struct is None:
+      continue
+    if struct in shared:
+      if shared[struct] != m["params"]:
+        raise ValueError("%s: %s differs from the previous methods" % (m["function"], struct))
+      continue
+    shared[struct] = m["params"]
+    out += gen_cpp_params(struct, m, 0)
+    out.append("")
+
+  out.append("/*")
+  out.append(" * Method descriptors")
+  out.append(" */")
+  for m in schema["methods"]:
+    result = m["result"]
+    kind = CPP_RESULT_KINDS[result["enum"] if result["type"] == "enum" else result["type"]]
+    out.append("struct %s {" % m["function"])
+    out.append("  static constexpr std::string_view kName = %s;" % c_string(m["method"]))
+    out.append("  static constexpr unsigned int kId = %d;" % m["id"])
+    if "params_struct" in m:
+      out.append("  using Params = %s;" % m["params_struct"])
+    elif not m["params"]:
+      out.append("  using Params = NoParams;")
+    else:
+      out += gen_cpp_params("Params", m, 2)
+    out.append("  using ResultKind = %s;" % kind)
+    out.append("};")
+    out.append("")
+  return "\n".join(out)
+
+
+def main():
+  if len(sys.argv) != 3:
+    sys.stderr.write("usage: %s <schema> <output directory>\n" % sys.argv[0])
+    return 1
+
+  with open(sys.argv[1]) as f:
+    schema = json.load(f)
+
+  for name, gen in (("kiosk_schema.h", gen_schema_header), ("kiosk_methods.inc", gen_methods), ("kiosk_events.inc", gen_events),
+                    ("kiosk_descriptors.inc", gen_descriptors)):
+    with open(os.path.join(sys.argv[2], name), "w") as f:
+      f.write(gen(schema))
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -9,7 +9,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 #include "kiosk_commands.h"
+#include "kiosk_msgpack.h"
 #include "mjson.h"
 #include "../libotikiosk_types.h"
 #include "otiKiosk_log.h"
@@ -18,238 +22,760 @@ enum json_field_type {
   JSON_TYPE_STRING,
   JSON_TYPE_BOOL,
   JSON_TYPE_INT,
-  JSON_TYPE_DOUBLE
+  JSON_TYPE_DOUBLE,
+  JSON_TYPE_CENTS, // amount with 2 decimals, decoded to an integer number of cents
+  JSON_TYPE_ENUM
 };
 
-struct json_field_parser_options {
-  const char* json_path;
+// string value of an enumeration, matched against the raw JSON string
+struct enum_name {
+  const char* name;
+  int len;
+  int value;
+};
+
+struct enum_table {
+  const char* what; // for the logs
+  const struct enum_name* names;
+  int nb_names;
+};
+
+#define ENUM_NAME(name, value) {name, sizeof(name)-1, value}
+#define ENUM_TABLE(what, names) {what, names, sizeof(names)/sizeof(names[0])}
+
+// scope of a JSON object within the params of the TransactionComplete event
+enum tc_scope {
+  TC_SCOPE_OTHER,
+  TC_SCOPE_PARAMS,
+  TC_SCOPE_AUTH_DETAILS
+};
+
+// a field of the TransactionComplete event, identified by its key in the object of the given scope
+struct tc_field {
+  enum tc_scope scope;
+  const char* key;
   enum json_field_type type;
-  void* out;
+  size_t offset; // in otiKioskPaymentResponse
   int out_len;
+  const struct enum_table* enum_table; // for JSON_TYPE_ENUM
+};
+
+// state of the single pass decoding of the TransactionComplete params
+struct tc_decoder {
+  otiKioskPaymentResponse* resp;
+  bool binary;
+  bool error;
+  uint32_t found; // bit mask of the decoded tc_fields entries
+
+  int depth;
+  enum tc_scope scopes[4]; // scope of each nesting level, deeper levels are TC_SCOPE_OTHER
+  const char* key; // last key seen, including quotes, NULL once its value has been consumed
+  int key_len;
 };
 
-char* build_command(const char* template, ...) {
-  char* ret = NULL;
+#define TC_FIELD(scope, key, type, member) {scope, key, type, offsetof(otiKioskPaymentResponse, member), sizeof(((otiKioskPaymentResponse*)0)->member), NULL}
+#define TC_ENUM_FIELD(scope, key, table, member) {scope, key, JSON_TYPE_ENUM, offsetof(otiKioskPaymentResponse, member), sizeof(((otiKioskPaymentResponse*)0)->member), &table}
+
+// enumeration tables and TransactionComplete fields, generated from schema/kiosk_core.json
+#include "kiosk_events.inc"
+#define TC_ALL_FIELDS ((1u << TC_NB_FIELDS) - 1)
+
+// state of scan_members()
+struct member_scanner {
+  bool binary;
+  const char* const* keys; // keys of interest
+  kiosk_json_span* spans; // one per key
+  int nb_keys;
+  int nb_found;
+  int depth;
+  kiosk_json_span* member; // member whose value comes next, NULL if not of interest
+  int value_start; // offset of the container value being skipped
+};
+
+int build_command(char* out, int out_size, const char* template, ...) {
+  if(out_size <= 0)
+    return -1;
+
+  // format straight into the caller's buffer, keeping room for the terminator
+  struct mjson_out mout = MJSON_OUT_FIXED_BUF(out, out_size - 1);
   va_list args;
 
   va_start(args, template);
-  int ret_len = vsnprintf(NULL, 0, template, args) + 1;
+  mjson_vprintf(&mout, template, args);
   va_end(args);
 
-  ret = calloc(ret_len, 1);
-  if(ret == NULL)
-    return NULL;
+  out[mout.u.fixed_buf.len] = '\0';
+  if(mout.u.fixed_buf.overflow)
+    return -1;
 
-  va_start(args, template);
-  vsprintf(ret, template, args);
-  va_end(args);
+  return mout.u.fixed_buf.len;
+}
 
-  return ret;
+int unescape_string(const char* tok, int tok_len, char* out, int max_out_size) {
+  if(tok_len < 2 || tok[0] != '"')
+    return -1;
+  int len = mjson_unescape(tok + 1, tok_len - 2, out, max_out_size);
+  if(len < 0 || !mjson_utf8_valid(out, len))
+    return -1;
+  return len;
+}
+
+int decode_string(bool binary, const char* tok, int tok_len, char* out, int max_out_size) {
+  if(!binary)
+    return unescape_string(tok, tok_len, out, max_out_size);
+
+  const char* s;
+  int len;
+  if(!msgpack_get_str(tok, tok_len, &s, &len) || len >= max_out_size || !mjson_utf8_valid(s, len))
+    return -1;
+  memcpy(out, s, len);
+  out[len] = '\0';
+  return len;
+}
+
+// bytes of a string token, still escaped for JSON
+static bool _str_payload(bool binary, const char* tok, int tok_len, const char** out_str, int* out_len) {
+  if(binary)
+    return msgpack_get_str(tok, tok_len, out_str, out_len);
+  if(tok_len < 2 || tok[0] != '"')
+    return false;
+  *out_str = tok + 1;
+  *out_len = tok_len - 2;
+  return true;
 }
 
 KIOSK_RET parse_id(char *json, int json_len, int *out_id) {
+  static const struct mjson_path id_path = {1, {MJSON_PATH_KEY("id")}};
   double d;
-  if (mjson_get_number(json, json_len, "$.id", &d) != 1) {
+  if (mjson_path_get_number(json, json_len, &id_path, &d) != 1) {
     return KIOSK_RET_PARSING_ERROR;
   }
   *out_id = d;
   return KIOSK_RET_OK;
 }
 
-KIOSK_RET parse_resp_result(char* json, int json_len, int expected_cmd_id, char* out_result, int max_out_size) {
-  int id = 0;
+/*
+ * Converts a JSON number token to a fixed-point integer with the given number of decimals, using integer arithmetic
+ * only. Extra decimals are rounded half away from zero and reported through out_rounded.
+ * Returns false if the token isn't a number or doesn't fit.
+ */
+static bool _parse_fixed(const char* s, int len, int decimals, int64_t* out, bool* out_rounded) {
+  int64_t v = 0;
+  int frac = 0; // number of decimals accumulated in v
+  int exp = 0;
+  bool neg = false;
+  bool truncated = false; // non-zero digits were ignored because of the int64 range
+  int i = 0, start;
+
+  if(i < len && s[i] == '-') {
+    neg = true;
+    i++;
+  }
 
-  // expect to have an ID field
-  if(parse_id(json, json_len, &id) != KIOSK_RET_OK) {
-    KIOSK_ERROR("missing 'id' field\n");
-    return KIOSK_RET_PARSING_ERROR;
+  // integer part
+  for(start = i; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+    if(v > (INT64_MAX - 9) / 10)
+      return false;
+    v = v*10 + (s[i] - '0');
   }
-  if(id != expected_cmd_id) {
-    KIOSK_ERROR("unexpected id (got %d, expected %d)\n", id, expected_cmd_id);
-    return KIOSK_RET_PARSING_ERROR;
+  if(i == start)
+    return false;
+
+  // fraction part
+  if(i < len && s[i] == '.') {
+    for(start = ++i; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+      if(v > (INT64_MAX - 9) / 10) {
+        truncated |= (s[i] != '0');
+        continue;
+      }
+      v = v*10 + (s[i] - '0');
+      frac++;
+    }
+    if(i == start)
+      return false;
   }
 
-  // get the result as a string and parse it
-  if(mjson_get_string(json, json_len, "$.result", out_result, max_out_size) <= 0) {
-    KIOSK_ERROR("missing 'result' field\n");
-    return KIOSK_RET_PARSING_ERROR;
+  // exponent
+  if(i < len && (s[i] == 'e' || s[i] == 'E')) {
+    bool exp_neg = false;
+    i++;
+    if(i < len && (s[i] == '-' || s[i] == '+'))
+      exp_neg = (s[i++] == '-');
+    for(start = i; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+      if(exp < 1000)
+        exp = exp*10 + (s[i] - '0');
+    }
+    if(i == start)
+      return false;
+    if(exp_neg)
+      exp = -exp;
+  }
+  if(i != len)
+    return false;
+
+  // scale v to the requested number of decimals
+  int shift = decimals - frac + exp;
+  bool rounded = truncated;
+  for(; shift > 0 && v != 0; shift--) {
+    if(v > INT64_MAX / 10)
+      return false;
+    v *= 10;
+  }
+  if(shift < -18) {
+    // nothing left of the value
+    rounded |= (v != 0);
+    v = 0;
+  } else if(shift < 0) {
+    int64_t div = 1;
+    for(; shift < 0; shift++)
+      div *= 10;
+    int64_t rem = v % div;
+    v = v / div;
+    if(rem >= div - rem)
+      v++;
+    rounded |= (rem != 0);
+  }
+
+  *out = neg ? -v : v;
+  if(out_rounded != NULL)
+    *out_rounded = rounded;
+  return true;
+}
+
+/*
+ * Same as _parse_fixed() for a number token of either encoding. MessagePack floats can't hold most decimal amounts
+ * exactly, they are rounded to the nearest integer number of units and only reported as rounded if they were off
+ * by more than the float error.
+ */
+static bool _decode_fixed(bool binary, const char* s, int len, int decimals, int64_t* out, bool* out_rounded) {
+  if(!binary)
+    return _parse_fixed(s, len, decimals, out, out_rounded);
+
+  int64_t iv;
+  double dv;
+  bool is_int;
+  int64_t scale = 1;
+  if(!msgpack_get_number(s, len, &iv, &dv, &is_int))
+    return false;
+  for(int i = 0; i < decimals; i++)
+    scale *= 10;
+
+  int64_t v;
+  bool rounded = false;
+  if(is_int) {
+    if(iv > INT64_MAX / scale || iv < INT64_MIN / scale)
+      return false;
+    v = iv * scale;
+  } else {
+    double x = dv * scale;
+    if(!(x > -9e18 && x < 9e18))
+      return false;
+    v = (int64_t)(x < 0 ? x - 0.5 : x + 0.5);
+    rounded = x - v > 1e-6 || v - x > 1e-6;
   }
 
+  *out = v;
+  if(out_rounded != NULL)
+    *out_rounded = rounded;
+  return true;
+}
+
+bool decode_int(bool binary, int tok, const char* s, int len, int* out_value) {
+  int64_t v;
+  bool rounded;
+  if(tok != MJSON_TOK_NUMBER || !_decode_fixed(binary, s, len, 0, &v, &rounded) || rounded || v < INT_MIN || v > INT_MAX)
+    return false;
+  *out_value = (int)v;
+  return true;
+}
+
+static bool _key_is(bool binary, const char* key, int key_len, const char* name) {
+  // JSON keys include the quotes, MessagePack keys their header
+  const char* s;
+  int len;
+  int name_len = strlen(name);
+  return _str_payload(binary, key, key_len, &s, &len) && len == name_len && memcmp(s, name, name_len) == 0;
+}
+
+// mjson() callback for scan_members(), only looks at the members of the top-level object. Stops once all the keys
+// have been found.
+static int _scan_members_cb(int tok, const char* s, int off, int len, void* ud) {
+  struct member_scanner* scanner = (struct member_scanner*)ud;
+
+  switch(tok) {
+  case ':':
+  case ',':
+    return 0;
+
+  case '{':
+  case '[':
+    if(scanner->depth == 1)
+      scanner->value_start = off;
+    scanner->depth++;
+    return 0;
+
+  case '}':
+  case ']':
+    scanner->depth--;
+    if(scanner->depth == 1) {
+      // end of a container member
+      if(scanner->member != NULL) {
+        scanner->member->off = scanner->value_start;
+        scanner->member->len = off+len - scanner->value_start;
+        scanner->member->tok = tok == '}' ? MJSON_TOK_OBJECT : MJSON_TOK_ARRAY;
+        scanner->nb_found++;
+      }
+      scanner->member = NULL;
+    }
+    return scanner->nb_found == scanner->nb_keys;
+
+  case MJSON_TOK_KEY:
+    if(scanner->depth != 1)
+      return 0;
+    scanner->member = NULL;
+    for(int i = 0; i < scanner->nb_keys; i++) {
+      if(scanner->spans[i].len == 0 && _key_is(scanner->binary, s+off, len, scanner->keys[i])) {
+        scanner->member = &scanner->spans[i];
+        break;
+      }
+    }
+    return 0;
+  }
+
+  // scalar value
+  if(scanner->depth != 1)
+    return 0;
+  if(scanner->member != NULL) {
+    scanner->member->off = off;
+    scanner->member->len = len;
+    scanner->member->tok = tok;
+    scanner->nb_found++;
+  }
+  scanner->member = NULL;
+  return scanner->nb_found == scanner->nb_keys;
+}
+
+KIOSK_RET scan_members(const char* json, int json_len, bool binary, const char* const* keys, kiosk_json_span* out_spans, int nb_keys) {
+  struct member_scanner scanner;
+  memset(&scanner, 0, sizeof(scanner));
+  memset(out_spans, 0, nb_keys*sizeof(kiosk_json_span));
+  scanner.binary = binary;
+  scanner.keys = keys;
+  scanner.spans = out_spans;
+  scanner.nb_keys = nb_keys;
+
+  // only objects have members
+  if(binary) {
+    if(json_len <= 0 || !MSGPACK_IS_MAP_HEADER(json[0]))
+      return KIOSK_RET_PARSING_ERROR;
+    if(msgpack_scan(json, json_len, _scan_members_cb, &scanner) < 0)
+      return KIOSK_RET_PARSING_ERROR;
+    return KIOSK_RET_OK;
+  }
+
+  int i = 0;
+  while(i < json_len && (json[i] == ' ' || json[i] == '\t' || json[i] == '\n' || json[i] == '\r'))
+    i++;
+  if(i >= json_len || json[i] != '{')
+    return KIOSK_RET_PARSING_ERROR;
+
+  if(mjson(json, json_len, _scan_members_cb, &scanner) < 0)
+    return KIOSK_RET_PARSING_ERROR;
+
   return KIOSK_RET_OK;
 }
 
-KIOSK_RET check_response_ok(char* json, int json_len, int expected_cmd_id) {
-  char buff[32] = "";
-  int id = 0;
-  int val = 0;
+static bool _span_to_int(const char* json, bool binary, const kiosk_json_span* span, int* out_value) {
+  return decode_int(binary, span->tok, json + span->off, span->len, out_value);
+}
+
+KIOSK_RET parse_envelope(const char* json, int json_len, kiosk_envelope* out_env) {
+  static const char* const keys[] = {"id", "method", "result", "error", "params"};
+  kiosk_json_span spans[5];
+
+  memset(out_env, 0, sizeof(kiosk_envelope));
+  out_env->binary = json_len > 0 && MSGPACK_IS_MAP_HEADER(json[0]);
+  KIOSK_RET ret = scan_members(json, json_len, out_env->binary, keys, spans, 5);
+  if(ret != KIOSK_RET_OK)
+    return ret;
+
+  out_env->has_id = _span_to_int(json, out_env->binary, &spans[0], &out_env->id);
+  out_env->method = spans[1];
+  out_env->result = spans[2];
+  out_env->error = spans[3];
+  out_env->params = spans[4];
+  return KIOSK_RET_OK;
+}
+
+bool envelope_method_is(const char* json, const kiosk_envelope* env, const char* method) {
+  return env->method.tok == MJSON_TOK_STRING && _key_is(env->binary, json + env->method.off, env->method.len, method);
+}
+
+/*
+ * Maps a string token to its enumeration value, without copying it.
+ * Names rarely share a length, so the length comparison rejects almost all the other entries before memcmp().
+ */
+static bool _decode_enum(const struct enum_table* table, bool binary, const char* tok, int tok_len, int* out_value) {
+  const char* s;
+  int len;
+  if(!_str_payload(binary, tok, tok_len, &s, &len))
+    return false;
+  for(int i = 0; i < table->nb_names; i++) {
+    const struct enum_name* entry = &table->names[i];
+    if(entry->len == len && memcmp(entry->name, s, len) == 0) {
+      *out_value = entry->value;
+      return true;
+    }
+  }
+  KIOSK_ERROR("unsupported %s '%.*s'\n", table->what, len, s);
+  return false;
+}
 
+static KIOSK_RET _check_response_id(const kiosk_envelope* env, int expected_cmd_id) {
   // expect to have an ID field
-  if(parse_id(json, json_len, &id) != KIOSK_RET_OK) {
+  if(!env->has_id) {
     KIOSK_ERROR("missing 'id' field\n");
     return KIOSK_RET_PARSING_ERROR;
   }
-  if(id != expected_cmd_id) {
-    KIOSK_ERROR("unexpected id (got %d, expected %d)\n", id, expected_cmd_id);
+  if(env->id != expected_cmd_id) {
+    KIOSK_ERROR("unexpected id (got %d, expected %d)\n", env->id, expected_cmd_id);
     return KIOSK_RET_PARSING_ERROR;
   }
+  return KIOSK_RET_OK;
+}
+
+KIOSK_RET parse_resp_result(const char* json, const kiosk_envelope* env, int expected_cmd_id, char* out_result, int max_out_size) {
+  KIOSK_RET ret = _check_response_id(env, expected_cmd_id);
+  if(ret != KIOSK_RET_OK)
+    return ret;
+
+  // get the result as a string and parse it
+  if(env->result.tok != MJSON_TOK_STRING || decode_string(env->binary, json + env->result.off, env->result.len, out_result, max_out_size) <= 0) {
+    KIOSK_ERROR("missing 'result' field\n");
+    return KIOSK_RET_PARSING_ERROR;
+  }
+
+  return KIOSK_RET_OK;
+}
+
+KIOSK_RET check_response_ok(const char* json, const kiosk_envelope* env, int expected_cmd_id) {
+  KIOSK_RET ret = _check_response_id(env, expected_cmd_id);
+  if(ret != KIOSK_RET_OK)
+    return ret;
 
   // check for error
-  const char *p;
-  int n;
-  if(mjson_find(json, json_len, "$.error", &p, &n) == MJSON_TOK_OBJECT) {
-    KIOSK_ERROR("kiosk returned an error: %.*s\n", n, p);
+  if(env->error.tok == MJSON_TOK_OBJECT) {
+    KIOSK_ERROR("kiosk returned an error: %.*s\n", env->binary ? 0 : env->error.len, json + env->error.off);
     return KIOSK_RET_NEGATIVE_RESP;
   }
 
-  if(!mjson_get_bool(json, json_len, "$.result", &val)) {
+  if(env->result.tok != MJSON_TOK_TRUE && env->result.tok != MJSON_TOK_FALSE) {
     KIOSK_ERROR("missing 'result' field or wrong format\n");
     return KIOSK_RET_PARSING_ERROR;
   }
 
-  return(val ? KIOSK_RET_OK : KIOSK_RET_NEGATIVE_RESP);
+  return(env->result.tok == MJSON_TOK_TRUE ? KIOSK_RET_OK : KIOSK_RET_NEGATIVE_RESP);
 }
 
-KIOSK_RET parse_get_status(char* json, int json_len, int expected_cmd_id, KIOSK_STATUS* out_status) {
-  char buff[32] = "";
-
-  KIOSK_RET ret = parse_resp_result(json, json_len, expected_cmd_id, buff, sizeof(buff));
+// decodes a string result with the given enumeration table
+static KIOSK_RET _parse_resp_enum(const char* json, const kiosk_envelope* env, int expected_cmd_id, const struct enum_table* table, int* out_value) {
+  KIOSK_RET ret = _check_response_id(env, expected_cmd_id);
   if(ret != KIOSK_RET_OK)
     return ret;
 
-  if(strcmp(buff, "Ready") == 0)
-    *out_status = OK_READY;
-  else if(strcmp(buff, "PaymentTransaction") == 0)
-    *out_status = OK_TRANSACTION;
-  else if(strcmp(buff, "Update") == 0)
-    *out_status = OK_UPDATE;
-  else if(strcmp(buff, "Unconfirmed") == 0)
-    *out_status = OK_UNCONFIRMED;
-  else if(strcmp(buff, "NotReady") == 0)
-    *out_status = OK_NOT_READY;
-  else if(strcmp(buff, "NoReader") == 0)
-    *out_status = OK_NO_READER;
-  else if(strcmp(buff, "NoTerminalId") == 0)
-    *out_status = OK_NO_TERMINAL_ID;
-  else
+  if(env->result.tok != MJSON_TOK_STRING) {
+    KIOSK_ERROR("missing 'result' field\n");
+    return KIOSK_RET_PARSING_ERROR;
+  }
+
+  if(!_decode_enum(table, env->binary, json + env->result.off, env->result.len, out_value))
     return KIOSK_RET_PARSING_ERROR;
 
   return KIOSK_RET_OK;
 }
 
-KIOSK_RET parse_cancel_resp(char* json, int json_len, int expected_cmd_id) {
-	char buff[32] = "";
-	KIOSK_RET ret = parse_resp_result(json, json_len, expected_cmd_id, buff, sizeof(buff));
-	if(ret != KIOSK_RET_OK)
-		return ret;
-
-	if(strcmp(buff, "Ok") == 0)
-		ret = KIOSK_RET_OK;
-	else if(strcmp(buff, "NoTransaction" == 0))
-		ret = KIOSK_RET_OK;
-	else if(strcmp(buff, "CannotCancel" == 0))
-		ret = KIOSK_RET_NEGATIVE_RESP;
+KIOSK_RET parse_get_status(const char* json, const kiosk_envelope* env, int expected_cmd_id, KIOSK_STATUS* out_status) {
+  int status;
+  KIOSK_RET ret = _parse_resp_enum(json, env, expected_cmd_id, &kiosk_status_table, &status);
+  if(ret == KIOSK_RET_OK)
+    *out_status = status;
+  return ret;
+}
 
-	return ret;
+KIOSK_RET parse_cancel_resp(const char* json, const kiosk_envelope* env, int expected_cmd_id) {
+  int result;
+  KIOSK_RET ret = _parse_resp_enum(json, env, expected_cmd_id, &cancel_result_table, &result);
+  return ret == KIOSK_RET_OK ? (KIOSK_RET)result : ret;
 }
 
-bool parse_json_fields(const char* json, int json_len, struct json_field_parser_options *fields, int nb_fields) {
-  double dv;
-  int bv;
-  int len;
-  for(int i=0; i < nb_fields; i++) {
-    switch(fields[i].type) {
-    case JSON_TYPE_STRING:
-      len = mjson_get_string(json, json_len, fields[i].json_path, (char*)fields[i].out, fields[i].out_len-1);
-      if(len < 0) {
-        KIOSK_ERROR("failed to parse string field %s\n", fields[i].json_path);
-        return false;
-      }
-      ((char*)fields[i].out)[len] = '\0';
-      break;
-    case JSON_TYPE_BOOL:
-      if(mjson_get_bool(json, json_len, fields[i].json_path, &bv) == 0) {
-        KIOSK_ERROR("failed to parse boolean field %s\n", fields[i].json_path);
-        return false;
-      }
-      *(bool*)fields[i].out = (bv != 0);
-      break;
-    case JSON_TYPE_INT:
-      if(mjson_get_number(json, json_len, fields[i].json_path, &dv) == 0 || dv - (int)dv != 0) {
-        KIOSK_ERROR("failed to parse integer field %s\n", fields[i].json_path);
-        return false;
-      }
-      *(int*)fields[i].out = (int)dv;
-      break;
-    case JSON_TYPE_DOUBLE:
-      if(mjson_get_number(json, json_len, fields[i].json_path, &dv) == 0) {
-        KIOSK_ERROR("failed to parse float field %s\n", fields[i].json_path);
-        return false;
-      }
-      *(double*)fields[i].out = dv;
-      break;
+static bool _tc_decode_value(struct tc_decoder* dec, const struct tc_field* field, int tok, const char* s, int len) {
+  void* out = (char*)dec->resp + field->offset;
+  int64_t iv;
+  bool rounded;
+
+  switch(field->type) {
+  case JSON_TYPE_STRING:
+    if(tok != MJSON_TOK_STRING || decode_string(dec->binary, s, len, (char*)out, field->out_len) < 0) {
+      KIOSK_ERROR("failed to parse string field %s\n", field->key);
+      return false;
     }
+    break;
+  case JSON_TYPE_BOOL:
+    if(tok != MJSON_TOK_TRUE && tok != MJSON_TOK_FALSE) {
+      KIOSK_ERROR("failed to parse boolean field %s\n", field->key);
+      return false;
+    }
+    *(bool*)out = (tok == MJSON_TOK_TRUE);
+    break;
+  case JSON_TYPE_INT:
+    if(!decode_int(dec->binary, tok, s, len, (int*)out)) {
+      KIOSK_ERROR("failed to parse integer field %s\n", field->key);
+      return false;
+    }
+    break;
+  case JSON_TYPE_DOUBLE: {
+    double dv;
+    bool is_int;
+    if(tok != MJSON_TOK_NUMBER || (dec->binary && !msgpack_get_number(s, len, &iv, &dv, &is_int))) {
+      KIOSK_ERROR("failed to parse float field %s\n", field->key);
+      return false;
+    }
+    *(double*)out = !dec->binary ? strtod(s, NULL) : is_int ? (double)iv : dv;
+    break;
+  }
+  case JSON_TYPE_CENTS:
+    if(tok != MJSON_TOK_NUMBER || !_decode_fixed(dec->binary, s, len, 2, &iv, &rounded) || iv < 0 || iv > UINT32_MAX) {
+      KIOSK_ERROR("failed to parse amount field %s\n", field->key);
+      return false;
+    }
+    if(rounded)
+      KIOSK_INFO("amount field %s rounded to %lld cents: %.*s\n", field->key, (long long)iv, dec->binary ? 0 : len, s);
+    *(uint32_t*)out = (uint32_t)iv;
+    break;
+  case JSON_TYPE_ENUM:
+    if(tok != MJSON_TOK_STRING) {
+      KIOSK_ERROR("failed to parse enum field %s\n", field->key);
+      return false;
+    }
+    if(!_decode_enum(field->enum_table, dec->binary, s, len, (int*)out))
+      return false;
+    break;
   }
   return true;
 }
 
-KIOSK_RET parse_transaction_complete(char* json, int json_len, otiKioskPaymentResponse *out_pmt_resp, int* out_id) {
+// mjson() callback, called once per token of the params object. Stops on error or once all the fields are decoded.
+static int _tc_decoder_cb(int tok, const char* s, int off, int len, void* ud) {
+  struct tc_decoder* dec = (struct tc_decoder*)ud;
+  enum tc_scope scope = dec->depth < (int)(sizeof(dec->scopes)/sizeof(dec->scopes[0])) ? dec->scopes[dec->depth] : TC_SCOPE_OTHER;
+  s += off;
+
+  if(dec->error)
+    return 1;
+
+  switch(tok) {
+  case ':':
+  case ',':
+    return 0;
+
+  case MJSON_TOK_KEY:
+    dec->key = s;
+    dec->key_len = len;
+    return 0;
+
+  case '{':
+  case '[': {
+    // find out which object we are entering
+    enum tc_scope child = TC_SCOPE_OTHER;
+    if(tok == '{') {
+      if(dec->depth == 0)
+        child = TC_SCOPE_PARAMS;
+      else if(scope == TC_SCOPE_PARAMS && dec->key != NULL && _key_is(dec->binary, dec->key, dec->key_len, "authorizationDetails"))
+        child = TC_SCOPE_AUTH_DETAILS;
+    }
+    dec->depth++;
+    if(dec->depth < (int)(sizeof(dec->scopes)/sizeof(dec->scopes[0])))
+      dec->scopes[dec->depth] = child;
+    dec->key = NULL;
+    return 0;
+  }
+
+  case '}':
+  case ']':
+    dec->depth--;
+    dec->key = NULL;
+    return 0;
+  }
+
+  // a value, only the ones directly in a known object are of interest
+  const char* key = dec->key;
+  int key_len = dec->key_len;
+  dec->key = NULL;
+  if(key == NULL || scope == TC_SCOPE_OTHER)
+    return 0;
+
+  for(int i = 0; i < TC_NB_FIELDS; i++) {
+    if(tc_fields[i].scope == scope && _key_is(dec->binary, key, key_len, tc_fields[i].key)) {
+      // the first of duplicate keys wins, like the other scans
+      if((dec->found & (1u << i)) != 0)
+        return 0;
+      if(!_tc_decode_value(dec, &tc_fields[i], tok, s, len))
+        dec->error = true;
+      dec->found |= 1u << i;
+      return dec->error || dec->found == TC_ALL_FIELDS;
+    }
+  }
+  return 0;
+}
+
+KIOSK_RET parse_transaction_complete(const char* json, const kiosk_envelope* env, otiKioskPaymentResponse *out_pmt_resp) {
   // expect to have an ID field
-  if(parse_id(json, json_len, out_id) != KIOSK_RET_OK) {
+  if(!env->has_id) {
     KIOSK_ERROR("missing 'id' field\n");
     return KIOSK_RET_PARSING_ERROR;
   }
 
-  memset(out_pmt_resp, 0, sizeof(otiKioskPaymentResponse));
-
   // make sure that the method is "TransactionComplete"
-  const char *p;
-  int n;
-  if(mjson_find(json, json_len, "$.method", &p, &n) != MJSON_TOK_STRING || n != strlen("\"TransactionComplete\"") || memcmp("\"TransactionComplete\"", p, n) != 0)
+  if(!envelope_method_is(json, env, "TransactionComplete"))
     return KIOSK_RET_PARSING_ERROR;
 
-  // parse the fields
-  const char* s_params;
-  int params_len;
-  if(mjson_find(json, json_len, "$.params", &s_params, &params_len) != MJSON_TOK_OBJECT) {
+  if(env->params.tok != MJSON_TOK_OBJECT) {
     KIOSK_ERROR("failed to parse params in TransactionComplete event\n");
     return KIOSK_RET_PARSING_ERROR;
   }
 
-  char str_status[32];
-  struct json_field_parser_options fields[] = {
-      {"$.status", JSON_TYPE_STRING, str_status, sizeof(str_status)},
-      {"$.errorDescription", JSON_TYPE_STRING, &(out_pmt_resp->error_message), sizeof(out_pmt_resp->error_message)},
-      {"$.errorCode", JSON_TYPE_INT, &(out_pmt_resp->error_code), sizeof(out_pmt_resp->error_code)},
-      {"$.authorizationDetails.AmountAuthorized", JSON_TYPE_DOUBLE, &(out_pmt_resp->amount_authorized), sizeof(out_pmt_resp->amount_authorized)},
-      {"$.authorizationDetails.AmountRequested", JSON_TYPE_DOUBLE, &(out_pmt_resp->amount_requested), sizeof(out_pmt_resp->amount_requested)},
-      {"$.authorizationDetails.Transaction_Referance", JSON_TYPE_STRING, &(out_pmt_resp->transaction_reference), sizeof(out_pmt_resp->transaction_reference)},
-      {"$.authorizationDetails.PartialPan", JSON_TYPE_STRING, &(out_pmt_resp->partial_PAN), sizeof(out_pmt_resp->partial_PAN)},
-      {"$.authorizationDetails.CardType", JSON_TYPE_STRING, &(out_pmt_resp->card_type), sizeof(out_pmt_resp->card_type)},
-      {"$.authorizationDetails.Card_ID", JSON_TYPE_STRING, &(out_pmt_resp->card_id), sizeof(out_pmt_resp->card_id)},
-      {"$.authorizationDetails.CardToken", JSON_TYPE_STRING, &(out_pmt_resp->card_token), sizeof(out_pmt_resp->card_token)},
-  };
-  if(!parse_json_fields(s_params, params_len, fields, sizeof(fields)/sizeof(fields[0])))
-    return KIOSK_RET_PARSING_ERROR;
-
-  // translate the status
-  if(strcmp(str_status, "OK") == 0)
-    out_pmt_resp->status = otiTransactionStatus_OK;
-  else if(strcmp(str_status, "Declined") == 0)
-    out_pmt_resp->status = otiTransactionStatus_Declined;
-  else if(strcmp(str_status, "Error") == 0)
-    out_pmt_resp->status = otiTransactionStatus_Error;
-  else if(strcmp(str_status, "Timeout") == 0)
-    out_pmt_resp->status = otiTransactionStatus_Timeout;
-  else if(strcmp(str_status, "Cancelled") == 0)
-    out_pmt_resp->status = otiTransactionStatus_Cancelled;
-  else if(strcmp(str_status, "Void") == 0)
-    out_pmt_resp->status = otiTransactionStatus_Voided;
-  else if(strcmp(str_status, "LocalMifare") == 0)
-    out_pmt_resp->status = otiTransactionStatus_LocalMifare;
-  else {
-    KIOSK_ERROR("unsupported transaction status '%s'\n", str_status);
+  struct tc_decoder dec;
+  memset(&dec, 0, sizeof(dec));
+  memset(out_pmt_resp, 0, sizeof(otiKioskPaymentResponse));
+  dec.resp = out_pmt_resp;
+  dec.binary = env->binary;
+
+  // walk the params once, picking the fields as they come
+  int scanned = env->binary ? msgpack_scan(json + env->params.off, env->params.len, _tc_decoder_cb, &dec) : mjson(json + env->params.off, env->params.len, _tc_decoder_cb, &dec);
+  if(scanned < 0 || dec.error)
+    return KIOSK_RET_PARSING_ERROR;
+
+  for(int i = 0; i < TC_NB_FIELDS; i++) {
+    if((TC_REQUIRED_FIELDS & (1u << i)) != 0 && (dec.found & (1u << i)) == 0) {
+      KIOSK_ERROR("missing field %s in TransactionComplete event\n", tc_fields[i].key);
+      return KIOSK_RET_PARSING_ERROR;
+    }
+  }
+
+  // amounts in currency units, for the applications that still use them
+  out_pmt_resp->amount_requested = out_pmt_resp->amount_requested_cents / 100.0;
+  out_pmt_resp->amount_authorized = out_pmt_resp->amount_authorized_cents / 100.0;
+
+  return KIOSK_RET_OK;
+}
+
+KIOSK_RET transaction_view_init(LibOtiKiosk_TransactionView* view, const char* json, const kiosk_envelope* env) {
+  memset(view, 0, sizeof(LibOtiKiosk_TransactionView));
+
+  // same requirements as parse_transaction_complete(), the fields are checked when accessed
+  if(!env->has_id || !envelope_method_is(json, env, "TransactionComplete") || env->params.tok != MJSON_TOK_OBJECT)
     return KIOSK_RET_PARSING_ERROR;
+
+  view->json = json;
+  view->env = *env;
+  return KIOSK_RET_OK;
+}
+
+// locates the members of the params on the first access
+static kiosk_json_span* _view_member(LibOtiKiosk_TransactionView* view, int member) {
+  static const char* const keys[VIEW_NB_MEMBERS] = {"status", "errorDescription", "errorCode", "authorizationDetails"};
+
+  if(!view->indexed) {
+    const char* params = view->json + view->env.params.off;
+    if(scan_members(params, view->env.params.len, view->env.binary, keys, view->members, VIEW_NB_MEMBERS) != KIOSK_RET_OK)
+      memset(view->members, 0, sizeof(view->members));
+    for(int i = 0; i < VIEW_NB_MEMBERS; i++)
+      view->members[i].off += view->env.params.off;
+    view->indexed = true;
   }
 
+  return view->members[member].len > 0 ? &view->members[member] : NULL;
+}
+
+static KIOSK_RET _view_get_string(const LibOtiKiosk_TransactionView* view, const kiosk_json_span* span, char* out_value, int max_out_size) {
+  if(span == NULL || span->tok != MJSON_TOK_STRING || out_value == NULL)
+    return KIOSK_RET_PARSING_ERROR;
+  if(decode_string(view->env.binary, view->json + span->off, span->len, out_value, max_out_size) < 0)
+    return KIOSK_RET_PARSING_ERROR;
+  return KIOSK_RET_OK;
+}
+
+static KIOSK_RET _view_get_cents(const LibOtiKiosk_TransactionView* view, const kiosk_json_span* span, uint32_t* out_cents) {
+  int64_t v;
+  if(span == NULL || span->tok != MJSON_TOK_NUMBER || !_decode_fixed(view->env.binary, view->json + span->off, span->len, 2, &v, NULL) || v < 0 || v > UINT32_MAX)
+    return KIOSK_RET_PARSING_ERROR;
+  *out_cents = (uint32_t)v;
+  return KIOSK_RET_OK;
+}
+
+int LibOtiKiosk_View_Get_Id(LibOtiKiosk_TransactionView* view) {
+  return view->env.id;
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_Status(LibOtiKiosk_TransactionView* view, otiTransactionStatus* out_status) {
+  kiosk_json_span* span = _view_member(view, VIEW_STATUS);
+  int status;
+  if(span == NULL || span->tok != MJSON_TOK_STRING || !_decode_enum(&transaction_status_table, view->env.binary, view->json + span->off, span->len, &status))
+    return KIOSK_RET_PARSING_ERROR;
+  *out_status = status;
+  return KIOSK_RET_OK;
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_ErrorCode(LibOtiKiosk_TransactionView* view, int* out_error_code) {
+  kiosk_json_span* span = _view_member(view, VIEW_ERROR_CODE);
+  if(span == NULL || !_span_to_int(view->json, view->env.binary, span, out_error_code))
+    return KIOSK_RET_PARSING_ERROR;
+  return KIOSK_RET_OK;
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_ErrorDescription(LibOtiKiosk_TransactionView* view, char* out_description, int max_out_size) {
+  return _view_get_string(view, _view_member(view, VIEW_ERROR_DESCRIPTION), out_description, max_out_size);
+}
+
+// locates a member of authorizationDetails, with an offset relative to the event
+static kiosk_json_span* _view_auth_detail(LibOtiKiosk_TransactionView* view, const char* key, kiosk_json_span* out_span) {
+  kiosk_json_span* details = _view_member(view, VIEW_AUTH_DETAILS);
+  if(details == NULL || details->tok != MJSON_TOK_OBJECT || key == NULL)
+    return NULL;
+
+  // authorizationDetails is small, it's scanned again for each key
+  if(scan_members(view->json + details->off, details->len, view->env.binary, &key, out_span, 1) != KIOSK_RET_OK || out_span->len == 0)
+    return NULL;
+
+  out_span->off += details->off;
+  return out_span;
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_AuthDetail_Raw(LibOtiKiosk_TransactionView* view, const char* key, const char** out_json, int* out_len) {
+  kiosk_json_span span;
+  if(_view_auth_detail(view, key, &span) == NULL)
+    return KIOSK_RET_PARSING_ERROR;
+
+  *out_json = view->json + span.off;
+  *out_len = span.len;
   return KIOSK_RET_OK;
 }
+
+KIOSK_RET LibOtiKiosk_View_Get_AmountRequested(LibOtiKiosk_TransactionView* view, uint32_t* out_cents) {
+  kiosk_json_span span;
+  return _view_get_cents(view, _view_auth_detail(view, "AmountRequested", &span), out_cents);
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_AmountAuthorized(LibOtiKiosk_TransactionView* view, uint32_t* out_cents) {
+  kiosk_json_span span;
+  return _view_get_cents(view, _view_auth_detail(view, "AmountAuthorized", &span), out_cents);
+}
+
+KIOSK_RET LibOtiKiosk_View_Get_AuthDetail_String(LibOtiKiosk_TransactionView* view, const char* key, char* out_value, int max_out_size) {
+  kiosk_json_span span;
+  return _view_get_string(view, _view_auth_detail(view, key, &span), out_value, max_out_size);
+}
+
+KIOSK_RET LibOtiKiosk_View_Decode(LibOtiKiosk_TransactionView* view, otiKioskPaymentResponse* out_resp) {
+  return parse_transaction_complete(view->json, &view->env, out_resp);
+}
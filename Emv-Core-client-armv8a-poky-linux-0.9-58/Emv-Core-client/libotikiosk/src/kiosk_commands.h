@@ -10,13 +10,91 @@
 
 #include <stdbool.h>
 #include "libotikiosk.h"
+#include "kiosk_schema.h"
+
+// size of the buffers holding serialized commands
+#define KIOSK_CMD_MAX_SIZE 512
+
+// size of the buffers receiving the responses of the commands
+#define KIOSK_RESP_MAX_SIZE 128
+
+// location of a member value in a JSON message, relative to the start of the message
+typedef struct {
+  int off;
+  int len; // 0 when the member is absent
+  int tok; // mjson token type of the value
+} kiosk_json_span;
+
+// top-level members of a JSON-RPC message, see parse_envelope()
+typedef struct {
+  bool binary; // MessagePack message, the spans are then MessagePack values (see kiosk_msgpack.h)
+  bool has_id;
+  int id;
+  kiosk_json_span method;
+  kiosk_json_span result;
+  kiosk_json_span error;
+  kiosk_json_span params;
+} kiosk_envelope;
+
+/**
+ * Serializes a command into the provided buffer, using mjson_printf() formats:
+ * %Q for JSON-escaped strings, %d/%u for integers, %B for booleans.
+ * Returns the command length (without the terminating zero), or -1 if it didn't fit.
+ */
+int build_command(char* out, int out_size, const char* template, ...);
+
+// members of the params of a TransactionComplete event, located on the first access to one of them
+enum {
+  VIEW_STATUS,
+  VIEW_ERROR_DESCRIPTION,
+  VIEW_ERROR_CODE,
+  VIEW_AUTH_DETAILS,
+  VIEW_NB_MEMBERS
+};
+
+struct LibOtiKiosk_TransactionView {
+  const char* json; // event in the reception buffer
+  kiosk_envelope env;
+  bool indexed;
+  kiosk_json_span members[VIEW_NB_MEMBERS]; // relative to json
+};
 
-char* build_command(const char* template, ...);
 KIOSK_RET parse_id(char *json, int json_len, int *out_id);
-KIOSK_RET parse_resp_result(char* json, int json_len, int expected_cmd_id, char* out_result, int max_out_size);
-KIOSK_RET check_response_ok(char* json, int json_len, int expected_id);
-KIOSK_RET parse_get_status(char* json, int json_len, int expected_id, KIOSK_STATUS* out_status);
-KIOSK_RET parse_transaction_complete(char* json, int json_len, otiKioskPaymentResponse *out_pmt_resp, int* out_id);
-KIOSK_RET parse_cancel_resp(char* json, int json_len, int expected_cmd_id);
+
+/*
+ * Unescapes a JSON string token (including its quotes) into out, and checks that the result is valid UTF-8.
+ * Returns the length of the string, or -1 if it is invalid or doesn't fit in max_out_size with its terminator.
+ */
+int unescape_string(const char* tok, int tok_len, char* out, int max_out_size);
+
+/*
+ * Same as unescape_string() for a string token of either encoding, MessagePack strings are copied as they are.
+ */
+int decode_string(bool binary, const char* tok, int tok_len, char* out, int max_out_size);
+
+// converts a number token of either encoding to an int, false if it isn't an integer
+bool decode_int(bool binary, int tok, const char* s, int len, int* out_value);
+
+/**
+ * Locates the given members of an object (a map for MessagePack) in a single scan. Absent members have a zero
+ * length span. The offsets are relative to json.
+ */
+KIOSK_RET scan_members(const char* json, int json_len, bool binary, const char* const* keys, kiosk_json_span* out_spans, int nb_keys);
+
+/**
+ * Locates the id, method, result, error and params members of a JSON-RPC message in a single scan.
+ * The spans are offsets, so the envelope stays valid if the message is copied to another buffer.
+ * MessagePack messages are recognized by their first byte.
+ */
+KIOSK_RET parse_envelope(const char* json, int json_len, kiosk_envelope* out_env);
+bool envelope_method_is(const char* json, const kiosk_envelope* env, const char* method);
+
+// the parsing functions below work on a message already classified by parse_envelope()
+KIOSK_RET parse_resp_result(const char* json, const kiosk_envelope* env, int expected_cmd_id, char* out_result, int max_out_size);
+KIOSK_RET check_response_ok(const char* json, const kiosk_envelope* env, int expected_id);
+KIOSK_RET parse_get_status(const char* json, const kiosk_envelope* env, int expected_id, KIOSK_STATUS* out_status);
+KIOSK_RET parse_transaction_complete(const char* json, const kiosk_envelope* env, otiKioskPaymentResponse *out_pmt_resp);
+KIOSK_RET transaction_view_init(LibOtiKiosk_TransactionView* view, const char* json, const kiosk_envelope* env);
+KIOSK_RET parse_cancel_resp(const char* json, const kiosk_envelope* env, int expected_cmd_id);
 
 #endif /* LIBOTIKIOSK_SRC_KIOSK_COMMANDS_H_ */
@@ -0,0 +1,659 @@
+/*
+ * kiosk_msgpack.c
+ *
+ * MessagePack encoding of the JSON-RPC messages, see kiosk_msgpack.h
+ */
+
+// implements
+#include "kiosk_msgpack.h"
+
+// uses
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// type of a MessagePack value, from its first byte
+enum msgpack_type {
+  MSGPACK_NIL,
+  MSGPACK_BOOL,
+  MSGPACK_UINT,
+  MSGPACK_INT,
+  MSGPACK_FLOAT,
+  MSGPACK_STR,
+  MSGPACK_BIN,
+  MSGPACK_EXT,
+  MSGPACK_ARRAY,
+  MSGPACK_MAP
+};
+
+struct msgpack_header {
+  enum msgpack_type type;
+  int size; // header bytes, including the ext type byte
+  uint64_t n; // payload bytes, or number of entries of an array / map
+};
+
+// state of msgpack_scan()
+struct msgpack_scanner {
+  const uint8_t* s;
+  int len;
+  mjson_cb_t cb;
+  void* ud;
+  int stop; // offset following the token on which the callback stopped the walk, 0 while walking
+};
+
+static void _put_be(struct msgpack_out* out, uint8_t type, uint64_t v, int nb_bytes) {
+  uint8_t buf[9];
+  buf[0] = type;
+  for(int i = 0; i < nb_bytes; i++)
+    buf[1 + i] = (uint8_t)(v >> (8 * (nb_bytes - 1 - i)));
+  msgpack_put_raw(out, buf, 1 + nb_bytes);
+}
+
+static uint64_t _get_be(const uint8_t* s, int nb_bytes) {
+  uint64_t v = 0;
+  for(int i = 0; i < nb_bytes; i++)
+    v = (v << 8) | s[i];
+  return v;
+}
+
+void msgpack_put_raw(struct msgpack_out* out, const void* data, int len) {
+  if(out->overflow || len > out->size - out->len) {
+    out->overflow = true;
+    return;
+  }
+  memcpy(out->buf + out->len, data, len);
+  out->len += len;
+}
+
+// header of a container or string, the fix variant carries the length in its low bits
+static void _put_length(struct msgpack_out* out, uint8_t fix, uint32_t fix_max, uint8_t type8, uint8_t type16, uint8_t type32, uint32_t n) {
+  if(n <= fix_max) {
+    uint8_t c = fix | n;
+    msgpack_put_raw(out, &c, 1);
+  } else if(type8 != 0 && n <= 0xff) {
+    _put_be(out, type8, n, 1);
+  } else if(n <= 0xffff) {
+    _put_be(out, type16, n, 2);
+  } else {
+    _put_be(out, type32, n, 4);
+  }
+}
+
+void msgpack_put_map(struct msgpack_out* out, uint32_t nb_members) {
+  _put_length(out, 0x80, 15, 0, 0xde, 0xdf, nb_members);
+}
+
+void msgpack_put_array(struct msgpack_out* out, uint32_t nb_items) {
+  _put_length(out, 0x90, 15, 0, 0xdc, 0xdd, nb_items);
+}
+
+void msgpack_put_str(struct msgpack_out* out, const char* s, int len) {
+  _put_length(out, 0xa0, 31, 0xd9, 0xda, 0xdb, len);
+  msgpack_put_raw(out, s, len);
+}
+
+void msgpack_put_uint(struct msgpack_out* out, uint64_t v) {
+  if(v < 0x80) {
+    uint8_t c = (uint8_t)v;
+    msgpack_put_raw(out, &c, 1);
+  } else if(v <= 0xff) {
+    _put_be(out, 0xcc, v, 1);
+  } else if(v <= 0xffff) {
+    _put_be(out, 0xcd, v, 2);
+  } else if(v <= 0xffffffff) {
+    _put_be(out, 0xce, v, 4);
+  } else {
+    _put_be(out, 0xcf, v, 8);
+  }
+}
+
+void msgpack_put_int(struct msgpack_out* out, int64_t v) {
+  if(v >= 0) {
+    msgpack_put_uint(out, (uint64_t)v);
+  } else if(v >= -32) {
+    uint8_t c = (uint8_t)v;
+    msgpack_put_raw(out, &c, 1);
+  } else if(v >= INT8_MIN) {
+    _put_be(out, 0xd0, (uint64_t)v, 1);
+  } else if(v >= INT16_MIN) {
+    _put_be(out, 0xd1, (uint64_t)v, 2);
+  } else if(v >= INT32_MIN) {
+    _put_be(out, 0xd2, (uint64_t)v, 4);
+  } else {
+    _put_be(out, 0xd3, (uint64_t)v, 8);
+  }
+}
+
+void msgpack_put_double(struct msgpack_out* out, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  _put_be(out, 0xcb, bits, 8);
+}
+
+void msgpack_put_bool(struct msgpack_out* out, bool v) {
+  uint8_t c = v ? 0xc3 : 0xc2;
+  msgpack_put_raw(out, &c, 1);
+}
+
+void msgpack_put_nil(struct msgpack_out* out) {
+  uint8_t c = 0xc0;
+  msgpack_put_raw(out, &c, 1);
+}
+
+// decodes the header at s, returns 0 if more bytes are needed, -1 if it is invalid
+static int _get_header(const uint8_t* s, int len, struct msgpack_header* h) {
+  if(len < 1)
+    return 0;
+
+  uint8_t c = s[0];
+  h->size = 1;
+  h->n = 0;
+  if(c < 0x80 || c >= 0xe0) {
+    h->type = c < 0x80 ? MSGPACK_UINT : MSGPACK_INT;
+    return 1;
+  }
+  if(c < 0x90) {
+    h->type = MSGPACK_MAP;
+    h->n = c & 0x0f;
+    return 1;
+  }
+  if(c < 0xa0) {
+    h->type = MSGPACK_ARRAY;
+    h->n = c & 0x0f;
+    return 1;
+  }
+  if(c < 0xc0) {
+    h->type = MSGPACK_STR;
+    h->n = c & 0x1f;
+    return 1;
+  }
+
+  // size of the length field, or of the number for the numeric types
+  static const struct {
+    int8_t type;
+    int8_t len_size;
+    int8_t payload; // fixed payload size, when len_size is 0
+  } types[0x20] = {
+    [0x00] = {MSGPACK_NIL, 0, 0}, [0x01] = {-1, 0, 0}, [0x02] = {MSGPACK_BOOL, 0, 0}, [0x03] = {MSGPACK_BOOL, 0, 0},
+    [0x04] = {MSGPACK_BIN, 1, 0}, [0x05] = {MSGPACK_BIN, 2, 0}, [0x06] = {MSGPACK_BIN, 4, 0},
+    [0x07] = {MSGPACK_EXT, 1, 0}, [0x08] = {MSGPACK_EXT, 2, 0}, [0x09] = {MSGPACK_EXT, 4, 0},
+    [0x0a] = {MSGPACK_FLOAT, 0, 4}, [0x0b] = {MSGPACK_FLOAT, 0, 8},
+    [0x0c] = {MSGPACK_UINT, 0, 1}, [0x0d] = {MSGPACK_UINT, 0, 2}, [0x0e] = {MSGPACK_UINT, 0, 4}, [0x0f] = {MSGPACK_UINT, 0, 8},
+    [0x10] = {MSGPACK_INT, 0, 1}, [0x11] = {MSGPACK_INT, 0, 2}, [0x12] = {MSGPACK_INT, 0, 4}, [0x13] = {MSGPACK_INT, 0, 8},
+    [0x14] = {MSGPACK_EXT, 0, 2}, [0x15] = {MSGPACK_EXT, 0, 3}, [0x16] = {MSGPACK_EXT, 0, 5}, [0x17] = {MSGPACK_EXT, 0, 9},
+    [0x18] = {MSGPACK_EXT, 0, 17},
+    [0x19] = {MSGPACK_STR, 1, 0}, [0x1a] = {MSGPACK_STR, 2, 0}, [0x1b] = {MSGPACK_STR, 4, 0},
+    [0x1c] = {MSGPACK_ARRAY, 2, 0}, [0x1d] = {MSGPACK_ARRAY, 4, 0},
+    [0x1e] = {MSGPACK_MAP, 2, 0}, [0x1f] = {MSGPACK_MAP, 4, 0},
+  };
+  const int i = c - 0xc0;
+  if(types[i].type < 0)
+    return -1;
+
+  h->type = (enum msgpack_type)types[i].type;
+  if(types[i].len_size == 0) {
+    h->n = types[i].payload;
+    return 1;
+  }
+
+  h->size = 1 + types[i].len_size;
+  if(h->type == MSGPACK_EXT)
+    h->size++; // type byte
+  if(len < h->size)
+    return 0;
+  h->n = _get_be(s + 1, types[i].len_size);
+  return 1;
+}
+
+// bytes following the header, for the scalar types
+static uint64_t _payload_size(const struct msgpack_header* h) {
+  return h->type == MSGPACK_ARRAY || h->type == MSGPACK_MAP ? 0 : h->n;
+}
+
+int msgpack_value_len(const char* str, int len) {
+  const uint8_t* s = (const uint8_t*)str;
+  uint64_t remaining = 1; // values still to skip, the entries of the containers are added as they are entered
+  int pos = 0;
+
+  while(remaining > 0) {
+    struct msgpack_header h;
+    int ret = _get_header(s + pos, len - pos, &h);
+    if(ret <= 0)
+      return ret < 0 ? MJSON_ERROR_INVALID_INPUT : 0;
+
+    uint64_t end = (uint64_t)pos + h.size + _payload_size(&h);
+    if(end > (uint64_t)len)
+      return end > INT32_MAX ? MJSON_ERROR_INVALID_INPUT : 0;
+    pos = (int)end;
+
+    remaining--;
+    if(h.type == MSGPACK_ARRAY)
+      remaining += h.n;
+    else if(h.type == MSGPACK_MAP)
+      remaining += 2 * h.n;
+  }
+  return pos;
+}
+
+void msgpack_framer_init(struct msgpack_framer* f) {
+  mjson_stream_init(&f->stream);
+  f->filled = 0;
+}
+
+static void _framer_consume(struct msgpack_framer* f, char* buf, int len) {
+  memmove(buf, buf + len, f->filled - len);
+  f->filled -= len;
+}
+
+int msgpack_framer_feed(struct msgpack_framer* f, char* buf, int len, msgpack_frame_cb cb, void* ud) {
+  // the stream has seen the bytes already in the buffer
+  int pos = f->filled;
+  f->filled += len;
+  while(pos < f->filled) {
+    if(f->stream.start < 0) {
+      // between frames, a MessagePack map header starts a binary frame. It has no stream state, so a partial one
+      // is measured again from the start of the buffer.
+      int ws = 0;
+      while(ws < f->filled && (buf[ws] == ' ' || buf[ws] == '\n' || buf[ws] == '\t' || buf[ws] == '\r'))
+        ws++;
+      _framer_consume(f, buf, ws);
+      mjson_stream_init(&f->stream);
+      pos = 0;
+      if(f->filled == 0)
+        break;
+      if(MSGPACK_IS_MAP_HEADER(buf[0])) {
+        int n = msgpack_value_len(buf, f->filled);
+        if(n < 0)
+          return MJSON_ERROR_INVALID_INPUT;
+        if(n == 0)
+          break;
+        if(!cb(buf, n, ud))
+          return 0;
+        _framer_consume(f, buf, n);
+        continue;
+      }
+    }
+
+    int used = mjson_stream_feed(&f->stream, buf + pos, f->filled - pos);
+    if(used < 0)
+      return MJSON_ERROR_INVALID_INPUT;
+    pos += used;
+    if(!f->stream.done)
+      break;
+
+    // the stream was started at the beginning of the buffer
+    if(!cb(buf + f->stream.start, f->stream.len - f->stream.start, ud))
+      return 0;
+    _framer_consume(f, buf, pos);
+    pos = 0;
+    mjson_stream_init(&f->stream);
+  }
+  return 0;
+}
+
+// reports a token, returns false once the callback has stopped the walk
+static bool _report(struct msgpack_scanner* sc, int tok, int off, int len, int end) {
+  if(sc->cb(tok, (const char*)sc->s, off, len, sc->ud) != 0) {
+    sc->stop = end;
+    return false;
+  }
+  return true;
+}
+
+// walks the value at pos, returns the offset following it, 0 if the walk was stopped, or a negative error
+static int _scan_value(struct msgpack_scanner* sc, int pos, int depth) {
+  struct msgpack_header h;
+  if(_get_header(sc->s + pos, sc->len - pos, &h) <= 0)
+    return MJSON_ERROR_INVALID_INPUT;
+
+  int start = pos;
+  uint64_t end = (uint64_t)pos + h.size + _payload_size(&h);
+  if(end > (uint64_t)sc->len)
+    return MJSON_ERROR_INVALID_INPUT;
+  pos += h.size;
+
+  switch(h.type) {
+  case MSGPACK_NIL:
+    return _report(sc, MJSON_TOK_NULL, start, (int)end - start, (int)end) ? (int)end : 0;
+  case MSGPACK_BOOL:
+    return _report(sc, sc->s[start] == 0xc3 ? MJSON_TOK_TRUE : MJSON_TOK_FALSE, start, 1, (int)end) ? (int)end : 0;
+  case MSGPACK_UINT:
+  case MSGPACK_INT:
+  case MSGPACK_FLOAT:
+    return _report(sc, MJSON_TOK_NUMBER, start, (int)end - start, (int)end) ? (int)end : 0;
+  case MSGPACK_STR:
+    return _report(sc, MJSON_TOK_STRING, start, (int)end - start, (int)end) ? (int)end : 0;
+  case MSGPACK_BIN:
+  case MSGPACK_EXT:
+    return MJSON_ERROR_INVALID_INPUT;
+  case MSGPACK_ARRAY:
+  case MSGPACK_MAP:
+    break;
+  }
+
+  bool is_map = h.type == MSGPACK_MAP;
+  if(depth >= MJSON_MAX_DEPTH)
+    return MJSON_ERROR_TOO_DEEP;
+  if(!_report(sc, is_map ? '{' : '[', start, 1, pos))
+    return 0;
+
+  for(uint64_t i = 0; i < h.n; i++) {
+    if(is_map) {
+      // keys must be strings, as in JSON
+      struct msgpack_header k;
+      if(_get_header(sc->s + pos, sc->len - pos, &k) <= 0 || k.type != MSGPACK_STR || (uint64_t)pos + k.size + k.n > (uint64_t)sc->len)
+        return MJSON_ERROR_INVALID_INPUT;
+      int key_end = pos + k.size + (int)k.n;
+      if(!_report(sc, MJSON_TOK_KEY, pos, key_end - pos, key_end))
+        return 0;
+      pos = key_end;
+    }
+    pos = _scan_value(sc, pos, depth + 1);
+    if(pos <= 0)
+      return pos;
+  }
+
+  return _report(sc, is_map ? '}' : ']', pos - 1, 1, pos) ? pos : 0;
+}
+
+int msgpack_scan(const char* s, int len, mjson_cb_t cb, void* ud) {
+  struct msgpack_scanner sc = {(const uint8_t*)s, len, cb, ud, 0};
+  int ret = _scan_value(&sc, 0, 0);
+  return ret == 0 && sc.stop > 0 ? sc.stop : ret;
+}
+
+bool msgpack_get_str(const char* str, int len, const char** out_str, int* out_len) {
+  const uint8_t* s = (const uint8_t*)str;
+  struct msgpack_header h;
+  if(_get_header(s, len, &h) <= 0 || h.type != MSGPACK_STR || (uint64_t)h.size + h.n > (uint64_t)len)
+    return false;
+  *out_str = str + h.size;
+  *out_len = (int)h.n;
+  return true;
+}
+
+bool msgpack_get_number(const char* str, int len, int64_t* out_int, double* out_double, bool* out_is_int) {
+  const uint8_t* s = (const uint8_t*)str;
+  struct msgpack_header h;
+  if(_get_header(s, len, &h) <= 0 || (uint64_t)h.size + h.n > (uint64_t)len)
+    return false;
+
+  uint64_t v = _get_be(s + h.size, (int)h.n);
+  *out_is_int = true;
+  switch(h.type) {
+  case MSGPACK_UINT:
+    if(h.n == 0)
+      v = s[0];
+    if(v > INT64_MAX) {
+      *out_is_int = false;
+      *out_double = (double)v;
+    } else {
+      *out_int = (int64_t)v;
+    }
+    return true;
+  case MSGPACK_INT:
+    if(h.n == 0)
+      *out_int = (int8_t)s[0];
+    else if(h.n == 1)
+      *out_int = (int8_t)v;
+    else if(h.n == 2)
+      *out_int = (int16_t)v;
+    else if(h.n == 4)
+      *out_int = (int32_t)v;
+    else
+      *out_int = (int64_t)v;
+    return true;
+  case MSGPACK_FLOAT:
+    *out_is_int = false;
+    if(h.n == 4) {
+      uint32_t bits = (uint32_t)v;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      *out_double = f;
+    } else {
+      memcpy(out_double, &v, sizeof(*out_double));
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+// writes the value at pos as JSON, returns the offset following it or a negative error
+static int _to_json(const uint8_t* s, int len, int pos, int depth, struct mjson_out* out, int* out_len) {
+  struct msgpack_header h;
+  if(_get_header(s + pos, len - pos, &h) <= 0)
+    return MJSON_ERROR_INVALID_INPUT;
+  uint64_t end = (uint64_t)pos + h.size + _payload_size(&h);
+  if(end > (uint64_t)len)
+    return MJSON_ERROR_INVALID_INPUT;
+
+  char num[32];
+  int64_t iv;
+  double dv;
+  bool is_int;
+  switch(h.type) {
+  case MSGPACK_NIL:
+    *out_len += out->print(out, "null", 4);
+    return (int)end;
+  case MSGPACK_BOOL:
+    *out_len += s[pos] == 0xc3 ? out->print(out, "true", 4) : out->print(out, "false", 5);
+    return (int)end;
+  case MSGPACK_UINT:
+  case MSGPACK_INT:
+  case MSGPACK_FLOAT:
+    msgpack_get_number((const char*)s + pos, (int)(end - pos), &iv, &dv, &is_int);
+    if(is_int)
+      snprintf(num, sizeof(num), "%" PRId64, iv);
+    else if(dv != dv || dv > 1.7976931348623157e308 || dv < -1.7976931348623157e308)
+      snprintf(num, sizeof(num), "null"); // no NaN nor infinity in JSON
+    else
+      snprintf(num, sizeof(num), "%.17g", dv);
+    *out_len += out->print(out, num, (int)strlen(num));
+    return (int)end;
+  case MSGPACK_STR:
+    *out_len += mjson_print_str(out, (const char*)s + pos + h.size, (int)h.n);
+    return (int)end;
+  case MSGPACK_BIN:
+  case MSGPACK_EXT:
+    return MJSON_ERROR_INVALID_INPUT;
+  case MSGPACK_ARRAY:
+  case MSGPACK_MAP:
+    break;
+  }
+
+  bool is_map = h.type == MSGPACK_MAP;
+  if(depth >= MJSON_MAX_DEPTH)
+    return MJSON_ERROR_TOO_DEEP;
+  *out_len += out->print(out, is_map ? "{" : "[", 1);
+  pos += h.size;
+  for(uint64_t i = 0; i < h.n; i++) {
+    if(i > 0)
+      *out_len += out->print(out, ",", 1);
+    if(is_map) {
+      struct msgpack_header k;
+      if(_get_header(s + pos, len - pos, &k) <= 0 || k.type != MSGPACK_STR)
+        return MJSON_ERROR_INVALID_INPUT;
+      pos = _to_json(s, len, pos, depth + 1, out, out_len);
+      if(pos < 0)
+        return pos;
+      *out_len += out->print(out, ":", 1);
+    }
+    pos = _to_json(s, len, pos, depth + 1, out, out_len);
+    if(pos < 0)
+      return pos;
+  }
+  *out_len += out->print(out, is_map ? "}" : "]", 1);
+  return pos;
+}
+
+int msgpack_to_json(const char* s, int len, struct mjson_out* out) {
+  int out_len = 0;
+  int ret = _to_json((const uint8_t*)s, len, 0, 0, out, &out_len);
+  return ret < 0 ? ret : out_len;
+}
+
+// state of msgpack_from_json()
+struct msgpack_writer {
+  struct msgpack_out* out;
+  int depth;
+  struct {
+    int header; // offset of the 32-bit header, patched with the count when the container ends
+    uint32_t count;
+  } containers[MJSON_MAX_DEPTH];
+};
+
+// counts a value (or key) in its container
+static void _count_entry(struct msgpack_writer* w, int tok) {
+  if(w->depth == 0)
+    return;
+  bool is_map = w->out->overflow || w->out->buf[w->containers[w->depth - 1].header] == 0xdf;
+  // map entries are counted on their key
+  if(!is_map || tok == MJSON_TOK_KEY)
+    w->containers[w->depth - 1].count++;
+}
+
+// JSON string token, including the quotes, to a MessagePack string
+static void _put_json_string(struct msgpack_out* out, const char* tok, int tok_len) {
+  // the header is sized for the escaped length, which is an upper bound, and shrunk afterwards if possible
+  int max_len = tok_len - 2;
+  int header = max_len <= 31 ? 1 : max_len <= 0xff ? 2 : max_len <= 0xffff ? 3 : 5;
+  if(out->overflow || out->size - out->len < header) {
+    out->overflow = true;
+    return;
+  }
+
+  char* payload = (char*)out->buf + out->len + header;
+  int n = mjson_unescape(tok + 1, max_len, payload, out->size - out->len - header);
+  if(n < 0) {
+    out->overflow = true;
+    return;
+  }
+
+  struct msgpack_out hdr = MSGPACK_OUT(out->buf + out->len, header);
+  _put_length(&hdr, 0xa0, 31, 0xd9, 0xda, 0xdb, n);
+  if(hdr.len < header)
+    memmove(out->buf + out->len + hdr.len, payload, n);
+  out->len += hdr.len + n;
+}
+
+static void _put_json_number(struct msgpack_out* out, const char* s, int len) {
+  // integers keep their exact value, the others become doubles
+  bool is_int = len <= 18;
+  for(int i = 0; i < len && is_int; i++)
+    is_int = (s[i] >= '0' && s[i] <= '9') || (i == 0 && s[i] == '-');
+
+  char buf[64];
+  if(len >= (int)sizeof(buf)) {
+    out->overflow = true;
+    return;
+  }
+  memcpy(buf, s, len);
+  buf[len] = 0;
+  if(is_int)
+    msgpack_put_int(out, strtoll(buf, NULL, 10));
+  else
+    msgpack_put_double(out, strtod(buf, NULL));
+}
+
+static int _from_json_cb(int tok, const char* s, int off, int len, void* ud) {
+  struct msgpack_writer* w = (struct msgpack_writer*)ud;
+  struct msgpack_out* out = w->out;
+  s += off;
+
+  switch(tok) {
+  case ':':
+  case ',':
+    return 0;
+  case '{':
+  case '[':
+    _count_entry(w, tok);
+    if(w->depth >= MJSON_MAX_DEPTH) {
+      out->overflow = true;
+      return 1;
+    }
+    w->containers[w->depth].header = out->len;
+    w->containers[w->depth].count = 0;
+    w->depth++;
+    _put_be(out, tok == '{' ? 0xdf : 0xdd, 0, 4);
+    return 0;
+  case '}':
+  case ']':
+    w->depth--;
+    if(!out->overflow) {
+      struct msgpack_out hdr = MSGPACK_OUT(out->buf + w->containers[w->depth].header, 5);
+      _put_be(&hdr, out->buf[w->containers[w->depth].header], w->containers[w->depth].count, 4);
+    }
+    return 0;
+  }
+
+  _count_entry(w, tok);
+  switch(tok) {
+  case MJSON_TOK_KEY:
+  case MJSON_TOK_STRING:
+    _put_json_string(out, s, len);
+    break;
+  case MJSON_TOK_NUMBER:
+    _put_json_number(out, s, len);
+    break;
+  case MJSON_TOK_TRUE:
+  case MJSON_TOK_FALSE:
+    msgpack_put_bool(out, tok == MJSON_TOK_TRUE);
+    break;
+  case MJSON_TOK_NULL:
+    msgpack_put_nil(out);
+    break;
+  }
+  return out->overflow;
+}
+
+int msgpack_from_json(const char* json, int len, struct msgpack_out* out) {
+  struct msgpack_writer w;
+  memset(&w, 0, sizeof(w));
+  w.out = out;
+  if(mjson(json, len, _from_json_cb, &w) < 0 || out->overflow)
+    return MJSON_ERROR_INVALID_INPUT;
+  return out->len;
+}
+
+int msgpack_from_json_alloc(const char* json, int len, char** out_buf) {
+  // a JSON value takes at most 4 times its size in MessagePack ("{}" is a 5 byte map header)
+  int size = 4 * len + 16;
+  *out_buf = malloc(size);
+  if(*out_buf == NULL)
+    return MJSON_ERROR_INVALID_INPUT;
+  struct msgpack_out out = MSGPACK_OUT(*out_buf, size);
+  int n = msgpack_from_json(json, len, &out);
+  if(n < 0) {
+    free(*out_buf);
+    *out_buf = NULL;
+  }
+  return n;
+}
+
+int msgpack_listen_unix(const char* dir, const char* name, int backlog) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", dir, name) >= (int)sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  unlink(addr.sun_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
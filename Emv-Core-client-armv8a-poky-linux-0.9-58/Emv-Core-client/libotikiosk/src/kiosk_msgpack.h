@@ -0,0 +1,103 @@
+/*
+ * kiosk_msgpack.h
+ *
+ * MessagePack encoding of the JSON-RPC messages, for the links between our own components (simulator, broker).
+ * The messages keep the JSON-RPC model, objects become maps with string keys. A frame is recognized by its first
+ * byte: a MessagePack map header can't start a JSON text.
+ */
+
+#ifndef LIBOTIKIOSK_SRC_KIOSK_MSGPACK_H_
+#define LIBOTIKIOSK_SRC_KIOSK_MSGPACK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mjson.h"
+
+#define MSGPACK_IS_MAP_HEADER(c) ((((uint8_t)(c)) & 0xf0) == 0x80 || ((uint8_t)(c)) == 0xde || ((uint8_t)(c)) == 0xdf)
+
+// output buffer of the msgpack_put_*() functions
+struct msgpack_out {
+  uint8_t* buf;
+  int size;
+  int len;
+  bool overflow; // set when a value didn't fit, len then stays at the last value that fit
+};
+
+#define MSGPACK_OUT(buf, size) {(uint8_t*)(buf), (size), 0, false}
+
+void msgpack_put_raw(struct msgpack_out* out, const void* data, int len);
+void msgpack_put_map(struct msgpack_out* out, uint32_t nb_members);
+void msgpack_put_array(struct msgpack_out* out, uint32_t nb_items);
+void msgpack_put_str(struct msgpack_out* out, const char* s, int len);
+void msgpack_put_uint(struct msgpack_out* out, uint64_t v);
+void msgpack_put_int(struct msgpack_out* out, int64_t v);
+void msgpack_put_double(struct msgpack_out* out, double v);
+void msgpack_put_bool(struct msgpack_out* out, bool v);
+void msgpack_put_nil(struct msgpack_out* out);
+
+/**
+ * Length of the MessagePack value at the start of s.
+ * Returns 0 if more bytes are needed, or MJSON_ERROR_INVALID_INPUT.
+ */
+int msgpack_value_len(const char* s, int len);
+
+// splits the bytes of a link into frames, JSON values or MessagePack maps back to back
+struct msgpack_framer {
+  struct mjson_stream stream; // partial JSON frame at the start of the buffer
+  int filled; // bytes in the buffer
+};
+
+// called for each complete frame, returns false to stop the splitting (the link was closed)
+typedef bool (*msgpack_frame_cb)(const char* frame, int len, void* ud);
+
+void msgpack_framer_init(struct msgpack_framer* f);
+
+/**
+ * Adds the len bytes received at buf + f->filled and reports the complete frames, which are then dropped from buf.
+ * The whitespace between frames is dropped as well, a partial frame is kept at the start of buf.
+ * Returns 0, or MJSON_ERROR_INVALID_INPUT if the data isn't a JSON value nor a MessagePack map.
+ */
+int msgpack_framer_feed(struct msgpack_framer* f, char* buf, int len, msgpack_frame_cb cb, void* ud);
+
+/**
+ * Walks a MessagePack value and reports it to an mjson() callback, so that the JSON decoders can be reused:
+ * maps and arrays are reported as '{' '}' and '[' ']', map keys must be strings and are reported as MJSON_TOK_KEY.
+ * Scalar tokens cover the whole encoded value, header included, like JSON string tokens include their quotes:
+ * see msgpack_get_str() and msgpack_get_number(). The closing '}' / ']' is reported on the last byte of the container.
+ * Returns the offset following the value, or following the token on which the callback stopped the walk, or a
+ * negative value if the value is invalid.
+ */
+int msgpack_scan(const char* s, int len, mjson_cb_t cb, void* ud);
+
+/**
+ * Locates the bytes of a MessagePack string, reported as MJSON_TOK_STRING or MJSON_TOK_KEY by msgpack_scan().
+ * The string isn't terminated, nor checked for UTF-8.
+ */
+bool msgpack_get_str(const char* s, int len, const char** out_str, int* out_len);
+
+/**
+ * Decodes a MessagePack number, reported as MJSON_TOK_NUMBER by msgpack_scan().
+ * Integers are returned in out_int with *out_is_int set, floats in out_double.
+ */
+bool msgpack_get_number(const char* s, int len, int64_t* out_int, double* out_double, bool* out_is_int);
+
+/**
+ * Converts between the two encodings, for the logs and for the peers that only handle JSON.
+ * Return the length written, or a negative value if the input is invalid.
+ */
+int msgpack_to_json(const char* s, int len, struct mjson_out* out);
+int msgpack_from_json(const char* json, int len, struct msgpack_out* out);
+
+/**
+ * msgpack_from_json() into a buffer allocated to fit, freed by the caller.
+ * Returns the length written, or a negative value if the input is invalid or the allocation failed.
+ */
+int msgpack_from_json_alloc(const char* json, int len, char** out_buf);
+
+/**
+ * Listening Unix socket at dir/name, for the serving side of the links.
+ * Returns the socket, or -1 with errno set.
+ */
+int msgpack_listen_unix(const char* dir, const char* name, int backlog);
+
+#endif /* LIBOTIKIOSK_SRC_KIOSK_MSGPACK_H_ */
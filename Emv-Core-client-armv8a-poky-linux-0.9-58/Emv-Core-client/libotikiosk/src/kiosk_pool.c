@@ -0,0 +1,332 @@
+/*
+ * kiosk_pool.c
+ *
+ * Routing of payments across several Kiosk Core contexts.
+ */
+
+// implements
+#include "libotikiosk_pool.h"
+
+// uses
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "otiKiosk_log.h"
+
+typedef struct {
+  LibOtiKiosk_Pool* pool;
+  int index;
+  LibOtiKiosk_Context* ctx;
+  KIOSK_STATUS status;
+  unsigned int outstanding;
+  uint32_t started;
+  uint32_t completed;
+  uint64_t busy_ms;
+  uint64_t busy_since_ms; // start of the current busy period, valid when outstanding > 0
+  unsigned int released_early; // reservations released by the status poll whose TransactionComplete may still come
+  uint32_t connection_epoch; // reconnects + failovers of the context at the last poll
+  uint64_t dispatched_ms; // last transaction started or completed, a poll that began before it is out of date
+} KioskPoolReader;
+
+struct LibOtiKiosk_Pool {
+  KioskPoolReader* readers;
+  int nb_readers;
+  unsigned int status_poll_ms;
+  unsigned int max_outstanding;
+  uint64_t created_ms;
+
+  pthread_mutex_t mutex; // protects the reader routing fields
+  pthread_cond_t cond; // signalled when a reader may have become available
+  pthread_t poll_thread;
+  bool poll_thread_started;
+  volatile bool running;
+
+  PoolTransactionCompleteCb_t trans_complete_cb;
+  void* trans_complete_user_data;
+};
+
+static uint64_t _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _trans_complete_cb(LibOtiKiosk_Context* ctx, otiKioskPaymentResponse* resp, void* user_data) {
+  KioskPoolReader* reader = (KioskPoolReader*)user_data;
+  LibOtiKiosk_Pool* pool = reader->pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  reader->completed++;
+  if(reader->released_early > 0) {
+    // late event of a transaction the status poll already closed
+    reader->released_early--;
+  } else if(reader->outstanding > 0) {
+    reader->outstanding--;
+    reader->dispatched_ms = _now_ms();
+    if(reader->outstanding == 0) {
+      reader->busy_ms += reader->dispatched_ms - reader->busy_since_ms;
+      // idle again, without waiting for the next poll to say so
+      if(reader->status == OK_TRANSACTION)
+        reader->status = OK_READY;
+    }
+  }
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  if(pool->trans_complete_cb != NULL)
+    pool->trans_complete_cb(pool, reader->index, resp, pool->trans_complete_user_data);
+}
+
+// closes the reservations of a reader whose TransactionComplete won't come. Must be called with the pool mutex held.
+static void _release_all(KioskPoolReader* reader) {
+  if(reader->outstanding == 0)
+    return;
+  reader->busy_ms += _now_ms() - reader->busy_since_ms;
+  reader->outstanding = 0;
+  pthread_cond_broadcast(&reader->pool->cond);
+}
+
+static void* _status_poll_loop(void* arg) {
+  LibOtiKiosk_Pool* pool = (LibOtiKiosk_Pool*)arg;
+
+  while(pool->running) {
+    for(int i = 0; i < pool->nb_readers && pool->running; i++) {
+      KioskPoolReader* reader = &pool->readers[i];
+      uint64_t polled_ms = _now_ms();
+      KIOSK_STATUS status = OK_NO_KIOSK;
+      if(LibOtiKiosk_Ctx_GetStatus(reader->ctx, &status) != KIOSK_RET_OK)
+        status = OK_NO_KIOSK;
+      LibOtiKiosk_Stats stats;
+      uint32_t epoch = reader->connection_epoch;
+      if(LibOtiKiosk_Ctx_Get_Stats(reader->ctx, &stats) == KIOSK_RET_OK)
+        epoch = stats.reconnects + stats.failovers;
+
+      pthread_mutex_lock(&pool->mutex);
+      // Ready or PaymentTransaction from before the last start or TransactionComplete is older than the routing state
+      bool stale = polled_ms <= reader->dispatched_ms && (status == OK_READY || status == OK_TRANSACTION);
+      // a TransactionComplete lost with the connection (or a Kiosk Core restart) would keep the reader reserved
+      if(epoch != reader->connection_epoch) {
+        if(reader->outstanding > 0)
+          KIOSK_INFO("pool reader %d reconnected, releasing %u transaction(s)\n", i, reader->outstanding);
+        _release_all(reader);
+        reader->released_early = 0; // the events of the previous connection can't come anymore
+        reader->connection_epoch = epoch;
+      } else if(stale) {
+        status = reader->status;
+      } else if(reader->status == OK_TRANSACTION && status == OK_READY && reader->outstanding > 0) {
+        KIOSK_INFO("pool reader %d is ready again, releasing %u transaction(s)\n", i, reader->outstanding);
+        reader->released_early += reader->outstanding;
+        _release_all(reader);
+      }
+      if(reader->status != status) {
+        KIOSK_DEBUG("pool reader %d status %d -> %d\n", i, reader->status, status);
+        reader->status = status;
+        pthread_cond_broadcast(&pool->cond);
+      }
+      pthread_mutex_unlock(&pool->mutex);
+    }
+
+    // sleep in small steps so that the pool can be destroyed quickly
+    uint64_t wake_ms = _now_ms() + pool->status_poll_ms;
+    while(pool->running && _now_ms() < wake_ms) {
+      struct timespec ts = {0, 50 * 1000000};
+      nanosleep(&ts, NULL);
+    }
+  }
+  return NULL;
+}
+
+// returns the least busy available reader, or NULL. Must be called with the pool mutex held.
+static KioskPoolReader* _select_reader(LibOtiKiosk_Pool* pool) {
+  KioskPoolReader* best = NULL;
+  for(int i = 0; i < pool->nb_readers; i++) {
+    KioskPoolReader* r = &pool->readers[i];
+    // a reader in a transaction takes more of them up to max_outstanding, the other statuses can't pay
+    if((r->status != OK_READY && r->status != OK_TRANSACTION) || r->outstanding >= pool->max_outstanding)
+      continue;
+    // fewest outstanding transactions first, then the one that has been busy the least
+    if(best == NULL || r->outstanding < best->outstanding || (r->outstanding == best->outstanding && r->busy_ms < best->busy_ms))
+      best = r;
+  }
+  return best;
+}
+
+// waits for an available reader and reserves it, returns NULL on timeout
+static KioskPoolReader* _acquire_reader(LibOtiKiosk_Pool* pool, int queue_timeout_ms) {
+  struct timespec deadline;
+  if(queue_timeout_ms > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += queue_timeout_ms / 1000;
+    deadline.tv_nsec += (queue_timeout_ms % 1000) * 1000000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec = deadline.tv_nsec % 1000000000;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  KioskPoolReader* reader = _select_reader(pool);
+  while(reader == NULL && queue_timeout_ms != 0 && pool->running) {
+    int ret = queue_timeout_ms > 0 ? pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline) : pthread_cond_wait(&pool->cond, &pool->mutex);
+    reader = _select_reader(pool);
+    if(ret == ETIMEDOUT)
+      break;
+  }
+
+  if(reader != NULL) {
+    reader->dispatched_ms = _now_ms();
+    if(reader->outstanding == 0)
+      reader->busy_since_ms = reader->dispatched_ms;
+    reader->outstanding++;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return reader;
+}
+
+static void _release_reader(LibOtiKiosk_Pool* pool, KioskPoolReader* reader) {
+  pthread_mutex_lock(&pool->mutex);
+  if(reader->outstanding > 0) {
+    reader->outstanding--;
+    if(reader->outstanding == 0)
+      reader->busy_ms += _now_ms() - reader->busy_since_ms;
+  }
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+static KIOSK_RET _start_transaction(LibOtiKiosk_Pool* pool, otiKioskPaymentParameters *params, bool pre_authorize, int queue_timeout_ms, int* out_reader_index) {
+  KioskPoolReader* reader = _acquire_reader(pool, queue_timeout_ms);
+  if(reader == NULL) {
+    KIOSK_ERROR("no reader available in the pool\n");
+    return KIOSK_RET_GENERAL_ERROR;
+  }
+
+  KIOSK_RET ret = pre_authorize ? LibOtiKiosk_Ctx_PreAuthorize(reader->ctx, params) : LibOtiKiosk_Ctx_PayTransaction(reader->ctx, params);
+  if(ret != KIOSK_RET_OK) {
+    // the transaction did not start, no TransactionComplete will come
+    _release_reader(pool, reader);
+    return ret;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  reader->started++;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if(out_reader_index != NULL)
+    *out_reader_index = reader->index;
+  return KIOSK_RET_OK;
+}
+
+LibOtiKiosk_Pool* LibOtiKiosk_Pool_Create(const LibOtiKiosk_PoolEndpoint* endpoints, int nb_endpoints, unsigned int status_poll_ms, unsigned int max_outstanding) {
+  if(endpoints == NULL || nb_endpoints <= 0)
+    return NULL;
+
+  LibOtiKiosk_Pool* pool = calloc(1, sizeof(LibOtiKiosk_Pool));
+  if(pool == NULL)
+    return NULL;
+  pool->readers = calloc(nb_endpoints, sizeof(KioskPoolReader));
+  if(pool->readers == NULL) {
+    free(pool);
+    return NULL;
+  }
+
+  pool->status_poll_ms = status_poll_ms > 0 ? status_poll_ms : 1000;
+  pool->max_outstanding = max_outstanding > 0 ? max_outstanding : 1;
+  pool->created_ms = _now_ms();
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pool->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  for(int i = 0; i < nb_endpoints; i++) {
+    KioskPoolReader* reader = &pool->readers[i];
+    reader->pool = pool;
+    reader->index = i;
+    reader->status = OK_NO_KIOSK;
+    const LibOtiKiosk_PoolEndpoint* ep = &endpoints[i];
+    reader->ctx = ep->endpoints != NULL ? LibOtiKiosk_Ctx_Create_Endpoints(ep->endpoints, ep->nb_endpoints, ep->connect_timeout_ms) :
+        LibOtiKiosk_Ctx_Create(ep->server_address, ep->is_local);
+    if(reader->ctx == NULL) {
+      KIOSK_ERROR("failed to create context for pool reader %d\n", i);
+      LibOtiKiosk_Pool_Destroy(pool);
+      return NULL;
+    }
+    pool->nb_readers++;
+    LibOtiKiosk_Ctx_Register_TransactionComplete_Callback(reader->ctx, _trans_complete_cb, reader);
+  }
+
+  pool->running = true;
+  if(pthread_create(&pool->poll_thread, NULL, _status_poll_loop, pool) != 0) {
+    LibOtiKiosk_Pool_Destroy(pool);
+    return NULL;
+  }
+  pool->poll_thread_started = true;
+  return pool;
+}
+
+void LibOtiKiosk_Pool_Destroy(LibOtiKiosk_Pool* pool) {
+  if(pool == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->running = false;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  if(pool->poll_thread_started)
+    pthread_join(pool->poll_thread, NULL);
+
+  for(int i = 0; i < pool->nb_readers; i++)
+    LibOtiKiosk_Ctx_Destroy(pool->readers[i].ctx);
+
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->readers);
+  free(pool);
+}
+
+void LibOtiKiosk_Pool_Register_TransactionComplete_Callback(LibOtiKiosk_Pool* pool, PoolTransactionCompleteCb_t cb, void* user_data) {
+  pool->trans_complete_user_data = user_data;
+  pool->trans_complete_cb = cb;
+}
+
+KIOSK_RET LibOtiKiosk_Pool_PayTransaction(LibOtiKiosk_Pool* pool, otiKioskPaymentParameters *params, int queue_timeout_ms, int* out_reader_index) {
+  return _start_transaction(pool, params, false, queue_timeout_ms, out_reader_index);
+}
+
+KIOSK_RET LibOtiKiosk_Pool_PreAuthorize(LibOtiKiosk_Pool* pool, otiKioskPaymentParameters *params, int queue_timeout_ms, int* out_reader_index) {
+  return _start_transaction(pool, params, true, queue_timeout_ms, out_reader_index);
+}
+
+int LibOtiKiosk_Pool_Size(LibOtiKiosk_Pool* pool) {
+  return pool->nb_readers;
+}
+
+LibOtiKiosk_Context* LibOtiKiosk_Pool_Get_Context(LibOtiKiosk_Pool* pool, int reader_index) {
+  if(reader_index < 0 || reader_index >= pool->nb_readers)
+    return NULL;
+  return pool->readers[reader_index].ctx;
+}
+
+KIOSK_RET LibOtiKiosk_Pool_Get_Reader_Stats(LibOtiKiosk_Pool* pool, int reader_index, LibOtiKiosk_ReaderStats* out_stats) {
+  if(reader_index < 0 || reader_index >= pool->nb_readers || out_stats == NULL)
+    return KIOSK_RET_GENERAL_ERROR;
+
+  uint64_t now = _now_ms();
+  KioskPoolReader* reader = &pool->readers[reader_index];
+
+  pthread_mutex_lock(&pool->mutex);
+  out_stats->status = reader->status;
+  out_stats->outstanding = reader->outstanding;
+  out_stats->started = reader->started;
+  out_stats->completed = reader->completed;
+  out_stats->busy_ms = reader->busy_ms;
+  if(reader->outstanding > 0)
+    out_stats->busy_ms += now - reader->busy_since_ms;
+  pthread_mutex_unlock(&pool->mutex);
+
+  uint64_t lifetime_ms = now - pool->created_ms;
+  out_stats->utilization_permille = lifetime_ms > 0 ? (uint32_t)(out_stats->busy_ms * 1000 / lifetime_ms) : 0;
+  return KIOSK_RET_OK;
+}
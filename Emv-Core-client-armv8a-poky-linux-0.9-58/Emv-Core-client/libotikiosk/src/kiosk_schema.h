@@ -0,0 +1,25 @@
+/*
+ * kiosk_schema.h
+ *
+ * Generated by schema/gen_kiosk_core.py from schema/kiosk_core.json, do not edit.
+ */
+
+#ifndef LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_
+#define LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_
+
+// methods
+#define KIOSK_METHOD_GET_STATUS "GetStatus"
+#define KIOSK_METHOD_SHOW_MESSAGE "ShowMessage"
+#define KIOSK_METHOD_GET_KIOSK_ID "GetKioskID"
+#define KIOSK_METHOD_GET_VERSION "GetVersion"
+#define KIOSK_METHOD_PRE_AUTHORIZE "PreAuthorize"
+#define KIOSK_METHOD_PAY_TRANSACTION "PayTransaction"
+#define KIOSK_METHOD_CONFIRM_TRANSACTION "ConfirmTransaction"
+#define KIOSK_METHOD_VOID_TRANSACTION "VoidTransaction"
+#define KIOSK_METHOD_CANCEL_TRANSACTION "CancelTransaction"
+
+// events
+#define KIOSK_EVENT_TRANSACTION_COMPLETE "TransactionComplete"
+#define KIOSK_EVENT_READER_MESSAGE "ReaderMessageEvent"
+
+#endif /* LIBOTIKIOSK_SRC_KIOSK_SCHEMA_H_ */
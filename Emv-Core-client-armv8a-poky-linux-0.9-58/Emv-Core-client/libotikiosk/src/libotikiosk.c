@@ -8,44 +8,103 @@
 #include <sys/un.h>
 #include <netdb.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <time.h>
 #include "mjson.h"
 #include "kiosk_commands.h"
+#include "kiosk_msgpack.h"
 #include "otiKiosk_log.h"
 #include "emv-core-lib-version.h"
 
 // internal types
 typedef struct {
   bool is_tcp;
-  char* server_addr; // TODO: add more options for handling domain sockets
+  char* cmd_addr;
+  uint16_t cmd_port;
+  char* evt_addr;
+  uint16_t evt_port;
+  uint32_t consecutive_failures;
+  uint64_t retry_after_ms; // the endpoint is considered unhealthy until then
+} KioskEndpoint;
+
+typedef struct {
+  LibOtiKiosk_Context* ctx; // context owning this socket
+  bool is_commands; // commands socket (otherwise events socket)
+  bool is_tcp;
+  char* server_addr; // points into the active endpoint
   uint16_t tcp_port;
+  uint32_t endpoint_generation; // generation of the endpoint this socket is connected to
   int incoming_timeout_ms;
   int sockfd;
   pthread_mutex_t mutex;
-  void (*recv_cb)(unsigned char* data, int data_len);
+  void (*recv_cb)(LibOtiKiosk_Context* ctx, unsigned char* data, int data_len);
   uint8_t work_buffer[1024];
 } KioskSocketOptions;
 
-// variables
-static pthread_t _commands_thread;
-static pthread_t _reader_thread;
-
-static KioskSocketOptions _commands_socket_options;
-static KioskSocketOptions _reader_socket_options;
+struct LibOtiKiosk_Context {
+  pthread_t commands_thread;
+  pthread_t reader_thread;
+  bool threads_started;
+  volatile bool running;
+
+  KioskSocketOptions commands_socket_options;
+  KioskSocketOptions reader_socket_options;
+
+  // endpoints, in order of preference
+  pthread_mutex_t endpoint_mutex; // protects the endpoint selection and the statistics
+  KioskEndpoint* endpoints;
+  int nb_endpoints;
+  int active_endpoint;
+  volatile uint32_t endpoint_generation; // incremented on every switch of endpoint
+  int connected_endpoint; // endpoint of the last successful commands connection, -1 if none yet
+  unsigned int connect_timeout_ms;
+  uint64_t outage_start_ms; // when the connection was lost, 0 while connected
+  LibOtiKiosk_Stats stats;
+
+  pthread_mutex_t call_mutex; // serializes commands sent on this context
+  sem_t sema_resp_ready; // for signaling when the response to a command has been received
+  sem_t sema_resp_done; // for signaling when the received response has been handled and reception can resume
+  const uint8_t* current_resp; // response in the commands work buffer, valid until sema_resp_done is posted
+  uint32_t current_resp_len;
+  kiosk_envelope current_resp_env; // classification of the response in the commands work buffer
+  int expected_id;
+
+  otiKioskPaymentResponse pmt_resp;
+
+  // settings, from codec to the end: _context_init() keeps them, as the default context may be set up before LibOtiKiosk_Init
+  KIOSK_CODEC codec; // encoding of the commands built by the library
+  TransactionCompleteCtxCb_t trans_complete_cb;
+  void* trans_complete_user_data;
+  TransactionViewCtxCb_t trans_view_cb;
+  void* trans_view_user_data;
+  RdrEventCtxCb_t reader_event_cb;
+  void* reader_event_user_data;
+  RawEventCtxCb_t raw_event_cb;
+  void* raw_event_user_data;
+};
+
+// retry delay of a failed endpoint, grows with consecutive failures up to the max
+#define ENDPOINT_RETRY_STEP_MS 250
+#define ENDPOINT_RETRY_MAX_MS 2000
+#define DEFAULT_CONNECT_TIMEOUT_MS 1000
 
-static sem_t sema_resp_ready; // for signaling when the response to a command has been received
-static sem_t sema_resp_done; // for signaling when the received response has been handled and reception can resume
-static uint32_t current_resp_len;
-
-static otiKioskPaymentResponse pmt_resp;
+// variables
+static LibOtiKiosk_Context _default_context; // used by the context-less API
 
 static TransactionCompleteCb_t _trans_complete_app_cb = NULL;
 static RdrEventCb_t _reader_event_app_cb = NULL;
 
+// MessagePack messages aren't printable, the logs only show the JSON ones
+static int _log_len(const void* data, int len) {
+  return len > 0 && MSGPACK_IS_MAP_HEADER(*(const uint8_t*)data) ? 0 : len;
+}
+
 static int _receive_raw(int sfd, char* buff, int buff_size, int timeout_ms) {
   struct pollfd pfd = {0};
   pfd.fd = sfd;
@@ -59,13 +118,8 @@ static int _receive_raw(int sfd, char* buff, int buff_size, int timeout_ms) {
   } else if(ret > 0) {
     // something happened, either there is something to read or the socket got closed by the other side
     int len = read(sfd, buff, buff_size);
-    if(len > 0) {
-      if(len < buff_size) {
-        // clear the remaining part of the buffer
-        memset(&buff[len], 0, buff_size-len);
-      }
+    if(len > 0)
       return len;
-    }
 
     // read with zero length after a poll event means that the socket is closed
     return -1;
@@ -75,10 +129,198 @@ static int _receive_raw(int sfd, char* buff, int buff_size, int timeout_ms) {
   }
 }
 
+static uint64_t _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// sleeps in small steps so that a context being destroyed doesn't wait for the full delay
+static void _sleep_ms(LibOtiKiosk_Context* ctx, uint64_t delay_ms) {
+  uint64_t wake_ms = _now_ms() + delay_ms;
+  while(ctx->running) {
+    uint64_t now = _now_ms();
+    if(now >= wake_ms)
+      break;
+    uint64_t step = wake_ms - now > 50 ? 50 : wake_ms - now;
+    struct timespec ts = {0, step * 1000000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static int _connect_tcp(const char* host, uint16_t port, unsigned int timeout_ms) {
+  char s_port[8];
+  struct addrinfo hints = {0};
+  struct addrinfo* res = NULL;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(s_port, sizeof(s_port), "%u", port);
+
+  // resolve address
+  int err = getaddrinfo(host, s_port, &hints, &res);
+  if(err != 0 || res == NULL) {
+    KIOSK_ERROR("failed to resolve hostname %s (%s)\n", host, gai_strerror(err));
+    return -1;
+  }
+
+  // create socket
+  int sfd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol);
+  if(sfd < 0) {
+    KIOSK_ERROR("failed to create socket (%s)\n", strerror(errno));
+    freeaddrinfo(res);
+    return -1;
+  }
+
+  // connect to server, bounded by the connection timeout
+  int ret = connect(sfd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if(ret != 0 && errno == EINPROGRESS) {
+    struct pollfd pfd = {0};
+    pfd.fd = sfd;
+    pfd.events = POLLOUT;
+    int so_error = ETIMEDOUT;
+    socklen_t so_len = sizeof(so_error);
+    if(poll(&pfd, 1, timeout_ms) > 0)
+      getsockopt(sfd, SOL_SOCKET, SO_ERROR, &so_error, &so_len);
+    ret = so_error == 0 ? 0 : -1;
+    errno = so_error;
+  }
+  if(ret != 0) {
+    KIOSK_ERROR("failed to connect socket to %s:%d (%s)\n", host, port, strerror(errno));
+    close(sfd);
+    return -1;
+  }
+
+  // back to blocking mode for the rest of the communication
+  fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) & ~O_NONBLOCK);
+  return sfd;
+}
+
+static int _connect_unix(const char* path) {
+  struct sockaddr_un s_addr = {0};
+  if(strlen(path) >= sizeof(s_addr.sun_path)-1) {
+    KIOSK_ERROR("socket path is too long: %s\n", path);
+    return -1;
+  }
+
+  // create socket
+  int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(sfd < 0) {
+    KIOSK_ERROR("failed to create socket (%s)\n", strerror(errno));
+    return -1;
+  }
+
+  // connect to server
+  s_addr.sun_family = AF_UNIX;
+  strncpy(s_addr.sun_path, path, sizeof(s_addr.sun_path)-1);
+  if(connect(sfd, (struct sockaddr*)&s_addr, sizeof(s_addr)) != 0) {
+    KIOSK_ERROR("failed to connect socket to %s (%s)\n", path, strerror(errno));
+    close(sfd);
+    return -1;
+  }
+  return sfd;
+}
+
+// points the socket to the active endpoint
+static void _socket_use_active_endpoint(KioskSocketOptions* socket_options) {
+  LibOtiKiosk_Context* ctx = socket_options->ctx;
+  pthread_mutex_lock(&ctx->endpoint_mutex);
+  KioskEndpoint* ep = &ctx->endpoints[ctx->active_endpoint];
+  socket_options->is_tcp = ep->is_tcp;
+  socket_options->server_addr = socket_options->is_commands ? ep->cmd_addr : ep->evt_addr;
+  socket_options->tcp_port = socket_options->is_commands ? ep->cmd_port : ep->evt_port;
+  socket_options->endpoint_generation = ctx->endpoint_generation;
+  pthread_mutex_unlock(&ctx->endpoint_mutex);
+}
+
+/*
+ * Marks the endpoint used by the socket as failed and, if it's still the active one, switches to the next healthy
+ * endpoint. Returns how long to wait before the next connection attempt.
+ */
+static uint64_t _endpoint_failed(KioskSocketOptions* socket_options) {
+  LibOtiKiosk_Context* ctx = socket_options->ctx;
+  uint64_t now = _now_ms();
+  uint64_t delay_ms = 0;
+
+  pthread_mutex_lock(&ctx->endpoint_mutex);
+  if(ctx->outage_start_ms == 0)
+    ctx->outage_start_ms = now;
+
+  // the other socket may have already moved on, in that case just retry on the new endpoint
+  if(socket_options->endpoint_generation == ctx->endpoint_generation) {
+    KioskEndpoint* ep = &ctx->endpoints[ctx->active_endpoint];
+    ctx->stats.connect_failures++;
+    ep->consecutive_failures++;
+    uint64_t backoff = (uint64_t)ep->consecutive_failures * ENDPOINT_RETRY_STEP_MS;
+    ep->retry_after_ms = now + (backoff > ENDPOINT_RETRY_MAX_MS ? ENDPOINT_RETRY_MAX_MS : backoff);
+
+    // next healthy endpoint in order, or the one that recovers first if none is healthy
+    int next = ctx->active_endpoint;
+    for(int i = 1; i <= ctx->nb_endpoints; i++) {
+      int idx = (ctx->active_endpoint + i) % ctx->nb_endpoints;
+      if(ctx->endpoints[idx].retry_after_ms <= now) {
+        next = idx;
+        break;
+      }
+      if(ctx->endpoints[idx].retry_after_ms < ctx->endpoints[next].retry_after_ms)
+        next = idx;
+    }
+
+    if(next != ctx->active_endpoint) {
+      KIOSK_INFO("switching from endpoint %d to endpoint %d\n", ctx->active_endpoint, next);
+      ctx->active_endpoint = next;
+      ctx->endpoint_generation++;
+      ctx->stats.failovers++;
+    }
+  }
+
+  KioskEndpoint* active = &ctx->endpoints[ctx->active_endpoint];
+  if(active->retry_after_ms > now)
+    delay_ms = active->retry_after_ms - now;
+  ctx->stats.active_endpoint = ctx->active_endpoint;
+  pthread_mutex_unlock(&ctx->endpoint_mutex);
+
+  return delay_ms;
+}
+
+static void _endpoint_connected(KioskSocketOptions* socket_options) {
+  LibOtiKiosk_Context* ctx = socket_options->ctx;
+  if(!socket_options->is_commands)
+    return;
+
+  pthread_mutex_lock(&ctx->endpoint_mutex);
+  if(socket_options->endpoint_generation == ctx->endpoint_generation) {
+    KioskEndpoint* ep = &ctx->endpoints[ctx->active_endpoint];
+    ep->consecutive_failures = 0;
+    ep->retry_after_ms = 0;
+
+    // time from losing the previous endpoint to being connected to this one
+    if(ctx->outage_start_ms != 0 && ctx->connected_endpoint >= 0 && ctx->connected_endpoint != ctx->active_endpoint) {
+      uint32_t elapsed = (uint32_t)(_now_ms() - ctx->outage_start_ms);
+      ctx->stats.last_failover_ms = elapsed;
+      if(elapsed > ctx->stats.max_failover_ms)
+        ctx->stats.max_failover_ms = elapsed;
+    } else if(ctx->connected_endpoint >= 0) {
+      ctx->stats.reconnects++;
+    }
+    ctx->outage_start_ms = 0;
+    ctx->connected_endpoint = ctx->active_endpoint;
+    ctx->stats.active_endpoint = ctx->active_endpoint;
+  }
+  pthread_mutex_unlock(&ctx->endpoint_mutex);
+}
+
 static void* _kiosk_comm_loop(void* arg) {
   KioskSocketOptions* socket_options = (KioskSocketOptions*)arg;
+  LibOtiKiosk_Context* ctx = socket_options->ctx;
+  uint64_t retry_delay_ms = 0;
   // outer loop to maintain the connection with the server
-  while(true) {
+  while(ctx->running) {
+    if(retry_delay_ms > 0) {
+      _sleep_ms(ctx, retry_delay_ms);
+      retry_delay_ms = 0;
+    }
+
     // take the mutex to prevent other accesses while the socket is not connected
     pthread_mutex_lock(&socket_options->mutex);
 
@@ -87,112 +329,164 @@ static void* _kiosk_comm_loop(void* arg) {
       shutdown(socket_options->sockfd, SHUT_RDWR);
       close(socket_options->sockfd);
       socket_options->sockfd = -1;
-      sleep(1);
     }
 
-    KIOSK_INFO("opening socket to %s:%d\n", socket_options->server_addr, socket_options->tcp_port);
-
-    if(socket_options->is_tcp) {
-      // resolve address
-      struct hostent* host_info = gethostbyname(socket_options->server_addr);
-      if(host_info == NULL) {
-        KIOSK_ERROR("failed to resolve hostname %s\n", socket_options->server_addr);
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
-
-      // create socket
-      socket_options->sockfd = socket(AF_INET, SOCK_STREAM, 0);
-      if(socket_options->sockfd < 0) {
-        KIOSK_ERROR("failed to create socket (%s)\n", strerror(errno));
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
+    if(!ctx->running) {
+      pthread_mutex_unlock(&socket_options->mutex);
+      break;
+    }
 
-      // connect to server
-      struct sockaddr_in s_addr = {0};
-      s_addr.sin_addr = *(struct in_addr*) host_info->h_addr;
-      s_addr.sin_port = htons(socket_options->tcp_port);
-      s_addr.sin_family = AF_INET;
-      if(connect(socket_options->sockfd, (struct sockaddr*)&s_addr, sizeof(struct sockaddr)) != 0) {
-        KIOSK_ERROR("failed to connect socket to %s:%d (%s)\n", socket_options->server_addr, socket_options->tcp_port, strerror(errno));
-        close(socket_options->sockfd);
-        socket_options->sockfd = -1;
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
-    } else {
-      struct sockaddr_un s_addr = {0};
-      if(strlen(socket_options->server_addr) >= sizeof(s_addr.sun_path)-1) {
-        KIOSK_ERROR("socket path is too long: %s\n", socket_options->server_addr);
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
+    _socket_use_active_endpoint(socket_options);
+    KIOSK_INFO("opening socket to %s:%d\n", socket_options->server_addr, socket_options->tcp_port);
 
-      // create socket
-      socket_options->sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-      if(socket_options->sockfd < 0) {
-        KIOSK_ERROR("failed to create socket (%s)\n", strerror(errno));
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
+    if(socket_options->is_tcp)
+      socket_options->sockfd = _connect_tcp(socket_options->server_addr, socket_options->tcp_port, ctx->connect_timeout_ms);
+    else
+      socket_options->sockfd = _connect_unix(socket_options->server_addr);
 
-      // connect to server
-      s_addr.sun_family = AF_UNIX;
-      strncpy(s_addr.sun_path, socket_options->server_addr, sizeof(s_addr.sun_path)-1);
-      if(connect(socket_options->sockfd, (struct sockaddr*)&s_addr, sizeof(s_addr)) != 0) {
-        KIOSK_ERROR("failed to connect socket to %s (%s)\n", socket_options->server_addr, strerror(errno));
-        close(socket_options->sockfd);
-        socket_options->sockfd = -1;
-        pthread_mutex_unlock(&socket_options->mutex);
-        sleep(1);
-        continue;
-      }
+    if(socket_options->sockfd < 0) {
+      pthread_mutex_unlock(&socket_options->mutex);
+      retry_delay_ms = _endpoint_failed(socket_options);
+      continue;
     }
 
     pthread_mutex_unlock(&socket_options->mutex);
     KIOSK_INFO("successfully connected to %s:%d\n", socket_options->server_addr, socket_options->tcp_port);
-
-    // inner loop to receive events
-    while(true) {
+    _endpoint_connected(socket_options);
+
+    // messages are framed as they arrive, a read can hold several of them or only a part of one
+    struct mjson_stream stream;
+    mjson_stream_init(&stream);
+    int filled = 0; // bytes in the work buffer
+    int msg_start = 0; // start of the current message in the work buffer
+    bool discarding = false; // the current message didn't fit in the work buffer
+    bool binary_pending = false; // a partial MessagePack message is at the start of the buffer
+
+    // inner loop to receive events, until the connection is lost or the context switches to another endpoint
+    while(ctx->running && socket_options->endpoint_generation == ctx->endpoint_generation) {
       if(socket_options->sockfd < 0) {
+        retry_delay_ms = _endpoint_failed(socket_options);
         break;
       }
 
       // wait for incoming data
-      int received = _receive_raw(socket_options->sockfd, socket_options->work_buffer, sizeof(socket_options->work_buffer), socket_options->incoming_timeout_ms);
+      int received = _receive_raw(socket_options->sockfd, (char*)socket_options->work_buffer + filled, sizeof(socket_options->work_buffer) - filled, socket_options->incoming_timeout_ms);
       if(received < 0) {
         KIOSK_ERROR("error on _receive_raw (%s)\n", strerror(errno));
+        retry_delay_ms = _endpoint_failed(socket_options);
         break;
-      } else if(received > 0) {
-        socket_options->recv_cb(socket_options->work_buffer, received);
-      } else {
+      } else if(received == 0) {
         // timeout, just do nothing and continue
+        continue;
+      }
+
+      // only the new bytes are scanned, the stream keeps the state of the partial message. A partial MessagePack
+      // message has no such state and is measured again from its start.
+      int scanned = binary_pending ? 0 : filled;
+      filled += received;
+      binary_pending = false;
+      while(scanned < filled) {
+        if(stream.start < 0) {
+          // between messages, a MessagePack map header starts a binary message
+          char* buf = (char*)socket_options->work_buffer;
+          while(scanned < filled && (buf[scanned] == ' ' || buf[scanned] == '\t' || buf[scanned] == '\n' || buf[scanned] == '\r'))
+            scanned++;
+          mjson_stream_init(&stream);
+          msg_start = scanned;
+          if(scanned < filled && MSGPACK_IS_MAP_HEADER(buf[scanned])) {
+            int n = msgpack_value_len(buf + scanned, filled - scanned);
+            if(n < 0) {
+              KIOSK_ERROR("invalid data received from %s:%d, dropping %d bytes\n", socket_options->server_addr, socket_options->tcp_port, filled - msg_start);
+              msg_start = scanned = filled;
+              break;
+            }
+            if(n == 0) {
+              binary_pending = true;
+              break;
+            }
+            socket_options->recv_cb(ctx, socket_options->work_buffer + scanned, n);
+            scanned += n;
+            msg_start = scanned;
+            continue;
+          }
+          if(scanned == filled)
+            break;
+        }
+
+        int n = mjson_stream_feed(&stream, (char*)socket_options->work_buffer + scanned, filled - scanned);
+        if(n < 0) {
+          KIOSK_ERROR("invalid data received from %s:%d, dropping %d bytes\n", socket_options->server_addr, socket_options->tcp_port, filled - msg_start);
+          mjson_stream_init(&stream);
+          msg_start = scanned = filled;
+          discarding = false;
+          break;
+        }
+        scanned += n;
+        if(!stream.done)
+          break;
+        if(!discarding)
+          socket_options->recv_cb(ctx, socket_options->work_buffer + msg_start + stream.start, stream.len - stream.start);
+        discarding = false;
+        mjson_stream_init(&stream);
+        msg_start = scanned;
+      }
+
+      // drop the whitespace between messages, and keep the partial message at the start of the buffer
+      int keep_from = filled;
+      if(binary_pending) {
+        keep_from = msg_start;
+      } else if(stream.start < 0) {
+        mjson_stream_init(&stream);
+      } else {
+        keep_from = msg_start + stream.start;
+        stream.len -= stream.start;
+        stream.start = 0;
+      }
+      memmove(socket_options->work_buffer, socket_options->work_buffer + keep_from, filled - keep_from);
+      filled -= keep_from;
+      msg_start = 0;
+
+      if(filled == sizeof(socket_options->work_buffer) && binary_pending) {
+        // can't be followed without its end, resynchronize on the next message
+        KIOSK_ERROR("message from %s:%d is larger than %d bytes, dropped\n", socket_options->server_addr, socket_options->tcp_port, filled);
+        binary_pending = false;
+        filled = 0;
+      } else if(filled == sizeof(socket_options->work_buffer)) {
+        // keep following the message until its end, but don't deliver it
+        if(!discarding)
+          KIOSK_ERROR("message from %s:%d is larger than %d bytes, dropped\n", socket_options->server_addr, socket_options->tcp_port, filled);
+        discarding = true;
+        filled = 0;
       }
     }
   }
+
+  // release the socket when the context is destroyed
+  pthread_mutex_lock(&socket_options->mutex);
+  if(socket_options->sockfd >= 0) {
+    close(socket_options->sockfd);
+    socket_options->sockfd = -1;
+  }
+  pthread_mutex_unlock(&socket_options->mutex);
+
   pthread_exit(NULL);
 }
 
-static KIOSK_RET send_to_kiosk(char* data, int len) {
-  KIOSK_DEBUG("sending message to kiosk: %.*s\n", len, data);
+static KIOSK_RET send_to_kiosk(LibOtiKiosk_Context* ctx, const char* data, int len) {
+  KioskSocketOptions* socket_options = &ctx->commands_socket_options;
+  KIOSK_DEBUG("sending %d bytes to kiosk: %.*s\n", len, _log_len(data, len), data);
 
-  if(_commands_socket_options.sockfd < 0) {
+  if(socket_options->sockfd < 0) {
     KIOSK_ERROR("kiosk socket is not connected\n");
     return KIOSK_RET_COMM_ERROR;
   }
 
-  int written = write(_commands_socket_options.sockfd, data, len);
+  int written = write(socket_options->sockfd, data, len);
   if(written != len) {
-    pthread_mutex_lock(&_commands_socket_options.mutex);
-    close(_commands_socket_options.sockfd);
-    _commands_socket_options.sockfd = -1;
-    pthread_mutex_unlock(&_commands_socket_options.mutex);
+    pthread_mutex_lock(&socket_options->mutex);
+    close(socket_options->sockfd);
+    socket_options->sockfd = -1;
+    pthread_mutex_unlock(&socket_options->mutex);
   }
 
   if(written != len) {
@@ -221,101 +515,152 @@ static void _sema_clear(sem_t *sema) {
   while(sem_trywait(sema) == 0);
 }
 
-static int _expected_id = -1;
-static KIOSK_RET send_receive(char* cmd, int cmd_len, char* resp, int* resp_len, int timeout_ms) {
-  int id = 0;
-  if(parse_id(cmd, cmd_len, &id) != KIOSK_RET_OK) {
-    KIOSK_ERROR("missing 'id' in command, can't send to kiosk\n");
-    return KIOSK_RET_GENERAL_ERROR;
-  }
+/*
+ * Sends a command whose id is already known and waits for the response with the same id. When out_env is not NULL, it
+ * receives the envelope of the response, with offsets relative to resp.
+ */
+static KIOSK_RET send_receive_id(LibOtiKiosk_Context* ctx, int id, const char* cmd, int cmd_len, char* resp, int* resp_len, kiosk_envelope* out_env, int timeout_ms) {
+  pthread_mutex_lock(&ctx->call_mutex);
 
   // store expected response id
-  _expected_id = id;
+  ctx->expected_id = id;
 
   // clear response semaphore
-  _sema_clear(&sema_resp_ready);
+  _sema_clear(&ctx->sema_resp_ready);
 
-  KIOSK_RET ret = send_to_kiosk(cmd, cmd_len);
-  if(ret != KIOSK_RET_OK)
+  KIOSK_RET ret = send_to_kiosk(ctx, cmd, cmd_len);
+  if(ret != KIOSK_RET_OK) {
+    ctx->expected_id = -1;
+    pthread_mutex_unlock(&ctx->call_mutex);
     return ret;
+  }
 
   // wait on semaphore (signalled when a response is ready)
-  if(_sema_wait_timeout(&sema_resp_ready, timeout_ms) == 0) {
+  if(_sema_wait_timeout(&ctx->sema_resp_ready, timeout_ms) == 0) {
     // copy from the response buffer
-    if(current_resp_len > *resp_len) {
-      KIOSK_ERROR("received message is larger than output buffer (%d > %d)\n", current_resp_len, *resp_len);
-      return KIOSK_RET_GENERAL_ERROR;
+    if(ctx->current_resp_len > *resp_len) {
+      KIOSK_ERROR("received message is larger than output buffer (%d > %d)\n", ctx->current_resp_len, *resp_len);
+      ret = KIOSK_RET_GENERAL_ERROR;
+    } else {
+      *resp_len = ctx->current_resp_len;
+      memcpy(resp, ctx->current_resp, *resp_len);
+      if(out_env != NULL)
+        *out_env = ctx->current_resp_env;
     }
-    *resp_len = current_resp_len;
-    memcpy(resp, _commands_socket_options.work_buffer, *resp_len);
     // signal that response is handled
-    sem_post(&sema_resp_done);
-    // clean up
-    _expected_id = -1;
+    sem_post(&ctx->sema_resp_done);
   } else {
     KIOSK_ERROR("error waiting for response: %s\n", strerror(errno));
-    return KIOSK_RET_COMM_ERROR;
+    ret = KIOSK_RET_COMM_ERROR;
   }
 
-  return KIOSK_RET_OK;
+  // clean up
+  ctx->expected_id = -1;
+  pthread_mutex_unlock(&ctx->call_mutex);
+  return ret;
 }
 
-static bool LibOtiKiosk_Init_Common() {
-  // initialize semaphore
-  if(sem_init(&sema_resp_ready, 0, 0) != 0)
-    return false;
-  if(sem_init(&sema_resp_done, 0, 0) != 0)
-    return false;
+// same as send_receive_id() for commands built by the application, the id is read from the command
+static KIOSK_RET send_receive(LibOtiKiosk_Context* ctx, char* cmd, int cmd_len, char* resp, int* resp_len, kiosk_envelope* out_env, int timeout_ms) {
+  int id = 0;
+  if(parse_id(cmd, cmd_len, &id) != KIOSK_RET_OK) {
+    KIOSK_ERROR("missing 'id' in command, can't send to kiosk\n");
+    return KIOSK_RET_GENERAL_ERROR;
+  }
+  return send_receive_id(ctx, id, cmd, cmd_len, resp, resp_len, out_env, timeout_ms);
+}
 
-  // start a thread for handling each socket
-  pthread_create(&_commands_thread, NULL, _kiosk_comm_loop, &_commands_socket_options);
-  pthread_create(&_reader_thread, NULL, _kiosk_comm_loop, &_reader_socket_options);
-  return true;
+// members of the ReaderMessageEvent params, resolved in a single pass
+enum {
+  READER_MEMBER_INDEX,
+  READER_MEMBER_LINE1,
+  READER_MEMBER_LINE2,
+  READER_NB_MEMBERS
+};
+
+static const struct mjson_path _reader_member_paths[READER_NB_MEMBERS] = {
+  {1, {MJSON_PATH_KEY("index")}},
+  {1, {MJSON_PATH_KEY("line1")}},
+  {1, {MJSON_PATH_KEY("line2")}},
+};
+
+static const char* const _reader_member_keys[READER_NB_MEMBERS] = {"index", "line1", "line2"};
+
+// locates the ReaderMessageEvent members of either encoding, absent members are MJSON_TOK_INVALID
+static void _find_reader_members(const char* params, const kiosk_envelope* env, struct mjson_find_result* out_members) {
+  if(!env->binary) {
+    mjson_find_many(params, env->params.len, _reader_member_paths, READER_NB_MEMBERS, out_members);
+    return;
+  }
+
+  kiosk_json_span spans[READER_NB_MEMBERS];
+  scan_members(params, env->params.len, true, _reader_member_keys, spans, READER_NB_MEMBERS);
+  for(int i = 0; i < READER_NB_MEMBERS; i++) {
+    out_members[i].tok = spans[i].len > 0 ? spans[i].tok : MJSON_TOK_INVALID;
+    out_members[i].ptr = params + spans[i].off;
+    out_members[i].len = spans[i].len;
+  }
 }
 
-static void reader_event_received(unsigned char* data, int data_len) {
-  // parse the JSON message and call the application's reader message callback
-  KIOSK_DEBUG("received event from reader: %*s\n", data_len, data);
+static void reader_event_received(LibOtiKiosk_Context* ctx, unsigned char* data, int data_len) {
+  // parse the message and call the application's reader message callback
+  KIOSK_DEBUG("received %d bytes event from reader: %.*s\n", data_len, _log_len(data, data_len), data);
+
+  if(ctx->reader_event_cb == NULL && ctx->raw_event_cb == NULL)
+    return;
+
+  kiosk_envelope env;
+  if(parse_envelope((char*)data, data_len, &env) != KIOSK_RET_OK) {
+    KIOSK_ERROR("failed to parse ReaderMessageEvent: %.*s\n", _log_len(data, data_len), data);
+    return;
+  }
 
-  if(_reader_event_app_cb == NULL)
+  if(ctx->raw_event_cb != NULL && env.method.len > 0)
+    ctx->raw_event_cb(ctx, false, (char*)data, data_len, ctx->raw_event_user_data);
+  if(ctx->reader_event_cb == NULL)
     return;
 
   // expect "method" to be "ReaderMessageEvent"
-  const char *p;
-  int n;
-  if(mjson_find(data, data_len, "$.method", &p, &n) != MJSON_TOK_STRING || n != strlen("\"ReaderMessageEvent\"") || memcmp("\"ReaderMessageEvent\"", p, n) != 0)
-  {
-    KIOSK_ERROR("failed to parse 'method' field in ReaderMessageEvent: %.*s\n", data_len, data);
+  if(!envelope_method_is((char*)data, &env, KIOSK_EVENT_READER_MESSAGE)) {
+    KIOSK_ERROR("failed to parse 'method' field in ReaderMessageEvent: %.*s\n", _log_len(data, data_len), data);
     return;
   }
 
   // parse the fields
-  const char* s_params;
-  int params_len;
-  if(mjson_find(data, data_len, "$.params", &s_params, &params_len) != MJSON_TOK_OBJECT) {
-    KIOSK_ERROR("failed to parse 'params' in ReaderMessageEvent: %.*s\n", data_len, data);
+  if(env.params.tok != MJSON_TOK_OBJECT) {
+    KIOSK_ERROR("failed to parse 'params' in ReaderMessageEvent: %.*s\n", _log_len(data, data_len), data);
     return;
   }
+  struct mjson_find_result members[READER_NB_MEMBERS];
+  _find_reader_members((char*)data + env.params.off, &env, members);
 
-  double msg_idx;
-  if(mjson_get_number(s_params, params_len, "$.index", &msg_idx) == 0 || msg_idx < 0 || msg_idx > 0xFF) {
-    KIOSK_ERROR("failed to parse 'index' in ReaderMessageEvent: %.*s\n", data_len, data);
+  const struct mjson_find_result* index = &members[READER_MEMBER_INDEX];
+  int msg_idx;
+  if(!decode_int(env.binary, index->tok, index->ptr, index->len, &msg_idx) || msg_idx < 0 || msg_idx > 0xFF) {
+    KIOSK_ERROR("failed to parse 'index' in ReaderMessageEvent: %.*s\n", _log_len(data, data_len), data);
     return;
   }
 
+  // the decoded text is never longer than the encoded string
   char* line1 = NULL;
   char* line2 = NULL;
-  if(mjson_find(s_params, params_len, "$.line1", &p, &n) == MJSON_TOK_STRING) {
-    line1 = calloc(n-1, sizeof(char));
-    memcpy(line1, p+1, n-2);
+  bool valid = true;
+  const struct mjson_find_result* member = &members[READER_MEMBER_LINE1];
+  if(member->tok == MJSON_TOK_STRING) {
+    line1 = calloc(member->len, sizeof(char));
+    valid = line1 != NULL && decode_string(env.binary, member->ptr, member->len, line1, member->len) >= 0;
   }
 
-  if(mjson_find(s_params, params_len, "$.line2", &p, &n) == MJSON_TOK_STRING) {
-    line2 = calloc(n-1, sizeof(char));
-    memcpy(line2, p+1, n-2);
+  member = &members[READER_MEMBER_LINE2];
+  if(valid && member->tok == MJSON_TOK_STRING) {
+    line2 = calloc(member->len, sizeof(char));
+    valid = line2 != NULL && decode_string(env.binary, member->ptr, member->len, line2, member->len) >= 0;
   }
 
-  _reader_event_app_cb(msg_idx, line1 == NULL ? "" : line1, line2 == NULL ? "" : line2);
+  if(valid)
+    ctx->reader_event_cb(ctx, msg_idx, line1 == NULL ? "" : line1, line2 == NULL ? "" : line2, ctx->reader_event_user_data);
+  else
+    KIOSK_ERROR("invalid text in ReaderMessageEvent: %.*s\n", _log_len(data, data_len), data);
 
   if(line1 != NULL)
     free(line1);
@@ -324,63 +669,180 @@ static void reader_event_received(unsigned char* data, int data_len) {
     free(line2);
 }
 
-static void kiosk_msg_received(unsigned char* data, int data_len) {
-  KIOSK_DEBUG("received data from kiosk: %*s\n", data_len, data);
+static void kiosk_msg_received(LibOtiKiosk_Context* ctx, unsigned char* data, int data_len) {
+  KIOSK_DEBUG("received %d bytes from kiosk: %.*s\n", data_len, _log_len(data, data_len), data);
 
-  // check if it's a response that we expect
-  int id = 0;
-  if(_expected_id >= 0 && parse_id(data, data_len, &id) == KIOSK_RET_OK && id == _expected_id) {
-    current_resp_len = data_len;
+  kiosk_envelope env;
+  if(parse_envelope((char*)data, data_len, &env) != KIOSK_RET_OK) {
+    KIOSK_ERROR("invalid message received from kiosk: %.*s\n", _log_len(data, data_len), data);
+    return;
+  }
+
+  // check if it's a response that we expect, responses have no method
+  if(ctx->expected_id >= 0 && env.method.len == 0 && env.has_id && env.id == ctx->expected_id) {
+    ctx->current_resp = data;
+    ctx->current_resp_len = data_len;
+    ctx->current_resp_env = env;
     // clear the "response done" semaphore
-    _sema_clear(&sema_resp_done);
+    _sema_clear(&ctx->sema_resp_done);
     // signal that the response is ready
-    sem_post(&sema_resp_ready);
+    sem_post(&ctx->sema_resp_ready);
     // wait for the response to be handled
-    if(_sema_wait_timeout(&sema_resp_done, 100) != 0) {
+    if(_sema_wait_timeout(&ctx->sema_resp_done, 100) != 0) {
       KIOSK_ERROR("kiosk response not handled after 100ms\n");
     }
-    current_resp_len = 0;
+    ctx->current_resp_len = 0;
     return;
   }
 
   // not a response, check for supported events
+  bool forwarded = ctx->raw_event_cb != NULL && env.method.len > 0;
+  if(forwarded)
+    ctx->raw_event_cb(ctx, true, (char*)data, data_len, ctx->raw_event_user_data);
 
   //identify TransactionComplete event
-  int evt_id = 0;
-  if(parse_transaction_complete(data, data_len, &pmt_resp, &evt_id) == KIOSK_RET_OK) {
-    // send ACK
-    const char* ack_template = "{\"jsonrpc\": \"2.0\", \"result\": true, \"id\": %d}";
-    char* ack = build_command(ack_template, evt_id);
-    send_to_kiosk(ack, strlen(ack));
-    free(ack);
-
-    // call the application callback
-    if(_trans_complete_app_cb != NULL)
-      _trans_complete_app_cb(&pmt_resp);
+  if(envelope_method_is((char*)data, &env, KIOSK_EVENT_TRANSACTION_COMPLETE)) {
+    LibOtiKiosk_TransactionView view;
+    KIOSK_RET ret = transaction_view_init(&view, (char*)data, &env);
+    // fully decoded only for the TransactionComplete callback, the view decodes on demand
+    if(ret == KIOSK_RET_OK && ctx->trans_complete_cb != NULL)
+      ret = parse_transaction_complete((char*)data, &env, &ctx->pmt_resp);
+    if(ret != KIOSK_RET_OK) {
+      KIOSK_ERROR("invalid TransactionComplete event received from kiosk: %.*s\n", _log_len(data, data_len), data);
+      return;
+    }
+
+    // send ACK, in the encoding of the event
+    char ack[64];
+    int ack_len;
+    if(env.binary) {
+      struct msgpack_out out = MSGPACK_OUT(ack, sizeof(ack));
+      msgpack_put_map(&out, 3);
+      msgpack_put_str(&out, "jsonrpc", 7);
+      msgpack_put_str(&out, "2.0", 3);
+      msgpack_put_str(&out, "result", 6);
+      msgpack_put_bool(&out, true);
+      msgpack_put_str(&out, "id", 2);
+      msgpack_put_int(&out, env.id);
+      ack_len = out.len;
+    } else {
+      ack_len = build_command(ack, sizeof(ack), "{\"jsonrpc\": \"2.0\", \"result\": true, \"id\": %d}", env.id);
+    }
+    if(ack_len > 0)
+      send_to_kiosk(ctx, ack, ack_len);
+
+    // call the application callbacks
+    if(ctx->trans_view_cb != NULL)
+      ctx->trans_view_cb(ctx, &view, ctx->trans_view_user_data);
+    if(ctx->trans_complete_cb != NULL)
+      ctx->trans_complete_cb(ctx, &ctx->pmt_resp, ctx->trans_complete_user_data);
     return;
-  } else {
-    KIOSK_ERROR("unexpected message received from kiosk: %.*s\n", data_len, data);
   }
+
+  if(!forwarded)
+    KIOSK_ERROR("unexpected message received from kiosk: %.*s\n", _log_len(data, data_len), data);
 }
 
-bool LibOtiKiosk_Init(const char* server_address, bool is_local) {
+static void _socket_options_init(LibOtiKiosk_Context* ctx, KioskSocketOptions* socket_options, bool is_commands, void (*recv_cb)(LibOtiKiosk_Context*, unsigned char*, int)) {
+  memset(socket_options, 0, sizeof(KioskSocketOptions));
+  socket_options->ctx = ctx;
+  socket_options->is_commands = is_commands;
+  socket_options->incoming_timeout_ms = 1000;
+  pthread_mutex_init(&socket_options->mutex, NULL);
+  socket_options->sockfd = -1;
+  socket_options->recv_cb = recv_cb;
+}
+
+static char* _build_socket_path(const char* base, const char* name) {
+  int len = snprintf(NULL, 0, "%s/%s", base, name)+1;
+  char* path = calloc(len, 1);
+  if(path == NULL) {
+    KIOSK_ERROR("failed to allocate %d characters\n", len);
+    return NULL;
+  }
+  snprintf(path, len, "%s/%s", base, name);
+  return path;
+}
+
+static void _free_endpoints(LibOtiKiosk_Context* ctx) {
+  for(int i = 0; i < ctx->nb_endpoints; i++) {
+    free(ctx->endpoints[i].cmd_addr);
+    free(ctx->endpoints[i].evt_addr);
+  }
+  free(ctx->endpoints);
+  ctx->endpoints = NULL;
+  ctx->nb_endpoints = 0;
+}
+
+static bool _context_init(LibOtiKiosk_Context* ctx, const LibOtiKiosk_Endpoint* endpoints, int nb_endpoints, unsigned int connect_timeout_ms) {
+  // the threads of a running context use its sockets, mutexes and semaphores
+  if(ctx->threads_started) {
+    KIOSK_ERROR("kiosk context already initialized\n");
+    return false;
+  }
+
+  // left by a failed LibOtiKiosk_Init, before it is retried
+  _free_endpoints(ctx);
+  memset(ctx, 0, offsetof(LibOtiKiosk_Context, codec));
+  ctx->expected_id = -1;
+  ctx->connected_endpoint = -1;
+  ctx->connect_timeout_ms = connect_timeout_ms > 0 ? connect_timeout_ms : DEFAULT_CONNECT_TIMEOUT_MS;
+
   // initialize common socket params
-  memset(&_commands_socket_options, 0, sizeof(_commands_socket_options));
-  _commands_socket_options.is_tcp = !is_local;
-  _commands_socket_options.incoming_timeout_ms = 1000;
-  pthread_mutex_init(&_commands_socket_options.mutex, NULL);
-  _commands_socket_options.sockfd = -1;
-  _commands_socket_options.recv_cb = kiosk_msg_received;
-
-  memset(&_reader_socket_options, 0, sizeof(_reader_socket_options));
-  _reader_socket_options.is_tcp = !is_local;
-  _reader_socket_options.incoming_timeout_ms = 1000;
-  pthread_mutex_init(&_reader_socket_options.mutex, NULL);
-  _reader_socket_options.sockfd = -1;
-  _reader_socket_options.recv_cb = reader_event_received;
+  _socket_options_init(ctx, &ctx->commands_socket_options, true, kiosk_msg_received);
+  _socket_options_init(ctx, &ctx->reader_socket_options, false, reader_event_received);
+  pthread_mutex_init(&ctx->endpoint_mutex, NULL);
+  pthread_mutex_init(&ctx->call_mutex, NULL);
 
   KIOSK_INFO("initializing EmvCore Client Library "EMV_CORE_GIT_TAG"-"EMV_CORE_REV_COUNT"\n");
 
+  if(endpoints == NULL || nb_endpoints <= 0) {
+    KIOSK_ERROR("no endpoint configured\n");
+    return false;
+  }
+
+  // keep our own copy of the endpoints
+  ctx->endpoints = calloc(nb_endpoints, sizeof(KioskEndpoint));
+  if(ctx->endpoints == NULL)
+    return false;
+  ctx->nb_endpoints = nb_endpoints;
+  for(int i = 0; i < nb_endpoints; i++) {
+    const LibOtiKiosk_Endpoint* src = &endpoints[i];
+    KioskEndpoint* ep = &ctx->endpoints[i];
+    if(src->cmd_address == NULL || src->event_address == NULL) {
+      KIOSK_ERROR("endpoint %d has no address\n", i);
+      return false;
+    }
+    ep->is_tcp = !src->is_local;
+    ep->cmd_addr = strdup(src->cmd_address);
+    ep->cmd_port = src->cmd_port != 0 ? src->cmd_port : 10000;
+    ep->evt_addr = strdup(src->event_address);
+    ep->evt_port = src->event_port != 0 ? src->event_port : 10001;
+    if(ep->cmd_addr == NULL || ep->evt_addr == NULL)
+      return false;
+  }
+
+  // initialize semaphores
+  if(sem_init(&ctx->sema_resp_ready, 0, 0) != 0)
+    return false;
+  if(sem_init(&ctx->sema_resp_done, 0, 0) != 0)
+    return false;
+
+  // start a thread for handling each socket
+  ctx->running = true;
+  pthread_create(&ctx->commands_thread, NULL, _kiosk_comm_loop, &ctx->commands_socket_options);
+  pthread_create(&ctx->reader_thread, NULL, _kiosk_comm_loop, &ctx->reader_socket_options);
+  ctx->threads_started = true;
+  return true;
+}
+
+// builds the single endpoint described by the LibOtiKiosk_Init parameters
+static bool _context_init_legacy(LibOtiKiosk_Context* ctx, const char* server_address, bool is_local) {
+  LibOtiKiosk_Endpoint endpoint = {0};
+  char* cmd_path = NULL;
+  char* evt_path = NULL;
+  endpoint.is_local = is_local;
+
   if(is_local) {
     KIOSK_DEBUG("initializing for Unix domain sockets\n");
     // setting up for Unix domain sockets
@@ -399,21 +861,10 @@ bool LibOtiKiosk_Init(const char* server_address, bool is_local) {
     }
 
     // we have a base path, now build actual socket paths
-    int len = snprintf(NULL, 0, "%s/socket_cmd", server_address)+1;
-    _commands_socket_options.server_addr = calloc(len, 1);
-    if(_commands_socket_options.server_addr == NULL) {
-      KIOSK_ERROR("failed to allocate %d characters\n", len);
-      return false;
-    }
-    snprintf(_commands_socket_options.server_addr, len, "%s/socket_cmd", server_address);
-
-    len = snprintf(NULL, 0, "%s/socket_events", server_address)+1;
-    _reader_socket_options.server_addr = calloc(len, 1);
-    if(_reader_socket_options.server_addr == NULL) {
-      KIOSK_ERROR("failed to allocate %d characters\n", len);
-      return false;
-    }
-    snprintf(_reader_socket_options.server_addr, len, "%s/socket_events", server_address);
+    cmd_path = _build_socket_path(server_address, "socket_cmd");
+    evt_path = _build_socket_path(server_address, "socket_events");
+    endpoint.cmd_address = cmd_path;
+    endpoint.event_address = evt_path;
   } else {
     KIOSK_DEBUG("initializing for TCP sockets\n");
     // setting up for TCP sockets
@@ -422,207 +873,224 @@ bool LibOtiKiosk_Init(const char* server_address, bool is_local) {
       // no server address provided, use localhost
       server_address = "127.0.0.1";
     }
-    _commands_socket_options.server_addr = (char*)server_address;
-    _commands_socket_options.tcp_port = 10000;
-    _reader_socket_options.server_addr = (char*)server_address;
-    _reader_socket_options.tcp_port = 10001;
+    endpoint.cmd_address = server_address;
+    endpoint.event_address = server_address;
   }
 
-  return LibOtiKiosk_Init_Common();
+  bool ret = _context_init(ctx, &endpoint, 1, 0);
+  free(cmd_path);
+  free(evt_path);
+  return ret;
 }
 
-void LibOtiKiosk_Register_TransactionComplete_Callback(TransactionCompleteCb_t cb) {
-  _trans_complete_app_cb = cb;
-}
+static LibOtiKiosk_Context* _context_create(const LibOtiKiosk_Endpoint* endpoints, int nb_endpoints, unsigned int connect_timeout_ms, const char* server_address, bool is_local) {
+  LibOtiKiosk_Context* ctx = calloc(1, sizeof(LibOtiKiosk_Context));
+  if(ctx == NULL) {
+    KIOSK_ERROR("failed to allocate kiosk context\n");
+    return NULL;
+  }
 
-void LibOtiKiosk_Register_ReaderEvent_Callback(RdrEventCb_t cb) {
-  _reader_event_app_cb = cb;
+  bool ok = endpoints != NULL ? _context_init(ctx, endpoints, nb_endpoints, connect_timeout_ms) : _context_init_legacy(ctx, server_address, is_local);
+  if(!ok) {
+    LibOtiKiosk_Ctx_Destroy(ctx);
+    return NULL;
+  }
+  return ctx;
 }
 
-void LibOtiKiosk_Enable_Debug_Logs(bool enabled) {
-  oT_Log_Set_Module_Level("KIOSK", enabled ? e_OT_LOG_LEVEL_DEBUG : e_OT_LOG_LEVEL_INFO);
+LibOtiKiosk_Context* LibOtiKiosk_Ctx_Create(const char* server_address, bool is_local) {
+  return _context_create(NULL, 0, 0, server_address, is_local);
 }
 
-KIOSK_RET LibOtiKiosk_GetStatus(KIOSK_STATUS *out_status) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
-
-  KIOSK_RET ret = KIOSK_RET_GENERAL_ERROR;
-  *out_status = OK_NOT_READY;
+LibOtiKiosk_Context* LibOtiKiosk_Ctx_Create_Endpoints(const LibOtiKiosk_Endpoint* endpoints, int nb_endpoints, unsigned int connect_timeout_ms) {
+  if(endpoints == NULL || nb_endpoints <= 0)
+    return NULL;
+  return _context_create(endpoints, nb_endpoints, connect_timeout_ms, NULL, false);
+}
 
-  char* cmd = "{\"jsonrpc\": \"2.0\", \"method\": \"GetStatus\", \"params\": {}, \"id\": 1}";
+void LibOtiKiosk_Ctx_Destroy(LibOtiKiosk_Context* ctx) {
+  if(ctx == NULL || ctx == &_default_context)
+    return;
 
-  ret = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  if(ret != KIOSK_RET_OK) {
-    return ret;
+  // stop the socket threads, they exit after their current poll timeout
+  ctx->running = false;
+  if(ctx->threads_started) {
+    pthread_join(ctx->commands_thread, NULL);
+    pthread_join(ctx->reader_thread, NULL);
+    sem_destroy(&ctx->sema_resp_ready);
+    sem_destroy(&ctx->sema_resp_done);
   }
+  pthread_mutex_destroy(&ctx->call_mutex);
+  pthread_mutex_destroy(&ctx->endpoint_mutex);
+  pthread_mutex_destroy(&ctx->commands_socket_options.mutex);
+  pthread_mutex_destroy(&ctx->reader_socket_options.mutex);
 
-  // parse response
-  ret = parse_get_status(resp_buff, resp_len, 1, out_status);
-
-  return ret;
+  _free_endpoints(ctx);
+  free(ctx);
 }
 
-KIOSK_RET LibOtiKiosk_ShowMessage(const char* line1, const char* line2) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
-
-  const char* cmd_template = "{\"jsonrpc\": \"2.0\", \"method\": \"ShowMessage\", \"params\": {\"strLine1\":\"%s\", \"strLine2\":\"%s\"}, \"id\": 2}";
-  char* cmd = build_command(cmd_template, line1, line2);
-  if(cmd == NULL)
-    return KIOSK_RET_MEMORY_ERROR;
+KIOSK_RET LibOtiKiosk_Ctx_Get_Stats(LibOtiKiosk_Context* ctx, LibOtiKiosk_Stats* out_stats) {
+  if(ctx == NULL || out_stats == NULL)
+    return KIOSK_RET_GENERAL_ERROR;
 
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  free(cmd);
-  if(status != KIOSK_RET_OK) {
-    return status;
-  }
+  pthread_mutex_lock(&ctx->endpoint_mutex);
+  *out_stats = ctx->stats;
+  pthread_mutex_unlock(&ctx->endpoint_mutex);
+  return KIOSK_RET_OK;
+}
 
-  // parse response
-  return(check_response_ok(resp_buff, resp_len, 2));
+KIOSK_RET LibOtiKiosk_Ctx_Set_Codec(LibOtiKiosk_Context* ctx, KIOSK_CODEC codec) {
+  if(ctx == NULL || (codec != KIOSK_CODEC_JSON && codec != KIOSK_CODEC_MSGPACK))
+    return KIOSK_RET_GENERAL_ERROR;
+  ctx->codec = codec;
+  return KIOSK_RET_OK;
 }
 
-KIOSK_RET LibOtiKiosk_GetKioskId(char* out_kiosk_id, int max_out_size) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+LibOtiKiosk_Context* LibOtiKiosk_Default_Context(void) {
+  return &_default_context;
+}
 
-  KIOSK_RET ret = KIOSK_RET_GENERAL_ERROR;
-  memset(out_kiosk_id, 0, max_out_size);
+void LibOtiKiosk_Ctx_Register_TransactionComplete_Callback(LibOtiKiosk_Context* ctx, TransactionCompleteCtxCb_t cb, void* user_data) {
+  ctx->trans_complete_user_data = user_data;
+  ctx->trans_complete_cb = cb;
+}
 
-  char* cmd = "{\"jsonrpc\": \"2.0\", \"method\": \"GetKioskID\", \"params\": {}, \"id\": 3}";
+void LibOtiKiosk_Ctx_Register_TransactionView_Callback(LibOtiKiosk_Context* ctx, TransactionViewCtxCb_t cb, void* user_data) {
+  ctx->trans_view_user_data = user_data;
+  ctx->trans_view_cb = cb;
+}
 
-  ret = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  if(ret != KIOSK_RET_OK) {
-    return ret;
-  }
+void LibOtiKiosk_Ctx_Register_ReaderEvent_Callback(LibOtiKiosk_Context* ctx, RdrEventCtxCb_t cb, void* user_data) {
+  ctx->reader_event_user_data = user_data;
+  ctx->reader_event_cb = cb;
+}
 
-  // parse response
-  return(parse_resp_result(resp_buff, resp_len, 3, out_kiosk_id, max_out_size));
+void LibOtiKiosk_Ctx_Register_RawEvent_Callback(LibOtiKiosk_Context* ctx, RawEventCtxCb_t cb, void* user_data) {
+  ctx->raw_event_user_data = user_data;
+  ctx->raw_event_cb = cb;
 }
 
-KIOSK_RET LibOtiKiosk_GetKioskVersion(char* out_kiosk_version, int max_out_size) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+// LibOtiKiosk_Ctx_* commands, generated from schema/kiosk_core.json
+#include "kiosk_methods.inc"
 
-  KIOSK_RET ret = KIOSK_RET_GENERAL_ERROR;
-  memset(out_kiosk_version, 0, max_out_size);
+KIOSK_RET LibOtiKiosk_Ctx_Call(LibOtiKiosk_Context* ctx, const char* cmd, int cmd_len, char* out_resp, int* inout_resp_len, int timeout_ms) {
+  if(cmd == NULL || out_resp == NULL || inout_resp_len == NULL)
+    return KIOSK_RET_GENERAL_ERROR;
 
-  char* cmd = "{\"jsonrpc\": \"2.0\", \"method\": \"GetVersion\", \"params\": {\"SoftwareComponent\": \"otiKiosk\"}, \"id\": 4}";
+  return send_receive(ctx, (char*)cmd, cmd_len, out_resp, inout_resp_len, NULL, timeout_ms);
+}
 
-  ret = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  if(ret != KIOSK_RET_OK) {
-    return ret;
-  }
+/*
+ * Context-less API, working on the default context
+ */
 
-  // parse response
-  return(parse_resp_result(resp_buff, resp_len, 4, out_kiosk_version, max_out_size));
+static void _default_trans_complete_cb(LibOtiKiosk_Context* ctx, otiKioskPaymentResponse* resp, void* user_data) {
+  if(_trans_complete_app_cb != NULL)
+    _trans_complete_app_cb(resp);
 }
 
-KIOSK_RET LibOtiKiosk_GetReaderVersion(char* out_version, int max_out_size) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
-
-  KIOSK_RET ret = KIOSK_RET_GENERAL_ERROR;
-  memset(out_version, 0, max_out_size);
+static void _default_reader_event_cb(LibOtiKiosk_Context* ctx, uint8_t msg_index, char* s_line1, char* s_line2, void* user_data) {
+  if(_reader_event_app_cb != NULL)
+    _reader_event_app_cb(msg_index, s_line1, s_line2);
+}
 
-  char* cmd = "{\"jsonrpc\": \"2.0\", \"method\": \"GetVersion\", \"params\": {\"SoftwareComponent\": \"Reader\"}, \"id\": 5}";
+bool LibOtiKiosk_Init(const char* server_address, bool is_local) {
+  // the callbacks and the codec set on the default context before the call are kept
+  return _context_init_legacy(&_default_context, server_address, is_local);
+}
 
-  ret = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  if(ret != KIOSK_RET_OK) {
-    return ret;
-  }
+// the adapters are only installed when there is an application callback, so that events aren't decoded for nothing
+void LibOtiKiosk_Register_TransactionComplete_Callback(TransactionCompleteCb_t cb) {
+  _trans_complete_app_cb = cb;
+  LibOtiKiosk_Ctx_Register_TransactionComplete_Callback(&_default_context, cb != NULL ? _default_trans_complete_cb : NULL, NULL);
+}
 
-  // parse response
-  return(parse_resp_result(resp_buff, resp_len, 5, out_version, max_out_size));
+void LibOtiKiosk_Register_ReaderEvent_Callback(RdrEventCb_t cb) {
+  _reader_event_app_cb = cb;
+  LibOtiKiosk_Ctx_Register_ReaderEvent_Callback(&_default_context, cb != NULL ? _default_reader_event_cb : NULL, NULL);
 }
 
-KIOSK_RET LibOtiKiosk_PreAuthorize(otiKioskPaymentParameters *params) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+void LibOtiKiosk_Enable_Debug_Logs(bool enabled) {
+  oT_Log_Set_Module_Level("KIOSK", enabled ? e_OT_LOG_LEVEL_DEBUG : e_OT_LOG_LEVEL_INFO);
+}
 
-  const char* cmd_template = "{\"jsonrpc\":\"2.0\",\"method\":\"PreAuthorize\", \"params\": {\"amount\":%d, \"currency\":%d, \"timeout\":%d, \"fee\":%d, \"productID\":%d, \"continuous\":%s}, \"id\":6}";
-  char* cmd = build_command(cmd_template, params->amount_cents, params->currency_code, params->timeout_sec, params->fee_cents, params->product_id, params->continuous ? "true" : "false");
-  if(cmd == NULL)
-    return KIOSK_RET_MEMORY_ERROR;
+KIOSK_RET LibOtiKiosk_Enable_Async_Logs(bool enabled, unsigned int nb_logs, bool drop_on_overflow) {
+  if(!enabled) {
+    oT_Log_Stop_Async();
+    return KIOSK_RET_OK;
+  }
 
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  free(cmd);
-  if(status != KIOSK_RET_OK) {
-    return status;
+  if(nb_logs == 0) {
+    KIOSK_ERROR("Invalid number of logs\n");
+    return KIOSK_RET_GENERAL_ERROR;
   }
 
-  // parse response
-  return(check_response_ok(resp_buff, resp_len, 6));
+  if(oT_Log_Start_Async(nb_logs, drop_on_overflow ? e_OT_LOG_OVERFLOW_DROP : e_OT_LOG_OVERFLOW_BLOCK) != 0) {
+    KIOSK_ERROR("Failed to start the log writer\n");
+    return KIOSK_RET_MEMORY_ERROR;
+  }
+  return KIOSK_RET_OK;
 }
 
-KIOSK_RET LibOtiKiosk_PayTransaction(otiKioskPaymentParameters *params) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+unsigned long long LibOtiKiosk_Get_Dropped_Logs(void) {
+  t_OT_LOG_ASYNC_STATS stats;
+  oT_Log_Get_Async_Stats(&stats);
+  return stats.dropped;
+}
 
-  const char* cmd_template = "{\"jsonrpc\":\"2.0\",\"method\":\"PayTransaction\", \"params\": {\"amount\":%d, \"currency\":%d, \"timeout\":%d, \"fee\":%d, \"productID\":%d, \"continuous\":%s}, \"id\":7}";
-  char* cmd = build_command(cmd_template, params->amount_cents, params->currency_code, params->timeout_sec, params->fee_cents, params->product_id, params->continuous ? "true" : "false");
-  if(cmd == NULL)
-    return KIOSK_RET_MEMORY_ERROR;
+KIOSK_RET LibOtiKiosk_Enable_Binary_Logs(const char* path) {
+  if(path == NULL) {
+    oT_Log_Stop_Binary();
+    return KIOSK_RET_OK;
+  }
 
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  free(cmd);
-  if(status != KIOSK_RET_OK) {
-    return status;
+  if(oT_Log_Start_Binary(path) != 0) {
+    KIOSK_ERROR("Failed to create the log file %s (%s)\n", path, strerror(errno));
+    return KIOSK_RET_GENERAL_ERROR;
   }
+  return KIOSK_RET_OK;
+}
 
-  // parse response
-  return(check_response_ok(resp_buff, resp_len, 6));
+KIOSK_RET LibOtiKiosk_GetStatus(KIOSK_STATUS *out_status) {
+  return LibOtiKiosk_Ctx_GetStatus(&_default_context, out_status);
 }
 
-KIOSK_RET LibOtiKiosk_ConfirmTransaction(uint32_t amount_cents, uint32_t fee_cents, uint32_t product_id, char* transaction_reference) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+KIOSK_RET LibOtiKiosk_ShowMessage(const char* line1, const char* line2) {
+  return LibOtiKiosk_Ctx_ShowMessage(&_default_context, line1, line2);
+}
 
-  const char* cmd_template = "{\"jsonrpc\":\"2.0\",\"method\":\"ConfirmTransaction\", \"params\": {\"amount\":%d, \"fee\":%d, \"productID\":%d, \"transaction_Reference\":\"%s\"}, \"id\":8}";
-  char* cmd = build_command(cmd_template, amount_cents, fee_cents, product_id, transaction_reference);
-  if(cmd == NULL)
-    return KIOSK_RET_MEMORY_ERROR;
+KIOSK_RET LibOtiKiosk_GetKioskId(char* out_kiosk_id, int max_out_size) {
+  return LibOtiKiosk_Ctx_GetKioskId(&_default_context, out_kiosk_id, max_out_size);
+}
 
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  free(cmd);
-  if(status != KIOSK_RET_OK) {
-    return status;
-  }
+KIOSK_RET LibOtiKiosk_GetKioskVersion(char* out_kiosk_version, int max_out_size) {
+  return LibOtiKiosk_Ctx_GetKioskVersion(&_default_context, out_kiosk_version, max_out_size);
+}
 
-  // parse response
-  return(check_response_ok(resp_buff, resp_len, 8));
+KIOSK_RET LibOtiKiosk_GetReaderVersion(char* out_version, int max_out_size) {
+  return LibOtiKiosk_Ctx_GetReaderVersion(&_default_context, out_version, max_out_size);
 }
 
-KIOSK_RET LibOtiKiosk_VoidTransaction(char* transaction_reference) {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
+KIOSK_RET LibOtiKiosk_PreAuthorize(otiKioskPaymentParameters *params) {
+  return LibOtiKiosk_Ctx_PreAuthorize(&_default_context, params);
+}
 
-  const char* cmd_template = "{\"jsonrpc\":\"2.0\",\"method\":\"VoidTransaction\", \"params\": {\"transaction_Reference\":\"%s\"}, \"id\":9}";
-  char* cmd = build_command(cmd_template, transaction_reference);
-  if(cmd == NULL)
-    return KIOSK_RET_MEMORY_ERROR;
+KIOSK_RET LibOtiKiosk_PayTransaction(otiKioskPaymentParameters *params) {
+  return LibOtiKiosk_Ctx_PayTransaction(&_default_context, params);
+}
 
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  free(cmd);
-  if(status != KIOSK_RET_OK) {
-    return status;
-  }
+KIOSK_RET LibOtiKiosk_ConfirmTransaction(uint32_t amount_cents, uint32_t fee_cents, uint32_t product_id, char* transaction_reference) {
+  return LibOtiKiosk_Ctx_ConfirmTransaction(&_default_context, amount_cents, fee_cents, product_id, transaction_reference);
+}
 
-  // parse response
-  return(check_response_ok(resp_buff, resp_len, 9));
+KIOSK_RET LibOtiKiosk_VoidTransaction(char* transaction_reference) {
+  return LibOtiKiosk_Ctx_VoidTransaction(&_default_context, transaction_reference);
 }
 
 KIOSK_RET LibOtiKiosk_CancelTransaction() {
-  char resp_buff[128] = "";
-  int resp_len = sizeof(resp_buff);
-
-  char* cmd = "{\"jsonrpc\":\"2.0\",\"method\":\"CancelTransaction\", \"params\": {}, \"id\":10}";
-
-  KIOSK_RET status = send_receive(cmd, strlen(cmd), resp_buff, &resp_len, 500);
-  if(status != KIOSK_RET_OK) {
-    return status;
-  }
+  return LibOtiKiosk_Ctx_CancelTransaction(&_default_context);
+}
 
-  // parse response
-  return(parse_cancel_resp(resp_buff, resp_len, 10));
+KIOSK_RET LibOtiKiosk_Call(const char* cmd, int cmd_len, char* out_resp, int* inout_resp_len, int timeout_ms) {
+  return LibOtiKiosk_Ctx_Call(&_default_context, cmd, cmd_len, out_resp, inout_resp_len, timeout_ms);
 }
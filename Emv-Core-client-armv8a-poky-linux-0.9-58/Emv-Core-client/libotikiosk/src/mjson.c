@@ -39,10 +39,26 @@
 #define MJSON_ENABLE_BASE64 1
 #endif
 
+// Reject strings that are not valid UTF-8 in mjson_get_string()
+#ifndef MJSON_ENABLE_UTF8_CHECK
+#define MJSON_ENABLE_UTF8_CHECK 1
+#endif
+
+// Initial size of the jsonrpc_ctx input buffer, it grows up to
+// MJSON_RPC_IN_BUF_MAX for longer frames
 #ifndef MJSON_RPC_IN_BUF_SIZE
 #define MJSON_RPC_IN_BUF_SIZE 256
 #endif
 
+#ifndef MJSON_RPC_IN_BUF_MAX
+#define MJSON_RPC_IN_BUF_MAX 65536
+#endif
+
+// Number of buckets of the exported methods table, must be a power of 2
+#ifndef MJSON_RPC_HASH_SIZE
+#define MJSON_RPC_HASH_SIZE 32
+#endif
+
 #ifndef ATTR
 #define ATTR
 #endif
@@ -65,18 +81,81 @@ enum mjson_tok {
 };
 #define MJSON_TOK_IS_VALUE(t) ((t) > 10 && (t) < 20)
 
-typedef void (*mjson_cb_t)(int ev, const char *s, int off, int len, void *ud);
+// A callback returning non-zero stops the scan, mjson() then returns the
+// offset following the current token.
+typedef int (*mjson_cb_t)(int ev, const char *s, int off, int len, void *ud);
 
 #ifndef MJSON_MAX_DEPTH
 #define MJSON_MAX_DEPTH 20
 #endif
 
 int mjson(const char *s, int len, mjson_cb_t cb, void *ud);
+
+// Resumable framing of JSON values received in arbitrary chunks, e.g. from a
+// stream socket. Only strings and nesting are tracked, so that each byte is
+// scanned once; the complete value is validated when it is parsed.
+struct mjson_stream {
+  int depth;      // Nesting depth, 0 outside of the value
+  int in_string;  // Inside a string
+  int escaped;    // Previous byte was a backslash inside a string
+  int start;      // Offset of the value since the last init, -1 before it
+  int len;        // Number of bytes consumed since the last init
+  int done;       // A complete value ends at len
+};
+
+void mjson_stream_init(struct mjson_stream *st);
+int mjson_stream_feed(struct mjson_stream *st, const char *s, int len);
 enum mjson_tok mjson_find(const char *s, int len, const char *jp,
                           const char **tokptr, int *toklen);
 int mjson_get_number(const char *s, int len, const char *path, double *v);
 int mjson_get_bool(const char *s, int len, const char *path, int *v);
 int mjson_get_string(const char *s, int len, const char *path, char *to, int n);
+int mjson_unescape(const char *s, int len, char *to, int n);
+int mjson_utf8_valid(const char *s, int len);
+
+// Precompiled JSON path, e.g. "$.params.authorizationDetails" or "$[2].id".
+// Paths known at compile time can be initialized statically with
+// MJSON_PATH_KEY() / MJSON_PATH_INDEX(), others are built once with
+// mjson_path_compile(). Keys point into the original string.
+#ifndef MJSON_PATH_MAX_SEGMENTS
+#define MJSON_PATH_MAX_SEGMENTS 8
+#endif
+
+struct mjson_path_segment {
+  const char *key;  // Object key, NULL for an array index
+  int len;          // Key length, or array index
+};
+
+struct mjson_path {
+  int nb_segments;
+  struct mjson_path_segment segments[MJSON_PATH_MAX_SEGMENTS];
+};
+
+#define MJSON_PATH_KEY(k) \
+  { (k), (int) sizeof(k) - 1 }
+#define MJSON_PATH_INDEX(i) \
+  { NULL, (i) }
+
+int mjson_path_compile(const char *jp, struct mjson_path *path);
+enum mjson_tok mjson_path_find(const char *s, int len,
+                               const struct mjson_path *path,
+                               const char **tokptr, int *toklen);
+int mjson_path_get_number(const char *s, int len,
+                          const struct mjson_path *path, double *v);
+
+// Resolves several paths in a single pass over the document.
+#ifndef MJSON_FIND_MANY_MAX
+#define MJSON_FIND_MANY_MAX 16
+#endif
+
+struct mjson_find_result {
+  int tok;          // MJSON_TOK_INVALID if the path was not found
+  const char *ptr;  // Value, including quotes for strings
+  int len;
+};
+
+int mjson_find_many(const char *s, int len, const struct mjson_path *paths,
+                    int nb_paths, struct mjson_find_result *results);
 
 #if MJSON_ENABLE_BASE64
 int mjson_get_base64(const char *s, int len, const char *path, char *to, int n);
@@ -148,42 +227,51 @@ struct jsonrpc_method {
   int method_sz;
   void (*cb)(struct jsonrpc_request *);
   void *cbdata;
-  struct jsonrpc_method *next;
+  struct jsonrpc_method *next;   // All methods, in reverse export order
+  struct jsonrpc_method *hnext;  // Methods in the same hash bucket
+  unsigned hash;
 };
 
 typedef int (*jsonrpc_sender_t)(const char *buf, int len, void *userdata);
 
 /*
  * Main RPC context, stores current request information and a list of
- * exported RPC methods.
+ * exported RPC methods, also hashed by name for the dispatch.
  */
 struct jsonrpc_ctx {
   struct jsonrpc_method *methods;
+  struct jsonrpc_method *buckets[MJSON_RPC_HASH_SIZE];
   void *userdata;
   void (*response_cb)(const char *buf, int len, void *userdata);
   int in_len;
-  char in[MJSON_RPC_IN_BUF_SIZE];
+  int in_size;
+  int in_discard;  // Skipping the rest of an oversized frame
+  char *in;        // Partial frame, allocated on demand
 };
 
 /* Registers function fn under the given name within the given RPC context */
-#define jsonrpc_ctx_export(ctx, name, fn, ud)                                \
-  do {                                                                       \
-    static struct jsonrpc_method m = {(name), sizeof(name) - 1, (fn), 0, 0}; \
-    m.cbdata = (ud);                                                         \
-    m.next = (ctx)->methods;                                                 \
-    (ctx)->methods = &m;                                                     \
+#define jsonrpc_ctx_export(ctx, name, fn, ud)                          \
+  do {                                                                 \
+    static struct jsonrpc_method m = {(name), sizeof(name) - 1, (fn)}; \
+    m.cbdata = (ud);                                                   \
+    jsonrpc_ctx_add(ctx, &m);                                          \
   } while (0)
 
+void jsonrpc_ctx_add(struct jsonrpc_ctx *ctx, struct jsonrpc_method *m);
+
 void jsonrpc_ctx_init(struct jsonrpc_ctx *ctx,
                       void (*response_cb)(const char *, int, void *),
                       void *userdata);
+void jsonrpc_ctx_free(struct jsonrpc_ctx *ctx);
 int jsonrpc_call(jsonrpc_sender_t fn, void *fndata, const char *fmt, ...);
 void jsonrpc_return_error(struct jsonrpc_request *r, int code,
                           const char *message_fmt, ...);
 void jsonrpc_return_success(struct jsonrpc_request *r, const char *result_fmt,
                             ...);
-void jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, char *req, int req_sz,
-                         jsonrpc_sender_t fn, void *fndata);
+void jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, const char *req,
+                         int req_sz, jsonrpc_sender_t fn, void *fndata);
+void jsonrpc_ctx_process_buf(struct jsonrpc_ctx *ctx, const char *buf, int len,
+                             jsonrpc_sender_t fn, void *fndata);
 void jsonrpc_ctx_process_byte(struct jsonrpc_ctx *ctx, unsigned char ch,
                               jsonrpc_sender_t fn, void *fndata);
 
@@ -198,6 +286,10 @@ extern struct jsonrpc_ctx jsonrpc_default_context;
 #define jsonrpc_process_byte(x, fn, data) \
   jsonrpc_ctx_process_byte(&jsonrpc_default_context, (x), (fn), (data))
 
+#define jsonrpc_process_buf(buf, len, fn, data)                          \
+  jsonrpc_ctx_process_buf(&jsonrpc_default_context, (buf), (len), (fn), \
+                          (data))
+
 #endif /* MJSON_ENABLE_RPC */
 
 #endif /* MJSON_H_ */
@@ -208,6 +300,20 @@ extern struct jsonrpc_ctx jsonrpc_default_context;
 #define snprintf _snprintf
 #endif
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#include <stdint.h>
+#endif
+
+// Kept private so that it doesn't replace the libc strtod() of the whole program
+#if MJSON_IMPLEMENT_STRTOD
+static double mjson_strtod(const char *str, char **end);
+#else
+#define mjson_strtod strtod
+#endif
+
 static int mjson_esc(int c, int esc) {
   const char *p, *esc1 = "\b\f\n\r\t\\\"/", *esc2 = "bfnrt\\\"/";
   for (p = esc ? esc1 : esc2; *p != '\0'; p++) {
@@ -216,9 +322,83 @@ static int mjson_esc(int c, int esc) {
   return 0;
 }
 
+// Index of the first '"', '\\' or NUL byte in s, or len if there is none.
+// Strings are scanned 16 or 32 bytes at a time where the target has SIMD.
+static int mjson_find_special(const char *s, int len) {
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256i quote = _mm256_set1_epi8('"'), bslash = _mm256_set1_epi8('\\');
+  const __m256i zero = _mm256_setzero_si256();
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+        _mm256_cmpeq_epi8(v, zero));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i quote16 = _mm_set1_epi8('"'), bslash16 = _mm_set1_epi8('\\');
+  const __m128i zero16 = _mm_setzero_si128();
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote16), _mm_cmpeq_epi8(v, bslash16)),
+        _mm_cmpeq_epi8(v, zero16));
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  const uint8x16_t quote16 = vdupq_n_u8('"'), bslash16 = vdupq_n_u8('\\');
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+    uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, quote16), vceqq_u8(v, bslash16)),
+                            vceqzq_u8(v));
+    if (vmaxvq_u8(m) != 0) {
+      // narrow to 4 bits per byte to get a 64-bit mask of the matches
+      uint64_t mask = vget_lane_u64(
+          vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+      return i + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    if (s[i] == '"' || s[i] == '\\' || s[i] == '\0') break;
+  }
+  return i;
+}
+
+static int mjson_is_digit(int c) {
+  return c >= '0' && c <= '9';
+}
+
+// Length of the JSON number at the start of s, or 0 if it isn't a valid one.
+// Only validates the syntax, the value is converted by whoever needs it.
+static int mjson_pass_number(const char *s, int len) {
+  int i = 0, n;
+  if (i < len && s[i] == '-') i++;
+  for (n = i; i < len && mjson_is_digit(s[i]); i++) (void) 0;
+  if (i == n) return 0;
+  if (i < len && s[i] == '.') {
+    for (n = ++i; i < len && mjson_is_digit(s[i]); i++) (void) 0;
+    if (i == n) return 0;
+  }
+  if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+    i++;
+    if (i < len && (s[i] == '-' || s[i] == '+')) i++;
+    for (n = i; i < len && mjson_is_digit(s[i]); i++) (void) 0;
+    if (i == n) return 0;
+  }
+  return i;
+}
+
 static int mjson_pass_string(const char *s, int len) {
   int i;
   for (i = 0; i < len; i++) {
+    // skip the plain characters in bulk
+    i += mjson_find_special(s + i, len - i);
+    if (i >= len) break;
     if (s[i] == '\\' && i + 1 < len && mjson_esc(s[i + 1], 1)) {
       i++;
     } else if (s[i] == '\0') {
@@ -234,8 +414,9 @@ int ATTR mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
   enum { S_VALUE, S_KEY, S_COLON, S_COMMA_OR_EOO } expecting = S_VALUE;
   unsigned char nesting[MJSON_MAX_DEPTH];
   int i, depth = 0;
-#define MJSONCALL(ev) \
-  if (cb) cb(ev, s, start, i - start + 1, ud)
+#define MJSONCALL(ev)                                          \
+  if (cb != NULL && cb(ev, s, start, i - start + 1, ud) != 0) \
+  return i + 1
 
 // In the ascii table, the distance between `[` and `]` is 2.
 // Ditto for `{` and `}`. Hence +2 in the code below.
@@ -278,9 +459,9 @@ int ATTR mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
           i += 4;
           tok = MJSON_TOK_FALSE;
         } else if (c == '-' || ((c >= '0' && c <= '9'))) {
-          char *end = NULL;
-          strtod(&s[i], &end);
-          if (end != NULL) i += end - &s[i] - 1;
+          int n = mjson_pass_number(&s[i], len - i);
+          if (n == 0) return MJSON_ERROR_INVALID_INPUT;
+          i += n - 1;
           tok = MJSON_TOK_NUMBER;
         } else if (c == '"') {
           int n = mjson_pass_string(&s[i + 1], len - i - 1);
@@ -336,98 +517,226 @@ int ATTR mjson(const char *s, int len, mjson_cb_t cb, void *ud) {
   return MJSON_ERROR_INVALID_INPUT;
 }
 
-struct msjon_get_data {
-  const char *path;     // Lookup json path
-  int pos;              // Current path index
-  int d1;               // Current depth of traversal
-  int d2;               // Expected depth of traversal
-  int i1;               // Index in an array
-  int i2;               // Expected index in an array
+void ATTR mjson_stream_init(struct mjson_stream *st) {
+  memset(st, 0, sizeof(*st));
+  st->start = -1;
+}
+
+// Consumes bytes up to the end of the current top level object or array.
+// Returns the number of bytes consumed, which is less than len only when the
+// value is complete (st->done is set), or MJSON_ERROR_INVALID_INPUT.
+// Whitespace before the value is consumed and skipped.
+int ATTR mjson_stream_feed(struct mjson_stream *st, const char *s, int len) {
+  int i = 0;
+  if (st->done) return 0;
+  while (i < len) {
+    unsigned char c;
+    if (st->in_string) {
+      if (st->escaped) {
+        st->escaped = 0;
+        i++;
+        continue;
+      }
+      i += mjson_find_special(s + i, len - i);
+      if (i >= len) break;
+      c = (unsigned char) s[i++];
+      if (c == '"') {
+        st->in_string = 0;
+      } else if (c == '\\') {
+        st->escaped = 1;
+      } else {
+        return MJSON_ERROR_INVALID_INPUT;
+      }
+      continue;
+    }
+    c = (unsigned char) s[i++];
+    if (c == '{' || c == '[') {
+      if (st->depth == 0) st->start = st->len + i - 1;
+      if (++st->depth > MJSON_MAX_DEPTH) return MJSON_ERROR_TOO_DEEP;
+    } else if (c == '}' || c == ']') {
+      if (st->depth == 0) return MJSON_ERROR_INVALID_INPUT;
+      if (--st->depth == 0) {
+        st->done = 1;
+        break;
+      }
+    } else if (st->depth == 0) {
+      // only containers can be framed, scalars have no end marker
+      if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+        return MJSON_ERROR_INVALID_INPUT;
+    } else if (c == '"') {
+      st->in_string = 1;
+    }
+  }
+  st->len += i;
+  return i;
+}
+
+int ATTR mjson_path_compile(const char *jp, struct mjson_path *path) {
+  int i = 1, n = 0;
+  if (jp == NULL || jp[0] != '$') return -1;
+  while (jp[i] != '\0') {
+    if (n >= MJSON_PATH_MAX_SEGMENTS) return -1;
+    if (jp[i] == '.') {
+      int j = ++i;
+      while (jp[i] != '\0' && jp[i] != '.' && jp[i] != '[') i++;
+      path->segments[n].key = &jp[j];
+      path->segments[n].len = i - j;
+    } else if (jp[i] == '[') {
+      int idx = 0;
+      for (i++; mjson_is_digit(jp[i]); i++) idx = idx * 10 + (jp[i] - '0');
+      if (jp[i] != ']') return -1;
+      i++;
+      path->segments[n].key = NULL;
+      path->segments[n].len = idx;
+    } else {
+      return -1;
+    }
+    n++;
+  }
+  path->nb_segments = n;
+  return 0;
+}
+
+struct mjson_path_data {
+  const struct mjson_path *path;  // Lookup path
+  int seg;                        // Next segment to match
+  int d1;                         // Current depth of traversal
+  int d2;                         // Expected depth of traversal
+  int i1;                         // Index in an array, -1 outside
   int obj;              // If the value is array/object, offset where it starts
   const char **tokptr;  // Destination
   int *toklen;          // Destination length
   int tok;              // Returned token
 };
 
-static int mjson_plen(const char *s) {
-  int i = 0;
-  while (s[i] != '\0' && s[i] != '.' && s[i] != '[') i++;
-  return i;
-}
-
-static void ATTR mjson_get_cb(int tok, const char *s, int off, int len,
+static int ATTR mjson_path_cb(int tok, const char *s, int off, int len,
                               void *ud) {
-  struct msjon_get_data *data = (struct msjon_get_data *) ud;
-  // printf("--> %2x %2d %2d %2d %2d\t'%s'\t'%.*s'\t\t'%.*s'\n", tok, data->d1,
-  //        data->d2, data->i1, data->i2, data->path + data->pos, off, s, len,
-  //        s + off);
-  if (data->tok != MJSON_TOK_INVALID) return;  // Found
+  struct mjson_path_data *data = (struct mjson_path_data *) ud;
+  const struct mjson_path_segment *next =
+      data->seg < data->path->nb_segments ? &data->path->segments[data->seg]
+                                          : NULL;
+  if (data->tok != MJSON_TOK_INVALID) return 1;  // Found
 
   if (tok == '{') {
-    if (!data->path[data->pos] && data->d1 == data->d2) data->obj = off;
+    if (next == NULL && data->d1 == data->d2) data->obj = off;
     data->d1++;
   } else if (tok == '[') {
-    if (data->d1 == data->d2 && data->path[data->pos] == '[') {
+    if (data->d1 == data->d2 && next != NULL && next->key == NULL) {
       data->i1 = 0;
-      data->i2 = strtod(&data->path[data->pos + 1], NULL);
-      if (data->i1 == data->i2) {
+      if (next->len == 0) {
         data->d2++;
-        data->pos += 3;
+        data->seg++;
+        data->i1 = -1;
       }
+    } else if (next == NULL && data->d1 == data->d2) {
+      data->obj = off;
     }
-    if (!data->path[data->pos] && data->d1 == data->d2) data->obj = off;
     data->d1++;
   } else if (tok == ',') {
-    if (data->d1 == data->d2 + 1) {
+    if (data->d1 == data->d2 + 1 && data->i1 >= 0 && next != NULL &&
+        next->key == NULL) {
       data->i1++;
-      if (data->i1 == data->i2) {
-        while (data->path[data->pos] != ']') data->pos++;
-        data->pos++;
+      if (data->i1 == next->len) {
+        data->seg++;
         data->d2++;
+        data->i1 = -1;
       }
     }
   } else if (tok == MJSON_TOK_KEY && data->d1 == data->d2 + 1 &&
-             data->path[data->pos] == '.' && s[off] == '"' &&
-             s[off + len - 1] == '"' &&
-             mjson_plen(&data->path[data->pos + 1]) == len - 2 &&
-             !memcmp(s + off + 1, &data->path[data->pos + 1], len - 2)) {
+             next != NULL && next->key != NULL && next->len == len - 2 &&
+             !memcmp(s + off + 1, next->key, len - 2)) {
     data->d2++;
-    data->pos += len - 1;
+    data->seg++;
+    data->i1 = -1;
   } else if (tok == '}' || tok == ']') {
     data->d1--;
-    if (!data->path[data->pos] && data->d1 == data->d2 && data->obj != -1) {
+    if (next == NULL && data->d1 == data->d2 && data->obj != -1) {
       data->tok = tok - 2;
       if (data->tokptr) *data->tokptr = s + data->obj;
       if (data->toklen) *data->toklen = off - data->obj + 1;
     }
   } else if (MJSON_TOK_IS_VALUE(tok)) {
-    // printf("TOK --> %d\n", tok);
-    if (data->d1 == data->d2 && !data->path[data->pos]) {
+    if (data->d1 == data->d2 && next == NULL) {
       data->tok = tok;
       if (data->tokptr) *data->tokptr = s + off;
       if (data->toklen) *data->toklen = len;
     }
   }
+  return data->tok != MJSON_TOK_INVALID;
+}
+
+enum mjson_tok ATTR mjson_path_find(const char *s, int len,
+                                    const struct mjson_path *path,
+                                    const char **tokptr, int *toklen) {
+  struct mjson_path_data data = {path, 0,      0,      0, -1,
+                                 -1,   tokptr, toklen, MJSON_TOK_INVALID};
+  if (mjson(s, len, mjson_path_cb, &data) < 0) return MJSON_TOK_INVALID;
+  return (enum mjson_tok) data.tok;
+}
+
+struct mjson_find_many_data {
+  struct mjson_path_data paths[MJSON_FIND_MANY_MAX];
+  int nb_paths;
+};
+
+static int ATTR mjson_find_many_cb(int tok, const char *s, int off, int len,
+                                   void *ud) {
+  struct mjson_find_many_data *data = (struct mjson_find_many_data *) ud;
+  int i, found = 0;
+  for (i = 0; i < data->nb_paths; i++)
+    found += mjson_path_cb(tok, s, off, len, &data->paths[i]);
+  return found == data->nb_paths;
+}
+
+// Returns the number of paths found, or a negative value if the document is
+// invalid or there are more than MJSON_FIND_MANY_MAX paths.
+int ATTR mjson_find_many(const char *s, int len, const struct mjson_path *paths,
+                         int nb_paths, struct mjson_find_result *results) {
+  struct mjson_find_many_data data;
+  int i, found = 0;
+  if (nb_paths < 0 || nb_paths > MJSON_FIND_MANY_MAX)
+    return MJSON_ERROR_INVALID_INPUT;
+  data.nb_paths = nb_paths;
+  for (i = 0; i < nb_paths; i++) {
+    struct mjson_path_data d = {&paths[i],        0,  0,  0, -1, -1,
+                                &results[i].ptr, &results[i].len,
+                                MJSON_TOK_INVALID};
+    data.paths[i] = d;
+    results[i].ptr = NULL;
+    results[i].len = 0;
+  }
+  if (mjson(s, len, mjson_find_many_cb, &data) < 0)
+    return MJSON_ERROR_INVALID_INPUT;
+  for (i = 0; i < nb_paths; i++) {
+    results[i].tok = data.paths[i].tok;
+    if (results[i].tok != MJSON_TOK_INVALID) found++;
+  }
+  return found;
 }
 
 enum mjson_tok ATTR mjson_find(const char *s, int len, const char *jp,
                                const char **tokptr, int *toklen) {
-  struct msjon_get_data data = {jp, 1,  0,      0,      0,
-                                0,  -1, tokptr, toklen, MJSON_TOK_INVALID};
-  if (jp[0] != '$') return MJSON_TOK_INVALID;
-  if (mjson(s, len, mjson_get_cb, &data) < 0) return MJSON_TOK_INVALID;
-  return (enum mjson_tok) data.tok;
+  struct mjson_path path;
+  if (mjson_path_compile(jp, &path) != 0) return MJSON_TOK_INVALID;
+  return mjson_path_find(s, len, &path, tokptr, toklen);
 }
 
-int mjson_get_number(const char *s, int len, const char *path, double *v) {
+int ATTR mjson_path_get_number(const char *s, int len,
+                               const struct mjson_path *path, double *v) {
   const char *p;
   int tok, n;
-  if ((tok = mjson_find(s, len, path, &p, &n)) == MJSON_TOK_NUMBER) {
-    if (v != NULL) *v = strtod(p, NULL);
+  if ((tok = mjson_path_find(s, len, path, &p, &n)) == MJSON_TOK_NUMBER) {
+    if (v != NULL) *v = mjson_strtod(p, NULL);
   }
   return tok == MJSON_TOK_NUMBER ? 1 : 0;
 }
 
+int mjson_get_number(const char *s, int len, const char *path, double *v) {
+  struct mjson_path jp;
+  if (mjson_path_compile(path, &jp) != 0) return 0;
+  return mjson_path_get_number(s, len, &jp, v);
+}
+
 int ATTR mjson_get_bool(const char *s, int len, const char *path, int *v) {
   int tok = mjson_find(s, len, path, NULL, NULL);
   if (tok == MJSON_TOK_TRUE && v != NULL) *v = 1;
@@ -435,29 +744,163 @@ int ATTR mjson_get_bool(const char *s, int len, const char *path, int *v) {
   return tok == MJSON_TOK_TRUE || tok == MJSON_TOK_FALSE ? 1 : 0;
 }
 
-static int ATTR mjson_unescape(const char *s, int len, char *to, int n) {
-  int i, j;
-  for (i = 0, j = 0; i < len && j < n; i++, j++) {
-    if (s[i] == '\\' && i + 1 < len) {
-      int c = mjson_esc(s[i + 1], 0);
-      if (c == 0) return -1;
-      to[j] = c;
-      i++;
+static int mjson_hex4(const char *s) {
+  int i, v = 0;
+  for (i = 0; i < 4; i++) {
+    int c = (unsigned char) s[i];
+    if (c >= '0' && c <= '9') {
+      c -= '0';
+    } else if (c >= 'a' && c <= 'f') {
+      c -= 'a' - 10;
+    } else if (c >= 'A' && c <= 'F') {
+      c -= 'A' - 10;
+    } else {
+      return -1;
+    }
+    v = (v << 4) | c;
+  }
+  return v;
+}
+
+// Decodes a \uXXXX escape (or a surrogate pair) at s into UTF-8.
+// Returns the number of input bytes consumed, or -1.
+static int mjson_unescape_u(const char *s, int len, char *to, int *n) {
+  int consumed = 6;
+  long cp;
+  if (len < 6 || (cp = mjson_hex4(s + 2)) < 0) return -1;
+  if (cp >= 0xd800 && cp <= 0xdbff) {
+    int lo;
+    if (len < 12 || s[6] != '\\' || s[7] != 'u') return -1;
+    lo = mjson_hex4(s + 8);
+    if (lo < 0xdc00 || lo > 0xdfff) return -1;
+    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+    consumed = 12;
+  } else if ((cp >= 0xdc00 && cp <= 0xdfff) || cp == 0) {
+    return -1;  // lone low surrogate, or a NUL that would cut the C string
+  }
+  if (cp < 0x80) {
+    to[0] = (char) cp;
+    *n = 1;
+  } else if (cp < 0x800) {
+    to[0] = (char) (0xc0 | (cp >> 6));
+    to[1] = (char) (0x80 | (cp & 0x3f));
+    *n = 2;
+  } else if (cp < 0x10000) {
+    to[0] = (char) (0xe0 | (cp >> 12));
+    to[1] = (char) (0x80 | ((cp >> 6) & 0x3f));
+    to[2] = (char) (0x80 | (cp & 0x3f));
+    *n = 3;
+  } else {
+    to[0] = (char) (0xf0 | (cp >> 18));
+    to[1] = (char) (0x80 | ((cp >> 12) & 0x3f));
+    to[2] = (char) (0x80 | ((cp >> 6) & 0x3f));
+    to[3] = (char) (0x80 | (cp & 0x3f));
+    *n = 4;
+  }
+  return consumed;
+}
+
+// Runs between backslashes are copied at once, \uXXXX escapes are decoded
+// to UTF-8. Returns the length of the output, or -1 if the escaping is invalid
+// or the output (with its terminating NUL) doesn't fit in n bytes.
+int ATTR mjson_unescape(const char *s, int len, char *to, int n) {
+  int i = 0, j = 0;
+  while (i < len) {
+    const char *bs = (const char *) memchr(s + i, '\\', (size_t) (len - i));
+    int run = bs == NULL ? len - i : (int) (bs - (s + i));
+    if (run >= n - j) return -1;
+    memcpy(to + j, s + i, (size_t) run);
+    i += run;
+    j += run;
+    if (i >= len) break;
+    if (i + 1 >= len) return -1;
+    if (s[i + 1] == 'u') {
+      char utf8[4];
+      int k, nb, consumed = mjson_unescape_u(s + i, len - i, utf8, &nb);
+      if (consumed < 0 || nb >= n - j) return -1;
+      for (k = 0; k < nb; k++) to[j++] = utf8[k];
+      i += consumed;
     } else {
-      to[j] = s[i];
+      int c = mjson_esc(s[i + 1], 0);
+      if (c == 0 || j + 1 >= n) return -1;
+      to[j++] = (char) c;
+      i += 2;
     }
   }
   if (j >= n) return -1;
-  if (n > 0) to[j] = '\0';
+  to[j] = '\0';
   return j;
 }
 
+// Length of the leading run of ASCII bytes of s
+static int mjson_ascii_run(const char *s, int len) {
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(v);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(v);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    if (vmaxvq_u8(vld1q_u8((const uint8_t *) (s + i))) >= 0x80) break;
+  }
+#endif
+  for (; i < len; i++) {
+    if ((unsigned char) s[i] >= 0x80) break;
+  }
+  return i;
+}
+
+// Returns 1 if s is valid UTF-8: no overlong forms, surrogates or code points
+// above U+10FFFF. ASCII runs are skipped 16 or 32 bytes at a time.
+int ATTR mjson_utf8_valid(const char *s, int len) {
+  int i = 0;
+  while (i < len) {
+    unsigned char c;
+    unsigned long cp, min;
+    int k, n;
+    i += mjson_ascii_run(s + i, len - i);
+    if (i >= len) break;
+    c = (unsigned char) s[i];
+    if ((c & 0xe0) == 0xc0) {
+      n = 1, cp = c & 0x1f, min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+      n = 2, cp = c & 0x0f, min = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+      n = 3, cp = c & 0x07, min = 0x10000;
+    } else {
+      return 0;
+    }
+    if (i + n >= len) return 0;
+    for (k = 1; k <= n; k++) {
+      unsigned char cc = (unsigned char) s[i + k];
+      if ((cc & 0xc0) != 0x80) return 0;
+      cp = (cp << 6) | (cc & 0x3f);
+    }
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+
 int ATTR mjson_get_string(const char *s, int len, const char *path, char *to,
                           int n) {
   const char *p;
   int sz;
   if (mjson_find(s, len, path, &p, &sz) != MJSON_TOK_STRING) return 0;
-  return mjson_unescape(p + 1, sz - 2, to, n);
+  sz = mjson_unescape(p + 1, sz - 2, to, n);
+#if MJSON_ENABLE_UTF8_CHECK
+  if (sz > 0 && !mjson_utf8_valid(to, sz)) return -1;
+#endif
+  return sz;
 }
 
 #if MJSON_ENABLE_BASE64
@@ -508,14 +951,12 @@ int ATTR mjson_get_base64(const char *s, int len, const char *path, char *to,
 #if MJSON_ENABLE_PRINT
 int ATTR mjson_print_fixed_buf(struct mjson_out *out, const char *ptr,
                                int len) {
-  int i, left = out->u.fixed_buf.size - out->u.fixed_buf.len;
+  int left = out->u.fixed_buf.size - out->u.fixed_buf.len;
   if (left < len) {
     out->u.fixed_buf.overflow = 1;
     len = left;
   }
-  for (i = 0; i < len; i++) {
-    out->u.fixed_buf.ptr[out->u.fixed_buf.len + i] = ptr[i];
-  }
+  memcpy(out->u.fixed_buf.ptr + out->u.fixed_buf.len, ptr, len);
   out->u.fixed_buf.len += len;
   return len;
 }
@@ -542,18 +983,31 @@ int ATTR mjson_print_buf(struct mjson_out *out, const char *buf, int len) {
   return out->print(out, buf, len);
 }
 
+// Formats an integer from the right end of the buffer, no printf involved
+static int ATTR mjson_print_ulong_sign(struct mjson_out *out, unsigned long v,
+                                       int neg) {
+  char buf[24];
+  int i = sizeof(buf);
+  do {
+    buf[--i] = (char) ('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  if (neg) buf[--i] = '-';
+  return out->print(out, buf + i, sizeof(buf) - i);
+}
+
 int ATTR mjson_print_int(struct mjson_out *out, int value, int is_signed) {
-  char buf[20];
-  const char *fmt = (is_signed ? "%d" : "%u");
-  int len = snprintf(buf, sizeof(buf), fmt, value);
-  return out->print(out, buf, len);
+  if (is_signed && value < 0) {
+    return mjson_print_ulong_sign(out, 0UL - (unsigned long) (long) value, 1);
+  }
+  return mjson_print_ulong_sign(out, (unsigned int) value, 0);
 }
 
 int ATTR mjson_print_long(struct mjson_out *out, long value, int is_signed) {
-  char buf[20];
-  const char *fmt = (is_signed ? "%ld" : "%lu");
-  int len = snprintf(buf, sizeof(buf), fmt, value);
-  return out->print(out, buf, len);
+  if (is_signed && value < 0) {
+    return mjson_print_ulong_sign(out, 0UL - (unsigned long) value, 1);
+  }
+  return mjson_print_ulong_sign(out, (unsigned long) value, 0);
 }
 
 int ATTR mjson_print_dbl(struct mjson_out *out, double d, const char *fmt) {
@@ -563,16 +1017,25 @@ int ATTR mjson_print_dbl(struct mjson_out *out, double d, const char *fmt) {
 }
 
 int ATTR mjson_print_str(struct mjson_out *out, const char *s, int len) {
-  int i, n = out->print(out, "\"", 1);
+  static const char *hex = "0123456789abcdef";
+  int i, run = 0, n = out->print(out, "\"", 1);
   for (i = 0; i < len; i++) {
-    char c = mjson_esc(s[i], 1);
-    if (c) {
-      n += out->print(out, "\\", 1);
-      n += out->print(out, &c, 1);
+    unsigned char uc = (unsigned char) s[i];
+    char c;
+    // Plain characters are accumulated and written as a single run
+    if (uc >= 0x20 && uc != '"' && uc != '\\' && uc != '/') continue;
+    if (i > run) n += out->print(out, s + run, i - run);
+    run = i + 1;
+    if ((c = (char) mjson_esc(uc, 1)) != 0) {
+      char esc[2] = {'\\', c};
+      n += out->print(out, esc, sizeof(esc));
     } else {
-      n += out->print(out, &s[i], 1);
+      // Remaining control characters have no short escape form
+      char esc[6] = {'\\', 'u', '0', '0', hex[uc >> 4], hex[uc & 15]};
+      n += out->print(out, esc, sizeof(esc));
     }
   }
+  if (len > run) n += out->print(out, s + run, len - run);
   return n + out->print(out, "\"", 1);
 }
 
@@ -663,7 +1126,11 @@ int ATTR mjson_vprintf(struct mjson_out *out, const char *fmt, va_list ap) {
       }
       i++;
     } else {
-      n += mjson_print_buf(out, &fmt[i++], 1);
+      // the literal text up to the next conversion, in a single write
+      int j;
+      for (j = i + 1; fmt[j] != '\0' && fmt[j] != '%'; j++) (void) 0;
+      n += mjson_print_buf(out, &fmt[i], j - i);
+      i = j;
     }
   }
   return n;
@@ -685,7 +1152,7 @@ static inline int is_digit(int c) {
 }
 
 /* NOTE: strtod() implementation by Yasuhiro Matsumoto. */
-double ATTR strtod(const char *str, char **end) {
+static double ATTR mjson_strtod(const char *str, char **end) {
   double d = 0.0;
   int sign = 1, n = 0;
   const char *p = str, *a = str;
@@ -849,47 +1316,87 @@ void ATTR jsonrpc_return_success(struct jsonrpc_request *r,
   va_end(ap);
 }
 
-void ATTR jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, char *req, int req_sz,
-                              jsonrpc_sender_t fn, void *fndata) {
-  const char *result = NULL;
+// FNV-1a
+static unsigned ATTR jsonrpc_hash(const char *s, int len) {
+  unsigned h = 2166136261u;
+  int i;
+  for (i = 0; i < len; i++) h = (h ^ (unsigned char) s[i]) * 16777619u;
+  return h;
+}
+
+void ATTR jsonrpc_ctx_add(struct jsonrpc_ctx *ctx, struct jsonrpc_method *m) {
+  struct jsonrpc_method **b;
+  m->hash = jsonrpc_hash(m->method, m->method_sz);
+  b = &ctx->buckets[m->hash & (MJSON_RPC_HASH_SIZE - 1)];
+  m->hnext = *b;
+  *b = m;
+  m->next = ctx->methods;
+  ctx->methods = m;
+}
+
+static struct jsonrpc_method *jsonrpc_lookup(struct jsonrpc_ctx *ctx,
+                                             const char *name, int len) {
+  unsigned h = jsonrpc_hash(name, len);
+  struct jsonrpc_method *m = ctx->buckets[h & (MJSON_RPC_HASH_SIZE - 1)];
+  for (; m != NULL; m = m->hnext) {
+    if (m->hash == h && m->method_sz == len && !memcmp(m->method, name, len))
+      break;
+  }
+  return m;
+}
+
+enum { RPC_RESULT, RPC_METHOD, RPC_ID, RPC_PARAMS, RPC_NB_MEMBERS };
+
+static const struct mjson_path jsonrpc_paths[RPC_NB_MEMBERS] = {
+    {1, {MJSON_PATH_KEY("result")}},
+    {1, {MJSON_PATH_KEY("method")}},
+    {1, {MJSON_PATH_KEY("id")}},
+    {1, {MJSON_PATH_KEY("params")}},
+};
+
+void ATTR jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, const char *req,
+                              int req_sz, jsonrpc_sender_t fn, void *fndata) {
   char method[50];
-  int method_sz = 0, result_sz = 0;
+  int method_sz = 0;
   struct jsonrpc_method *m = NULL;
+  struct mjson_find_result v[RPC_NB_MEMBERS];
   struct mjson_out out = {jsonrpc_printer, {{0, 0, 0, 0}}};
   struct jsonrpc_request r = {NULL, 0, NULL, 0, &out, NULL};
 
   out.u.ptrs[0] = (void *) fn;
   out.u.ptrs[1] = (void *) fndata;
 
+  // All the members are located in a single pass
+  if (mjson_find_many(req, req_sz, jsonrpc_paths, RPC_NB_MEMBERS, v) < 0)
+    v[RPC_METHOD].tok = MJSON_TOK_INVALID;
+
   // Is is a response frame?
-  mjson_find(req, req_sz, "$.result", &result, &result_sz);
-  if (result != NULL && result_sz > 0) {
+  if (v[RPC_RESULT].ptr != NULL && v[RPC_RESULT].len > 0) {
     if (ctx->response_cb != NULL) ctx->response_cb(req, req_sz, ctx->userdata);
     return;
   }
 
   // Method must exist and must be a string
-  if ((method_sz = mjson_get_string(req, req_sz, "$.method", method,
-                                    sizeof(method))) <= 0) {
+  if (v[RPC_METHOD].tok == MJSON_TOK_STRING)
+    method_sz = mjson_unescape(v[RPC_METHOD].ptr + 1, v[RPC_METHOD].len - 2,
+                               method, sizeof(method));
+  if (method_sz <= 0) {
     jsonrpc_call(fn, fndata, "{\"error\":{\"code\":-32700,\"message\":%.*Q}}",
                  req_sz, req);
-    ctx->in_len = 0;
     return;
   }
 
   // id and params are optional
-  mjson_find(req, req_sz, "$.id", &r.id, &r.id_len);
-  mjson_find(req, req_sz, "$.params", &r.params, &r.params_len);
-
-  for (m = ctx->methods; m != NULL; m = m->next) {
-    if (m->method_sz == method_sz && !memcmp(m->method, method, method_sz)) {
-      if (r.params == NULL) r.params = "";
-      r.userdata = m->cbdata;
-      m->cb(&r);
-      break;
-    }
-  }
-  if (m == NULL) {
+  r.id = v[RPC_ID].ptr;
+  r.id_len = v[RPC_ID].len;
+  r.params = v[RPC_PARAMS].ptr;
+  r.params_len = v[RPC_PARAMS].len;
+
+  if ((m = jsonrpc_lookup(ctx, method, method_sz)) != NULL) {
+    if (r.params == NULL) r.params = "";
+    r.userdata = m->cbdata;
+    m->cb(&r);
+  } else {
     jsonrpc_return_error(&r, JSONRPC_ERROR_NOT_FOUND, "%Q", "method not found");
   }
 }
@@ -918,16 +1425,65 @@ void ATTR jsonrpc_ctx_init(struct jsonrpc_ctx *ctx,
   jsonrpc_ctx_export(ctx, "RPC.List", rpclist, ctx);
 }
 
+void ATTR jsonrpc_ctx_free(struct jsonrpc_ctx *ctx) {
+  free(ctx->in);
+  ctx->in = NULL;
+  ctx->in_len = ctx->in_size = ctx->in_discard = 0;
+}
+
+static void ATTR jsonrpc_frame(struct jsonrpc_ctx *ctx, const char *frame,
+                               int len, jsonrpc_sender_t fn, void *fndata) {
+  if (len > 1) jsonrpc_ctx_process(ctx, frame, len, fn, fndata);
+}
+
+// Appends to the partial frame, returns 0 if it would exceed the maximum size
+static int ATTR jsonrpc_append(struct jsonrpc_ctx *ctx, const char *buf,
+                               int len) {
+  if (ctx->in_len + len > ctx->in_size) {
+    int size = ctx->in_size > 0 ? ctx->in_size : MJSON_RPC_IN_BUF_SIZE;
+    char *p;
+    while (size < ctx->in_len + len) size *= 2;
+    if (size > MJSON_RPC_IN_BUF_MAX) size = MJSON_RPC_IN_BUF_MAX;
+    if (ctx->in_len + len > size) return 0;
+    if ((p = (char *) realloc(ctx->in, size)) == NULL) return 0;
+    ctx->in = p;
+    ctx->in_size = size;
+  }
+  memcpy(ctx->in + ctx->in_len, buf, len);
+  ctx->in_len += len;
+  return 1;
+}
+
+// Splits the input into newline-delimited frames. Complete frames are
+// processed in place, only a trailing partial frame is copied to ctx->in.
+void ATTR jsonrpc_ctx_process_buf(struct jsonrpc_ctx *ctx, const char *buf,
+                                  int len, jsonrpc_sender_t fn, void *fndata) {
+  while (len > 0) {
+    const char *nl = (const char *) memchr(buf, '\n', len);
+    int n = nl == NULL ? len : (int) (nl - buf);
+    if (ctx->in_discard) {
+      // Rest of an oversized frame, already reported
+    } else if (nl != NULL && ctx->in_len == 0) {
+      jsonrpc_frame(ctx, buf, n, fn, fndata);
+    } else if (!jsonrpc_append(ctx, buf, n)) {
+      jsonrpc_call(fn, fndata, "{\"error\":{\"code\":%d,\"message\":%Q}}",
+                   JSONRPC_ERROR_INVALID, "frame too long");
+      ctx->in_len = 0;
+      ctx->in_discard = 1;
+    } else if (nl != NULL) {
+      jsonrpc_frame(ctx, ctx->in, ctx->in_len, fn, fndata);
+      ctx->in_len = 0;
+    }
+    if (nl == NULL) break;
+    ctx->in_discard = 0;
+    buf = nl + 1;
+    len -= n + 1;
+  }
+}
+
 void ATTR jsonrpc_ctx_process_byte(struct jsonrpc_ctx *ctx, unsigned char ch,
                                    jsonrpc_sender_t fn, void *p) {
-  if (ctx->in_len >= (int) sizeof(ctx->in)) ctx->in_len = 0;  // Overflow
-  if (ch == '\n') {  // If new line, parse frame
-    if (ctx->in_len > 1) jsonrpc_ctx_process(ctx, ctx->in, ctx->in_len, fn, p);
-    ctx->in_len = 0;
-  } else {
-    ctx->in[ctx->in_len] = ch;  // Append to the buffer
-    ctx->in_len++;
-  }
+  jsonrpc_ctx_process_buf(ctx, (const char *) &ch, 1, fn, p);
 }
 
 void ATTR jsonrpc_init(void (*response_cb)(const char *, int, void *),
@@ -39,10 +39,26 @@
 #define MJSON_ENABLE_BASE64 1
 #endif
 
+// Reject strings that are not valid UTF-8 in mjson_get_string()
+#ifndef MJSON_ENABLE_UTF8_CHECK
+#define MJSON_ENABLE_UTF8_CHECK 1
+#endif
+
+// Initial size of the jsonrpc_ctx input buffer, it grows up to
+// MJSON_RPC_IN_BUF_MAX for longer frames
 #ifndef MJSON_RPC_IN_BUF_SIZE
 #define MJSON_RPC_IN_BUF_SIZE 256
 #endif
 
+#ifndef MJSON_RPC_IN_BUF_MAX
+#define MJSON_RPC_IN_BUF_MAX 65536
+#endif
+
+// Number of buckets of the exported methods table, must be a power of 2
+#ifndef MJSON_RPC_HASH_SIZE
+#define MJSON_RPC_HASH_SIZE 32
+#endif
+
 enum {
   MJSON_ERROR_INVALID_INPUT = -1,
   MJSON_ERROR_TOO_DEEP = -2,
@@ -61,18 +77,81 @@ enum mjson_tok {
 };
 #define MJSON_TOK_IS_VALUE(t) ((t) > 10 && (t) < 20)
 
-typedef void (*mjson_cb_t)(int ev, const char *s, int off, int len, void *ud);
+// A callback returning non-zero stops the scan, mjson() then returns the
+// offset following the current token.
+typedef int (*mjson_cb_t)(int ev, const char *s, int off, int len, void *ud);
 
 #ifndef MJSON_MAX_DEPTH
 #define MJSON_MAX_DEPTH 20
 #endif
 
 int mjson(const char *s, int len, mjson_cb_t cb, void *ud);
+
+// Resumable framing of JSON values received in arbitrary chunks, e.g. from a
+// stream socket. Only strings and nesting are tracked, so that each byte is
+// scanned once; the complete value is validated when it is parsed.
+struct mjson_stream {
+  int depth;      // Nesting depth, 0 outside of the value
+  int in_string;  // Inside a string
+  int escaped;    // Previous byte was a backslash inside a string
+  int start;      // Offset of the value since the last init, -1 before it
+  int len;        // Number of bytes consumed since the last init
+  int done;       // A complete value ends at len
+};
+
+void mjson_stream_init(struct mjson_stream *st);
+int mjson_stream_feed(struct mjson_stream *st, const char *s, int len);
 enum mjson_tok mjson_find(const char *s, int len, const char *jp,
                           const char **tokptr, int *toklen);
 int mjson_get_number(const char *s, int len, const char *path, double *v);
 int mjson_get_bool(const char *s, int len, const char *path, int *v);
 int mjson_get_string(const char *s, int len, const char *path, char *to, int n);
+int mjson_unescape(const char *s, int len, char *to, int n);
+int mjson_utf8_valid(const char *s, int len);
+
+// Precompiled JSON path, e.g. "$.params.authorizationDetails" or "$[2].id".
+// Paths known at compile time can be initialized statically with
+// MJSON_PATH_KEY() / MJSON_PATH_INDEX(), others are built once with
+// mjson_path_compile(). Keys point into the original string.
+#ifndef MJSON_PATH_MAX_SEGMENTS
+#define MJSON_PATH_MAX_SEGMENTS 8
+#endif
+
+struct mjson_path_segment {
+  const char *key;  // Object key, NULL for an array index
+  int len;          // Key length, or array index
+};
+
+struct mjson_path {
+  int nb_segments;
+  struct mjson_path_segment segments[MJSON_PATH_MAX_SEGMENTS];
+};
+
+#define MJSON_PATH_KEY(k) \
+  { (k), (int) sizeof(k) - 1 }
+#define MJSON_PATH_INDEX(i) \
+  { NULL, (i) }
+
+int mjson_path_compile(const char *jp, struct mjson_path *path);
+enum mjson_tok mjson_path_find(const char *s, int len,
+                               const struct mjson_path *path,
+                               const char **tokptr, int *toklen);
+int mjson_path_get_number(const char *s, int len,
+                          const struct mjson_path *path, double *v);
+
+// Resolves several paths in a single pass over the document.
+#ifndef MJSON_FIND_MANY_MAX
+#define MJSON_FIND_MANY_MAX 16
+#endif
+
+struct mjson_find_result {
+  int tok;          // MJSON_TOK_INVALID if the path was not found
+  const char *ptr;  // Value, including quotes for strings
+  int len;
+};
+
+int mjson_find_many(const char *s, int len, const struct mjson_path *paths,
+                    int nb_paths, struct mjson_find_result *results);
 
 #if MJSON_ENABLE_BASE64
 int mjson_get_base64(const char *s, int len, const char *path, char *to, int n);
@@ -144,42 +223,51 @@ struct jsonrpc_method {
   int method_sz;
   void (*cb)(struct jsonrpc_request *);
   void *cbdata;
-  struct jsonrpc_method *next;
+  struct jsonrpc_method *next;   // All methods, in reverse export order
+  struct jsonrpc_method *hnext;  // Methods in the same hash bucket
+  unsigned hash;
 };
 
 typedef int (*jsonrpc_sender_t)(const char *buf, int len, void *userdata);
 
 /*
  * Main RPC context, stores current request information and a list of
- * exported RPC methods.
+ * exported RPC methods, also hashed by name for the dispatch.
  */
 struct jsonrpc_ctx {
   struct jsonrpc_method *methods;
+  struct jsonrpc_method *buckets[MJSON_RPC_HASH_SIZE];
   void *userdata;
   void (*response_cb)(const char *buf, int len, void *userdata);
   int in_len;
-  char in[MJSON_RPC_IN_BUF_SIZE];
+  int in_size;
+  int in_discard;  // Skipping the rest of an oversized frame
+  char *in;        // Partial frame, allocated on demand
 };
 
 /* Registers function fn under the given name within the given RPC context */
-#define jsonrpc_ctx_export(ctx, name, fn, ud)                                \
-  do {                                                                       \
-    static struct jsonrpc_method m = {(name), sizeof(name) - 1, (fn), 0, 0}; \
-    m.cbdata = (ud);                                                         \
-    m.next = (ctx)->methods;                                                 \
-    (ctx)->methods = &m;                                                     \
+#define jsonrpc_ctx_export(ctx, name, fn, ud)                          \
+  do {                                                                 \
+    static struct jsonrpc_method m = {(name), sizeof(name) - 1, (fn)}; \
+    m.cbdata = (ud);                                                   \
+    jsonrpc_ctx_add(ctx, &m);                                          \
   } while (0)
 
+void jsonrpc_ctx_add(struct jsonrpc_ctx *ctx, struct jsonrpc_method *m);
+
 void jsonrpc_ctx_init(struct jsonrpc_ctx *ctx,
                       void (*response_cb)(const char *, int, void *),
                       void *userdata);
+void jsonrpc_ctx_free(struct jsonrpc_ctx *ctx);
 int jsonrpc_call(jsonrpc_sender_t fn, void *fndata, const char *fmt, ...);
 void jsonrpc_return_error(struct jsonrpc_request *r, int code,
                           const char *message_fmt, ...);
 void jsonrpc_return_success(struct jsonrpc_request *r, const char *result_fmt,
                             ...);
-void jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, char *req, int req_sz,
-                         jsonrpc_sender_t fn, void *fndata);
+void jsonrpc_ctx_process(struct jsonrpc_ctx *ctx, const char *req,
+                         int req_sz, jsonrpc_sender_t fn, void *fndata);
+void jsonrpc_ctx_process_buf(struct jsonrpc_ctx *ctx, const char *buf, int len,
+                             jsonrpc_sender_t fn, void *fndata);
 void jsonrpc_ctx_process_byte(struct jsonrpc_ctx *ctx, unsigned char ch,
                               jsonrpc_sender_t fn, void *fndata);
 
@@ -194,6 +282,10 @@ extern struct jsonrpc_ctx jsonrpc_default_context;
 #define jsonrpc_process_byte(x, fn, data) \
   jsonrpc_ctx_process_byte(&jsonrpc_default_context, (x), (fn), (data))
 
+#define jsonrpc_process_buf(buf, len, fn, data)                          \
+  jsonrpc_ctx_process_buf(&jsonrpc_default_context, (buf), (len), (fn), \
+                          (data))
+
 #endif /* MJSON_ENABLE_RPC */
 
 #endif /* MJSON_H_ */
@@ -1,83 +1,692 @@
 #include "ot_log.h"
 
+#include <atomic>
 #include <map>
 #include <string>
+#include <vector>
 #include <syslog.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <sys/time.h>
 
+// size of a formatted log line, longer ones are truncated
+#define OT_LOG_RECORD_SIZE 1024
+
+// bytes per line of the hex dumps, longer buffers take several lines
+#define OT_LOG_HEX_BYTES_PER_LINE 32
+
 extern "C" {
 
 using namespace std;
 
-static map<string, e_OT_LOG_LEVEL> log_levels;
+// level of a module and the call site handles sharing it
+typedef struct {
+  e_OT_LOG_LEVEL level;
+  vector<t_OT_LOG_MODULE*> handles;
+} t_OT_LOG_MODULE_LEVEL;
+
+// the levels are only read here when setting them or registering a handle, the log calls use their handle
+static map<string, t_OT_LOG_MODULE_LEVEL> log_levels;
+static pthread_mutex_t levels_mutex = PTHREAD_MUTEX_INITIALIZER;
 static e_OT_LOG_LEVEL default_level = e_OT_LOG_LEVEL_INFO;
 static bool direct_logs = true;
 
+/*
+ * Asynchronous mode: a bounded multi-producer ring (D. Vyukov's queue). Each record has a sequence number telling
+ * whose turn it is: equal to the position when it is free for a producer, position + 1 once it holds a message for
+ * the writer. A producer claims a position with a CAS on enqueue_pos and formats its message in place, so logging
+ * doesn't allocate, lock nor make any system call (the writer is only woken when it sleeps).
+ */
+typedef struct {
+  atomic<size_t> seq;
+  int syslog_level;
+  int len; // binary records only
+  bool binary; // text holds an encoded record of the binary logs
+  char text[OT_LOG_RECORD_SIZE];
+} t_OT_LOG_RECORD;
+
+static t_OT_LOG_RECORD *ring = nullptr;
+static size_t ring_mask = 0;
+static atomic<size_t> enqueue_pos(0);
+static size_t dequeue_pos = 0; // only used by the writer
+static e_OT_LOG_OVERFLOW overflow_policy = e_OT_LOG_OVERFLOW_DROP;
+
+static atomic<bool> async_logs(false);
+static atomic<int> nb_producers(0); // threads between the async_logs / binary_logs checks and their output
+static atomic<bool> writer_sleeping(false);
+static atomic<bool> writer_stop(false);
+static sem_t writer_sem;
+static pthread_t writer_thread;
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes start and stop
+
+static atomic<unsigned long long> nb_written(0);
+static atomic<unsigned long long> nb_dropped(0);
+static atomic<unsigned long long> nb_blocked(0);
+
+// binary logs, see ot_log.h for the file format
+static FILE *binary_file = nullptr;
+static atomic<bool> binary_logs(false);
+static unsigned int nb_formats = 0;
+static pthread_mutex_t formats_mutex = PTHREAD_MUTEX_INITIALIZER; // orders the format records and their ids
+static pthread_mutex_t binary_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes start and stop
+
+static void oT_Log_Set_Level_Locked(t_OT_LOG_MODULE_LEVEL *module_level, e_OT_LOG_LEVEL level) {
+  module_level->level = level;
+  for (size_t i = 0; i < module_level->handles.size(); i++)
+    __atomic_store_n(&module_level->handles[i]->level, (int) level, __ATOMIC_RELAXED);
+}
+
+static t_OT_LOG_MODULE_LEVEL* oT_Log_Find_Locked(const char *log_module) {
+  map<string, t_OT_LOG_MODULE_LEVEL>::iterator it = log_levels.find(log_module);
+  if (it == log_levels.end()) {
+    it = log_levels.insert(make_pair(string(log_module), t_OT_LOG_MODULE_LEVEL())).first;
+    it->second.level = default_level;
+  }
+  return &it->second;
+}
+
 void oT_Log_Set_Global_Level(e_OT_LOG_LEVEL level) {
+  pthread_mutex_lock(&levels_mutex);
   default_level = level;
 
-  map<string, e_OT_LOG_LEVEL>::iterator it;
+  map<string, t_OT_LOG_MODULE_LEVEL>::iterator it;
   for (it = log_levels.begin(); it != log_levels.end(); it++)
-    it->second = level;
+    oT_Log_Set_Level_Locked(&it->second, level);
+  pthread_mutex_unlock(&levels_mutex);
 }
 
 void oT_Log_Set_Module_Level(const char *log_module, e_OT_LOG_LEVEL level) {
-  log_levels[log_module] = level;
+  pthread_mutex_lock(&levels_mutex);
+  oT_Log_Set_Level_Locked(oT_Log_Find_Locked(log_module), level);
+  pthread_mutex_unlock(&levels_mutex);
 }
 
 e_OT_LOG_LEVEL oT_Log_Get_Module_Level(const char *log_module) {
-  if (log_levels.find(log_module) == log_levels.end())
-    log_levels[log_module] = default_level;
+  pthread_mutex_lock(&levels_mutex);
+  e_OT_LOG_LEVEL level = oT_Log_Find_Locked(log_module)->level;
+  pthread_mutex_unlock(&levels_mutex);
 
-  return log_levels[log_module];
+  return level;
 }
 
-void oT_Log_Write_Format_v(e_OT_LOG_LEVEL level, const char *log_module, const char *format, va_list args) {
-  // don't do anything if log is disabled
-  if (level <= 0 || level > oT_Log_Get_Module_Level(log_module))
-    return;
+static int oT_Log_Register_Module(t_OT_LOG_MODULE *module) {
+  pthread_mutex_lock(&levels_mutex);
+  // another thread may have registered the call site meanwhile
+  if (__atomic_load_n(&module->level, __ATOMIC_RELAXED) == OT_LOG_LEVEL_UNREGISTERED) {
+    t_OT_LOG_MODULE_LEVEL *module_level = oT_Log_Find_Locked(module->name);
+    module_level->handles.push_back(module);
+    __atomic_store_n(&module->level, (int) module_level->level, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&levels_mutex);
 
+  return __atomic_load_n(&module->level, __ATOMIC_RELAXED);
+}
+
+static int oT_Log_Syslog_Level(e_OT_LOG_LEVEL level) {
   // convert internal log level to syslog level
-  int syslog_level = 0;
   switch (level) {
   case 1:
-    syslog_level = LOG_ERR;
-    break;
+    return LOG_ERR;
   case 2:
-    syslog_level = LOG_WARNING;
-    break;
+    return LOG_WARNING;
   case 3:
-    syslog_level = LOG_NOTICE;
-    break;
+    return LOG_NOTICE;
   case 4:
-    syslog_level = LOG_INFO;
-    break;
+    return LOG_INFO;
   case 5:
   default:
-    syslog_level = LOG_DEBUG;
+    return LOG_DEBUG;
   }
+}
 
-  char *s_buff = (char*) malloc(1024);
+static void oT_Log_Format_Text(char *s_buff, int syslog_level, const char *format, va_list args) {
   int len = 0;
 
   struct timeval now;
 
   if (syslog_level == LOG_DEBUG) {
     gettimeofday(&now, nullptr);
-    len = snprintf(s_buff, 1024, "[%06lu]", now.tv_usec);
+    len = snprintf(s_buff, OT_LOG_RECORD_SIZE, "[%06lu]", now.tv_usec);
   }
 
-  //va_start(args, format);
-  vsnprintf(s_buff + len, 1024 - len, format, args);
+  vsnprintf(s_buff + len, OT_LOG_RECORD_SIZE - len, format, args);
+}
 
+static void oT_Log_Output(int syslog_level, const char *s_buff) {
   syslog(LOG_MAKEPRI(LOG_USER, syslog_level), "%s", s_buff);
-  //	va_end(args);
   if (direct_logs)
     printf("%s", s_buff);
-  free(s_buff);
+}
+
+int oT_Log_Next_Conversion(const char *format, t_OT_LOG_CONVERSION *out_conv) {
+  const char *p = strchr(format, '%');
+  if (p == nullptr)
+    return 0;
+
+  out_conv->start = p++;
+  out_conv->width_star = 0;
+  out_conv->precision_star = 0;
+  out_conv->precision = -1;
+  out_conv->arg = e_OT_LOG_ARG_NONE;
+
+  while (*p != '\0' && strchr("-+ #0'", *p) != nullptr)
+    p++;
+  if (*p == '*') {
+    out_conv->width_star = 1;
+    p++;
+  } else {
+    while (*p >= '0' && *p <= '9')
+      p++;
+  }
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      out_conv->precision_star = 1;
+      p++;
+    } else {
+      out_conv->precision = 0;
+      while (*p >= '0' && *p <= '9')
+        out_conv->precision = out_conv->precision * 10 + (*p++ - '0');
+    }
+  }
+
+  // length modifier
+  e_OT_LOG_ARG int_arg = e_OT_LOG_ARG_INT;
+  bool long_double = false;
+  if (p[0] == 'h') {
+    p += (p[1] == 'h') ? 2 : 1;
+  } else if (p[0] == 'l' && p[1] == 'l') {
+    int_arg = e_OT_LOG_ARG_LLONG;
+    p += 2;
+  } else if (p[0] == 'l') {
+    int_arg = e_OT_LOG_ARG_LONG;
+    p++;
+  } else if (p[0] == 'q') {
+    int_arg = e_OT_LOG_ARG_LLONG;
+    p++;
+  } else if (p[0] == 'j') {
+    int_arg = e_OT_LOG_ARG_INTMAX;
+    p++;
+  } else if (p[0] == 'z') {
+    int_arg = e_OT_LOG_ARG_SIZE;
+    p++;
+  } else if (p[0] == 't') {
+    int_arg = e_OT_LOG_ARG_PTRDIFF;
+    p++;
+  } else if (p[0] == 'L') {
+    long_double = true;
+    p++;
+  }
+
+  switch (*p) {
+  case 'd':
+  case 'i':
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+    out_conv->arg = int_arg;
+    break;
+  case 'c':
+    out_conv->arg = e_OT_LOG_ARG_INT;
+    break;
+  case 'e':
+  case 'E':
+  case 'f':
+  case 'F':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    out_conv->arg = long_double ? e_OT_LOG_ARG_LDOUBLE : e_OT_LOG_ARG_DOUBLE;
+    break;
+  case 's':
+    out_conv->arg = e_OT_LOG_ARG_STRING;
+    break;
+  case 'p':
+    out_conv->arg = e_OT_LOG_ARG_POINTER;
+    break;
+  default:
+    // "%%", or a conversion the binary logs don't record (%n, wide characters)
+    break;
+  }
+  if (*p != '\0')
+    p++;
+  out_conv->len = p - out_conv->start;
+
+  return 1;
+}
+
+static uint64_t oT_Log_Now_Us(void) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static bool oT_Log_Put(char *out, int *len, const void *data, int size) {
+  if (*len + size > OT_LOG_RECORD_SIZE)
+    return false;
+  memcpy(out + *len, data, size);
+  *len += size;
+  return true;
+}
+
+static bool oT_Log_Put_Int(char *out, int *len, int64_t value) {
+  return oT_Log_Put(out, len, &value, sizeof(value));
+}
+
+static int oT_Log_Encode_Log(char *out, unsigned int format_id, const char *format, va_list args) {
+  char type = OT_LOG_BINARY_LOG;
+  uint64_t now = oT_Log_Now_Us();
+  int len = 0;
+  oT_Log_Put(out, &len, &type, 1);
+  oT_Log_Put(out, &len, &format_id, sizeof(format_id));
+  oT_Log_Put(out, &len, &now, sizeof(now));
+  int args_off = len;
+  len += sizeof(uint16_t);
+
+  // the arguments that don't fit are left out, the decoder prints their conversion as is
+  t_OT_LOG_CONVERSION conv;
+  while (oT_Log_Next_Conversion(format, &conv)) {
+    format = conv.start + conv.len;
+    int precision = conv.precision;
+    if (conv.width_star && !oT_Log_Put_Int(out, &len, va_arg(args, int)))
+      break;
+    if (conv.precision_star) {
+      precision = va_arg(args, int);
+      if (!oT_Log_Put_Int(out, &len, precision))
+        break;
+    }
+
+    bool fits = true;
+    double d;
+    switch (conv.arg) {
+    case e_OT_LOG_ARG_NONE:
+      break;
+    case e_OT_LOG_ARG_INT:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, int));
+      break;
+    case e_OT_LOG_ARG_LONG:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, long));
+      break;
+    case e_OT_LOG_ARG_LLONG:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, long long));
+      break;
+    case e_OT_LOG_ARG_INTMAX:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, intmax_t));
+      break;
+    case e_OT_LOG_ARG_SIZE:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, size_t));
+      break;
+    case e_OT_LOG_ARG_PTRDIFF:
+      fits = oT_Log_Put_Int(out, &len, va_arg(args, ptrdiff_t));
+      break;
+    case e_OT_LOG_ARG_POINTER:
+      fits = oT_Log_Put_Int(out, &len, (intptr_t) va_arg(args, void*));
+      break;
+    case e_OT_LOG_ARG_DOUBLE:
+      d = va_arg(args, double);
+      fits = oT_Log_Put(out, &len, &d, sizeof(d));
+      break;
+    case e_OT_LOG_ARG_LDOUBLE:
+      d = va_arg(args, long double);
+      fits = oT_Log_Put(out, &len, &d, sizeof(d));
+      break;
+    case e_OT_LOG_ARG_STRING: {
+      const char *str = va_arg(args, const char*);
+      if (str == nullptr)
+        str = "(null)";
+      // strings are cut to the room left in the record
+      int room = OT_LOG_RECORD_SIZE - len - (int) sizeof(uint16_t);
+      if (room < 0) {
+        fits = false;
+        break;
+      }
+      if (precision >= 0 && precision < room)
+        room = precision;
+      uint16_t str_len = strnlen(str, room);
+      oT_Log_Put(out, &len, &str_len, sizeof(str_len));
+      oT_Log_Put(out, &len, str, str_len);
+      break;
+    }
+    }
+    if (!fits)
+      break;
+  }
+
+  uint16_t args_len = len - args_off - sizeof(uint16_t);
+  memcpy(out + args_off, &args_len, sizeof(args_len));
+  return len;
+}
+
+// record of a log without call site handle, formatted at runtime
+static int oT_Log_Encode_Text(char *out, e_OT_LOG_LEVEL level, const char *format, va_list args) {
+  char type = OT_LOG_BINARY_TEXT;
+  uint8_t log_level = level;
+  uint64_t now = oT_Log_Now_Us();
+  int len = 0;
+  oT_Log_Put(out, &len, &type, 1);
+  oT_Log_Put(out, &len, &log_level, 1);
+  oT_Log_Put(out, &len, &now, sizeof(now));
+  int text_len = vsnprintf(out + len + sizeof(uint16_t), OT_LOG_RECORD_SIZE - len - sizeof(uint16_t), format, args);
+  if (text_len < 0)
+    text_len = 0;
+  else if (text_len >= (int) (OT_LOG_RECORD_SIZE - len - sizeof(uint16_t)))
+    text_len = OT_LOG_RECORD_SIZE - len - sizeof(uint16_t) - 1;
+  uint16_t u16_len = text_len;
+  memcpy(out + len, &u16_len, sizeof(u16_len));
+  return len + sizeof(uint16_t) + text_len;
+}
+
+// writes the format record of a call site to the binary file the first time it logs there
+static unsigned int oT_Log_Define_Format(t_OT_LOG_MODULE *module, e_OT_LOG_LEVEL level, const char *format) {
+  pthread_mutex_lock(&formats_mutex);
+  unsigned int id = __atomic_load_n(&module->format_id, __ATOMIC_RELAXED);
+  if (id == 0) {
+    id = ++nb_formats;
+    char head[8];
+    int len = 0;
+    char type = OT_LOG_BINARY_FORMAT;
+    uint8_t log_level = level;
+    size_t format_len = strlen(format);
+    uint16_t u16_len = format_len > 0xffff ? 0xffff : format_len;
+    oT_Log_Put(head, &len, &type, 1);
+    oT_Log_Put(head, &len, &id, sizeof(id));
+    oT_Log_Put(head, &len, &log_level, 1);
+    oT_Log_Put(head, &len, &u16_len, sizeof(u16_len));
+    // one record for the other threads writing the file: the log writer, or the other call sites in sync mode
+    flockfile(binary_file);
+    fwrite(head, 1, len, binary_file);
+    fwrite(format, 1, u16_len, binary_file);
+    funlockfile(binary_file);
+    // the log records of this format can only be written once its record is
+    __atomic_store_n(&module->format_id, id, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&formats_mutex);
+
+  return id;
+}
+
+static void oT_Log_Encode_Record(char *out, int *out_len, e_OT_LOG_LEVEL level, t_OT_LOG_MODULE *module, const char *format, va_list args) {
+  if (module == nullptr) {
+    *out_len = oT_Log_Encode_Text(out, level, format, args);
+    return;
+  }
+
+  unsigned int id = __atomic_load_n(&module->format_id, __ATOMIC_ACQUIRE);
+  if (id == 0)
+    id = oT_Log_Define_Format(module, level, format);
+  *out_len = oT_Log_Encode_Log(out, id, format, args);
+}
+
+// claims a free record, or returns nullptr if the ring is full and the policy is to drop
+static t_OT_LOG_RECORD* oT_Log_Claim_Record(size_t *out_pos) {
+  bool blocked = false;
+  size_t pos = enqueue_pos.load(memory_order_relaxed);
+  for (;;) {
+    t_OT_LOG_RECORD *rec = &ring[pos & ring_mask];
+    intptr_t dif = (intptr_t) rec->seq.load(memory_order_acquire) - (intptr_t) pos;
+    if (dif == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+        *out_pos = pos;
+        return rec;
+      }
+    } else if (dif < 0) {
+      // full: the record still holds the message of the previous lap
+      if (overflow_policy == e_OT_LOG_OVERFLOW_DROP) {
+        nb_dropped.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+      }
+      if (!blocked) {
+        blocked = true;
+        nb_blocked.fetch_add(1, memory_order_relaxed);
+      }
+      sched_yield();
+      pos = enqueue_pos.load(memory_order_relaxed);
+    } else {
+      pos = enqueue_pos.load(memory_order_relaxed);
+    }
+  }
+}
+
+static void oT_Log_Wake_Writer(void) {
+  if (writer_sleeping.load() && writer_sleeping.exchange(false))
+    sem_post(&writer_sem);
+}
+
+// message of the logger itself, returns true if it went to the binary file
+static bool oT_Log_Write_Notice(const char *format, ...) {
+  char record[OT_LOG_RECORD_SIZE];
+  bool binary = binary_logs.load();
+  va_list args;
+  va_start(args, format);
+  if (binary) {
+    int len = oT_Log_Encode_Text(record, e_OT_LOG_LEVEL_INFO, format, args);
+    fwrite(record, 1, len, binary_file);
+  } else {
+    vsnprintf(record, sizeof(record), format, args);
+    oT_Log_Output(LOG_WARNING, record);
+  }
+  va_end(args);
+
+  return binary;
+}
+
+static void* oT_Log_Writer(void *arg) {
+  unsigned long long reported_drops = nb_dropped.load(memory_order_relaxed);
+  bool unflushed = false; // binary records written since the last flush
+
+  for (;;) {
+    t_OT_LOG_RECORD *rec = &ring[dequeue_pos & ring_mask];
+    if (rec->seq.load(memory_order_acquire) == dequeue_pos + 1) {
+      if (rec->binary) {
+        fwrite(rec->text, 1, rec->len, binary_file);
+        unflushed = true;
+      } else {
+        oT_Log_Output(rec->syslog_level, rec->text);
+      }
+      // free for the producers of the next lap
+      rec->seq.store(dequeue_pos + ring_mask + 1, memory_order_release);
+      dequeue_pos++;
+      nb_written.fetch_add(1, memory_order_relaxed);
+      continue;
+    }
+
+    // the ring is empty, report the records lost since the last time it was
+    unsigned long long drops = nb_dropped.load(memory_order_relaxed);
+    if (drops != reported_drops) {
+      if (oT_Log_Write_Notice("%llu log records dropped\n", drops - reported_drops))
+        unflushed = true;
+      reported_drops = drops;
+    }
+
+    if (unflushed) {
+      fflush(binary_file);
+      unflushed = false;
+    }
+
+    // stop is only requested once no producer can publish anymore
+    if (writer_stop.load())
+      break;
+
+    writer_sleeping.store(true);
+    if (rec->seq.load() == dequeue_pos + 1 || writer_stop.load()) {
+      writer_sleeping.store(false);
+      continue;
+    }
+    sem_wait(&writer_sem);
+    writer_sleeping.store(false);
+  }
+
+  if (unflushed)
+    fflush(binary_file);
+  if (direct_logs)
+    fflush(stdout);
+  return nullptr;
+}
+
+int oT_Log_Start_Async(unsigned int nb_records, e_OT_LOG_OVERFLOW overflow) {
+  int ret = 0;
+
+  pthread_mutex_lock(&async_mutex);
+  if (!async_logs.load()) {
+    if (ring == nullptr) {
+      size_t size = 2;
+      while (size < nb_records)
+        size <<= 1;
+      ring = (t_OT_LOG_RECORD*) malloc(size * sizeof(t_OT_LOG_RECORD));
+      if (ring != nullptr) {
+        for (size_t i = 0; i < size; i++)
+          ring[i].seq.store(i, memory_order_relaxed);
+        ring_mask = size - 1;
+        sem_init(&writer_sem, 0, 0);
+      }
+    }
+
+    if (ring == nullptr) {
+      ret = -1;
+    } else {
+      overflow_policy = overflow;
+      writer_stop.store(false);
+      if (pthread_create(&writer_thread, nullptr, oT_Log_Writer, nullptr) != 0)
+        ret = -1;
+      else
+        async_logs.store(true);
+    }
+  }
+  pthread_mutex_unlock(&async_mutex);
+
+  return ret;
+}
+
+void oT_Log_Stop_Async(void) {
+  pthread_mutex_lock(&async_mutex);
+  if (async_logs.load()) {
+    async_logs.store(false);
+    // wait for the producers that saw the async mode to publish their record
+    while (nb_producers.load() != 0)
+      sched_yield();
+
+    writer_stop.store(true);
+    sem_post(&writer_sem);
+    pthread_join(writer_thread, nullptr);
+  }
+  pthread_mutex_unlock(&async_mutex);
+}
+
+void oT_Log_Get_Async_Stats(t_OT_LOG_ASYNC_STATS *out_stats) {
+  out_stats->written = nb_written.load(memory_order_relaxed);
+  out_stats->dropped = nb_dropped.load(memory_order_relaxed);
+  out_stats->blocked = nb_blocked.load(memory_order_relaxed);
+}
+
+int oT_Log_Start_Binary(const char *path) {
+  oT_Log_Stop_Binary();
+
+  pthread_mutex_lock(&binary_mutex);
+  binary_file = fopen(path, "wb");
+  if (binary_file == nullptr) {
+    pthread_mutex_unlock(&binary_mutex);
+    return -1;
+  }
+  fwrite(OT_LOG_BINARY_MAGIC, 1, strlen(OT_LOG_BINARY_MAGIC), binary_file);
+  binary_logs.store(true);
+  pthread_mutex_unlock(&binary_mutex);
 
+  return 0;
+}
+
+void oT_Log_Stop_Binary(void) {
+  pthread_mutex_lock(&binary_mutex);
+  if (binary_file != nullptr) {
+    binary_logs.store(false);
+    while (nb_producers.load() != 0)
+      sched_yield();
+
+    // the writer may still hold binary records: restarting it drains them
+    pthread_mutex_lock(&async_mutex);
+    bool restart = async_logs.load();
+    pthread_mutex_unlock(&async_mutex);
+    if (restart) {
+      oT_Log_Stop_Async();
+      oT_Log_Start_Async(0, overflow_policy);
+    }
+
+    fclose(binary_file);
+    binary_file = nullptr;
+
+    // the format ids are per file
+    pthread_mutex_lock(&levels_mutex);
+    map<string, t_OT_LOG_MODULE_LEVEL>::iterator it;
+    for (it = log_levels.begin(); it != log_levels.end(); it++) {
+      for (size_t i = 0; i < it->second.handles.size(); i++)
+        __atomic_store_n(&it->second.handles[i]->format_id, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&levels_mutex);
+    nb_formats = 0;
+  }
+  pthread_mutex_unlock(&binary_mutex);
+}
+
+static void oT_Log_Write_Enabled_v(e_OT_LOG_LEVEL level, t_OT_LOG_MODULE *module, const char *format, va_list args) {
+  int syslog_level = oT_Log_Syslog_Level(level);
+
+  nb_producers.fetch_add(1);
+  bool binary = binary_logs.load();
+  if (async_logs.load()) {
+    size_t pos;
+    t_OT_LOG_RECORD *rec = oT_Log_Claim_Record(&pos);
+    if (rec != nullptr) {
+      rec->syslog_level = syslog_level;
+      rec->binary = binary;
+      if (binary)
+        oT_Log_Encode_Record(rec->text, &rec->len, level, module, format, args);
+      else
+        oT_Log_Format_Text(rec->text, syslog_level, format, args);
+      rec->seq.store(pos + 1);
+      oT_Log_Wake_Writer();
+    }
+  } else if (binary) {
+    char record[OT_LOG_RECORD_SIZE];
+    int len;
+    oT_Log_Encode_Record(record, &len, level, module, format, args);
+    fwrite(record, 1, len, binary_file);
+    // the errors must survive a crash that follows them
+    if (level <= e_OT_LOG_LEVEL_ERROR)
+      fflush(binary_file);
+  } else {
+    char s_buff[OT_LOG_RECORD_SIZE];
+    oT_Log_Format_Text(s_buff, syslog_level, format, args);
+    oT_Log_Output(syslog_level, s_buff);
+  }
+  nb_producers.fetch_sub(1);
+}
+
+void oT_Log_Write_Format_v(e_OT_LOG_LEVEL level, const char *log_module, const char *format, va_list args) {
+  // don't do anything if log is disabled
+  if (level <= 0 || level > oT_Log_Get_Module_Level(log_module))
+    return;
+
+  oT_Log_Write_Enabled_v(level, nullptr, format, args);
+}
+
+void oT_Log_Write_Module(e_OT_LOG_LEVEL level, t_OT_LOG_MODULE *module, const char *format, ...) {
+  int module_level = __atomic_load_n(&module->level, __ATOMIC_RELAXED);
+  if (module_level == OT_LOG_LEVEL_UNREGISTERED)
+    module_level = oT_Log_Register_Module(module);
+  if (level <= 0 || level > module_level)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  oT_Log_Write_Enabled_v(level, module, format, args);
+  va_end(args);
 }
 
 void oT_Log_Write_Format(e_OT_LOG_LEVEL level, const char *log_module, const char *format, ...) {
@@ -87,6 +696,39 @@ void oT_Log_Write_Format(e_OT_LOG_LEVEL level, const char *log_module, const cha
   va_end(args);
 }
 
+// writes a line already built by the caller
+static void oT_Log_Write_Line(e_OT_LOG_LEVEL level, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  oT_Log_Write_Enabled_v(level, nullptr, format, args);
+  va_end(args);
+}
+
+/*
+ * Dumps nb_values bytes as "XX " in lines of OT_LOG_HEX_BYTES_PER_LINE, the lines are built in the same stack buffer
+ * with a nibble table. With nine_bits, the buffer holds pairs of (9th bit, byte) and a set 9th bit is shown as "XX'".
+ */
+static void oT_Log_Write_Hex_Lines(e_OT_LOG_LEVEL level, const unsigned char *buf, unsigned int nb_values, bool nine_bits) {
+  static const char hex_digits[] = "0123456789ABCDEF";
+  char line[OT_LOG_HEX_BYTES_PER_LINE * 3];
+
+  for (unsigned int start = 0; start < nb_values; start += OT_LOG_HEX_BYTES_PER_LINE) {
+    unsigned int end = start + OT_LOG_HEX_BYTES_PER_LINE;
+    if (end > nb_values)
+      end = nb_values;
+
+    char *p = line;
+    for (unsigned int i = start; i < end; i++) {
+      unsigned char value = nine_bits ? buf[2 * i + 1] : buf[i];
+      p[0] = hex_digits[value >> 4];
+      p[1] = hex_digits[value & 0x0f];
+      p[2] = (nine_bits && buf[2 * i] == 1) ? '\'' : ' ';
+      p += 3;
+    }
+    oT_Log_Write_Line(level, "  %.*s\n", (int) (p - line), line);
+  }
+}
+
 void oT_Log_Write_Hex_Buf(e_OT_LOG_LEVEL level, const char *log_module, unsigned char *buf, unsigned int len, const char *format, ...) {
   if (level <= 0 || level > oT_Log_Get_Module_Level(log_module))
     return;
@@ -94,16 +736,11 @@ void oT_Log_Write_Hex_Buf(e_OT_LOG_LEVEL level, const char *log_module, unsigned
   // first log the regular message
   va_list args;
   va_start(args, format);
-  oT_Log_Write_Format_v(level, log_module, format, args);
+  oT_Log_Write_Enabled_v(level, nullptr, format, args);
   va_end(args);
 
   // now log the buffer
-  uint s_len = len * 3;
-  char *s_buf = (char*) malloc(s_len + 1);
-  for (uint i = 0; i < len; i++)
-    sprintf(s_buf + 3 * i, "%02X ", buf[i]);
-  oT_Log_Write_Format(level, log_module, "  %s\n", s_buf);
-  free(s_buf);
+  oT_Log_Write_Hex_Lines(level, buf, len, false);
 }
 
 void oT_Log_Write_9bit_Hex_Buf(e_OT_LOG_LEVEL level, const char *log_module, unsigned char *buf, unsigned int len, const char *format, ...) {
@@ -113,20 +750,11 @@ void oT_Log_Write_9bit_Hex_Buf(e_OT_LOG_LEVEL level, const char *log_module, uns
   // first log the regular message
   va_list args;
   va_start(args, format);
-  oT_Log_Write_Format_v(level, log_module, format, args);
+  oT_Log_Write_Enabled_v(level, nullptr, format, args);
   va_end(args);
 
   // now log the buffer
-  uint s_len = (len / 2) * 3;
-  char *s_buf = (char*) malloc(s_len + 1);
-  for (uint i = 0; i < (len / 2); i++) {
-    if (buf[2 * i] == 1)
-      sprintf(s_buf + 3 * i, "%02X'", buf[2 * i + 1]);
-    else
-      sprintf(s_buf + 3 * i, "%02X ", buf[2 * i + 1]);
-  }
-  oT_Log_Write_Format(level, log_module, "  %s\n", s_buf);
-  free(s_buf);
+  oT_Log_Write_Hex_Lines(level, buf, len / 2, true);
 }
 
 }
@@ -15,18 +15,112 @@ extern "C" {
     e_OT_LOG_LEVEL_DEEP_DEBUG,
   } e_OT_LOG_LEVEL;
 
+  // level of a module handle that isn't registered yet, it lets the first log through to oT_Log_Write_Module()
+#define OT_LOG_LEVEL_UNREGISTERED 0x7fffffff
+
+  /*
+   * Module handle of a log call site, registered by its first log. The level is a copy of the module level, updated by
+   * oT_Log_Set_Module_Level() and oT_Log_Set_Global_Level(), so that a disabled log costs a single load and compare.
+   */
+  typedef struct {
+    const char* name;
+    int level; // accessed atomically
+    unsigned int format_id; // id of the format in the binary logs, 0 until it is recorded there
+  } t_OT_LOG_MODULE;
+
+  // what a logging thread does when the asynchronous ring is full
+  typedef enum {
+    e_OT_LOG_OVERFLOW_DROP, // the record is dropped and counted, logging never waits
+    e_OT_LOG_OVERFLOW_BLOCK, // the thread waits for the writer to make room, no record is lost
+  } e_OT_LOG_OVERFLOW;
+
+  typedef struct {
+    unsigned long long written; // records written by the writer thread
+    unsigned long long dropped; // records dropped because the ring was full
+    unsigned long long blocked; // records that waited for room in the ring
+  } t_OT_LOG_ASYNC_STATS;
+
+  /*
+   * Binary logs: the arguments of the logs are recorded without formatting them, in a file decoded offline by
+   * otiKioskLogDecode. The integers are in the byte order of the writer:
+   *   file header: OT_LOG_BINARY_MAGIC
+   *   format record: 'F', u32 id, u8 level, u16 length, format
+   *   log record: 'L', u32 format id, u64 time (us), u16 length, arguments
+   *   text record: 'T', u8 level, u64 time (us), u16 length, text (logs without a call site handle)
+   * Each argument is encoded as a 64-bit integer, a double, or a u16 length and the bytes of a string, following the
+   * conversions of the format (see oT_Log_Next_Conversion()). The '*' width and precision are integers.
+   */
+#define OT_LOG_BINARY_MAGIC "OTLOGB01"
+#define OT_LOG_BINARY_FORMAT 'F'
+#define OT_LOG_BINARY_LOG 'L'
+#define OT_LOG_BINARY_TEXT 'T'
+
+  // argument of a printf conversion, as read by va_arg()
+  typedef enum {
+    e_OT_LOG_ARG_NONE, // "%%" or unsupported conversion
+    e_OT_LOG_ARG_INT,
+    e_OT_LOG_ARG_LONG,
+    e_OT_LOG_ARG_LLONG,
+    e_OT_LOG_ARG_INTMAX,
+    e_OT_LOG_ARG_SIZE,
+    e_OT_LOG_ARG_PTRDIFF,
+    e_OT_LOG_ARG_DOUBLE,
+    e_OT_LOG_ARG_LDOUBLE,
+    e_OT_LOG_ARG_STRING,
+    e_OT_LOG_ARG_POINTER,
+  } e_OT_LOG_ARG;
+
+  typedef struct {
+    const char* start; // the '%'
+    int len; // length of the conversion, up to its conversion character included
+    int width_star; // the width is an int argument
+    int precision_star; // the precision is an int argument
+    int precision; // literal precision, -1 if absent
+    e_OT_LOG_ARG arg;
+  } t_OT_LOG_CONVERSION;
+
+  // finds the first conversion of a printf format, returns 0 if there is none
+  int oT_Log_Next_Conversion(const char* format, t_OT_LOG_CONVERSION* out_conv);
+
   void oT_Log_Write_Format(e_OT_LOG_LEVEL level, const char* log_module, const char* format, ...);
+  void oT_Log_Write_Module(e_OT_LOG_LEVEL level, t_OT_LOG_MODULE* module, const char* format, ...);
   void oT_Log_Write_Hex_Buf(e_OT_LOG_LEVEL level, const char* log_module, unsigned char* buf, unsigned int len, const char* format, ...);
   void oT_Log_Write_9bit_Hex_Buf(e_OT_LOG_LEVEL level, const char* log_module, unsigned char* buf, unsigned int len, const char* format, ...);
   void oT_Log_Set_Global_Level(e_OT_LOG_LEVEL level);
   void oT_Log_Set_Module_Level(const char* log_module, e_OT_LOG_LEVEL level);
   e_OT_LOG_LEVEL oT_Log_Get_Module_Level(const char* log_module);
 
+  /*
+   * Asynchronous mode: the logging threads only format the message into a preallocated record of a lock-free ring,
+   * and a background thread writes the records to syslog and stdout. The ring of nb_records (rounded up to a power
+   * of 2) is allocated by the first start and kept for later ones. Returns 0, or -1 on failure, the logs then stay
+   * synchronous.
+   */
+  int oT_Log_Start_Async(unsigned int nb_records, e_OT_LOG_OVERFLOW overflow);
+  // writes the pending records and goes back to synchronous logs
+  void oT_Log_Stop_Async(void);
+  void oT_Log_Get_Async_Stats(t_OT_LOG_ASYNC_STATS* out_stats);
+
+  /*
+   * Writes the logs to a new binary file instead of syslog and stdout. In synchronous mode the file is buffered by
+   * stdio and flushed after each error, in asynchronous mode the writer flushes it whenever the ring is empty.
+   * Returns 0, or -1 if the file can't be created.
+   */
+  int oT_Log_Start_Binary(const char* path);
+  // closes the binary file and goes back to syslog and stdout
+  void oT_Log_Stop_Binary(void);
+
   // some helper macros
-#define OT_LOG_ERROR(module, format, ...) oT_Log_Write_Format(e_OT_LOG_LEVEL_ERROR, module, "["module"] ERR %s:%d %s() : " format,__FILE__,__LINE__, __FUNCTION__, ##__VA_ARGS__)
-#define OT_LOG_INFO(module, format, ...) oT_Log_Write_Format(e_OT_LOG_LEVEL_INFO, module, "["module"] INF : " format, ##__VA_ARGS__)
-#define OT_LOG_DEBUG(module, format, ...) oT_Log_Write_Format(e_OT_LOG_LEVEL_DEBUG, module, "["module"] DBG : " format, ##__VA_ARGS__)
-#define OT_LOG_DDEBUG(module, format, ...) oT_Log_Write_Format(e_OT_LOG_LEVEL_DEEP_DEBUG, module, "["module"] DBG %s:%d %s() : " format,__FILE__,__LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define OT_LOG_WRITE(log_level, log_module, format, ...) do { \
+    static t_OT_LOG_MODULE _ot_log_module = { log_module, OT_LOG_LEVEL_UNREGISTERED, 0 }; \
+    if ((log_level) <= __atomic_load_n(&_ot_log_module.level, __ATOMIC_RELAXED)) \
+      oT_Log_Write_Module(log_level, &_ot_log_module, format, ##__VA_ARGS__); \
+  } while (0)
+
+#define OT_LOG_ERROR(module, format, ...) OT_LOG_WRITE(e_OT_LOG_LEVEL_ERROR, module, "["module"] ERR %s:%d %s() : " format,__FILE__,__LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define OT_LOG_INFO(module, format, ...) OT_LOG_WRITE(e_OT_LOG_LEVEL_INFO, module, "["module"] INF : " format, ##__VA_ARGS__)
+#define OT_LOG_DEBUG(module, format, ...) OT_LOG_WRITE(e_OT_LOG_LEVEL_DEBUG, module, "["module"] DBG : " format, ##__VA_ARGS__)
+#define OT_LOG_DDEBUG(module, format, ...) OT_LOG_WRITE(e_OT_LOG_LEVEL_DEEP_DEBUG, module, "["module"] DBG %s:%d %s() : " format,__FILE__,__LINE__, __FUNCTION__, ##__VA_ARGS__)
 
 
 #ifdef __cplusplus
@@ -0,0 +1,277 @@
+/*
+ * otiKioskLogDecode.c
+ *
+ * Renders the binary logs of libotikiosk (see LibOtiKiosk_Enable_Binary_Logs()) as the text the library would have
+ * logged: each log record is formatted with the format record of its call site.
+ *
+ * usage: otiKioskLogDecode [-t] <file>
+ *   -t  prefix every log with its date and time
+ *
+ * The file must come from a machine with the same byte order. A file cut in the middle of a record (the writer
+ * crashed or is still writing) is rendered up to the last complete record.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ot_log.h"
+
+// format record of a call site, indexed by format id
+typedef struct {
+  char* text;
+  uint8_t level;
+} format_entry;
+
+static format_entry* _formats = NULL;
+static unsigned int _nb_formats = 0;
+static bool _print_time = false;
+
+typedef struct {
+  const uint8_t* buf;
+  size_t len;
+  size_t off;
+} reader;
+
+static bool _read(reader* r, void* out, size_t size) {
+  if(r->len - r->off < size)
+    return false;
+  memcpy(out, r->buf + r->off, size);
+  r->off += size;
+  return true;
+}
+
+static uint8_t* _load_file(const char* path, size_t* out_len) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL)
+    return NULL;
+
+  size_t size = 1 << 16;
+  size_t len = 0;
+  uint8_t* buf = malloc(size);
+  size_t n;
+  while(buf != NULL && (n = fread(buf + len, 1, size - len, f)) > 0) {
+    len += n;
+    if(len == size) {
+      size *= 2;
+      uint8_t* grown = realloc(buf, size);
+      if(grown == NULL)
+        free(buf);
+      buf = grown;
+    }
+  }
+  fclose(f);
+
+  *out_len = len;
+  return buf;
+}
+
+static bool _define_format(unsigned int id, uint8_t level, const uint8_t* text, uint16_t len) {
+  if(id >= _nb_formats) {
+    unsigned int nb = (id + 1) * 2;
+    format_entry* grown = realloc(_formats, nb * sizeof(format_entry));
+    if(grown == NULL)
+      return false;
+    memset(grown + _nb_formats, 0, (nb - _nb_formats) * sizeof(format_entry));
+    _formats = grown;
+    _nb_formats = nb;
+  }
+
+  free(_formats[id].text);
+  _formats[id].text = malloc(len + 1);
+  if(_formats[id].text == NULL)
+    return false;
+  memcpy(_formats[id].text, text, len);
+  _formats[id].text[len] = '\0';
+  _formats[id].level = level;
+  return true;
+}
+
+// same prefix as the text logs
+static void _print_prefix(uint8_t level, uint64_t time_us) {
+  if(_print_time) {
+    time_t seconds = time_us / 1000000;
+    struct tm tm;
+    char date[32];
+    localtime_r(&seconds, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06u ", date, (unsigned int) (time_us % 1000000));
+  }
+  if(level >= e_OT_LOG_LEVEL_DEBUG)
+    printf("[%06u]", (unsigned int) (time_us % 1000000));
+}
+
+#define _PRINT_ARG(value) do { \
+    if(nb_stars == 0) printf(spec, value); \
+    else if(nb_stars == 1) printf(spec, stars[0], value); \
+    else printf(spec, stars[0], stars[1], value); \
+  } while(0)
+
+static void _render(const char* format, reader* args) {
+  static char str[0x10000];
+  t_OT_LOG_CONVERSION conv;
+  bool missing = false;
+
+  while(oT_Log_Next_Conversion(format, &conv)) {
+    fwrite(format, 1, conv.start - format, stdout);
+    format = conv.start + conv.len;
+
+    char spec[64];
+    if(conv.len == 2 && conv.start[1] == '%') {
+      putchar('%');
+      continue;
+    }
+    if(conv.arg == e_OT_LOG_ARG_NONE)
+      continue;
+    if(missing || conv.len >= (int) sizeof(spec)) {
+      fwrite(conv.start, 1, conv.len, stdout);
+      continue;
+    }
+    memcpy(spec, conv.start, conv.len);
+    spec[conv.len] = '\0';
+
+    // the arguments that didn't fit in the record are left as their conversion
+    int stars[2];
+    int nb_stars = 0;
+    int64_t star = 0;
+    for(int i = 0; i < conv.width_star + conv.precision_star; i++) {
+      if(!_read(args, &star, sizeof(star)))
+        missing = true;
+      stars[nb_stars++] = (int) star;
+    }
+
+    int64_t i64 = 0;
+    double d = 0;
+    uint16_t str_len = 0;
+    switch(conv.arg) {
+    case e_OT_LOG_ARG_DOUBLE:
+    case e_OT_LOG_ARG_LDOUBLE:
+      missing = missing || !_read(args, &d, sizeof(d));
+      break;
+    case e_OT_LOG_ARG_STRING:
+      missing = missing || !_read(args, &str_len, sizeof(str_len)) || !_read(args, str, str_len);
+      str[str_len] = '\0';
+      break;
+    default:
+      missing = missing || !_read(args, &i64, sizeof(i64));
+      break;
+    }
+    if(missing) {
+      fwrite(conv.start, 1, conv.len, stdout);
+      continue;
+    }
+
+    switch(conv.arg) {
+    case e_OT_LOG_ARG_INT: _PRINT_ARG((int) i64); break;
+    case e_OT_LOG_ARG_LONG: _PRINT_ARG((long) i64); break;
+    case e_OT_LOG_ARG_LLONG: _PRINT_ARG((long long) i64); break;
+    case e_OT_LOG_ARG_INTMAX: _PRINT_ARG((intmax_t) i64); break;
+    case e_OT_LOG_ARG_SIZE: _PRINT_ARG((size_t) i64); break;
+    case e_OT_LOG_ARG_PTRDIFF: _PRINT_ARG((ptrdiff_t) i64); break;
+    case e_OT_LOG_ARG_POINTER: _PRINT_ARG((void*) (intptr_t) i64); break;
+    case e_OT_LOG_ARG_DOUBLE: _PRINT_ARG(d); break;
+    case e_OT_LOG_ARG_LDOUBLE: _PRINT_ARG((long double) d); break;
+    case e_OT_LOG_ARG_STRING: _PRINT_ARG(str); break;
+    default: break;
+    }
+  }
+  fputs(format, stdout);
+}
+
+static bool _decode_record(reader* r) {
+  char type;
+  unsigned int id;
+  uint8_t level;
+  uint64_t time_us;
+  uint16_t len;
+
+  if(!_read(r, &type, 1))
+    return false;
+
+  switch(type) {
+  case OT_LOG_BINARY_FORMAT:
+    if(!_read(r, &id, sizeof(id)) || !_read(r, &level, 1) || !_read(r, &len, sizeof(len)) || r->len - r->off < len)
+      return false;
+    if(!_define_format(id, level, r->buf + r->off, len)) {
+      fprintf(stderr, "out of memory\n");
+      return false;
+    }
+    r->off += len;
+    return true;
+
+  case OT_LOG_BINARY_LOG: {
+    if(!_read(r, &id, sizeof(id)) || !_read(r, &time_us, sizeof(time_us)) || !_read(r, &len, sizeof(len)) || r->len - r->off < len)
+      return false;
+    reader args = { r->buf + r->off, len, 0 };
+    r->off += len;
+    if(id >= _nb_formats || _formats[id].text == NULL) {
+      printf("<log of unknown format %u>\n", id);
+      return true;
+    }
+    _print_prefix(_formats[id].level, time_us);
+    _render(_formats[id].text, &args);
+    return true;
+  }
+
+  case OT_LOG_BINARY_TEXT:
+    if(!_read(r, &level, 1) || !_read(r, &time_us, sizeof(time_us)) || !_read(r, &len, sizeof(len)) || r->len - r->off < len)
+      return false;
+    _print_prefix(level, time_us);
+    fwrite(r->buf + r->off, 1, len, stdout);
+    r->off += len;
+    return true;
+
+  default:
+    fprintf(stderr, "invalid record type 0x%02x at offset %zu\n", (uint8_t) type, r->off - 1);
+    return false;
+  }
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-t] <file>\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  int opt;
+
+  while((opt = getopt(argc, argv, "t")) != -1) {
+    switch(opt) {
+    case 't': _print_time = true; break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if(optind != argc - 1) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  reader r = { NULL, 0, 0 };
+  uint8_t* buf = _load_file(argv[optind], &r.len);
+  if(buf == NULL) {
+    fprintf(stderr, "failed to read %s\n", argv[optind]);
+    return 1;
+  }
+  r.buf = buf;
+
+  size_t magic_len = strlen(OT_LOG_BINARY_MAGIC);
+  if(r.len < magic_len || memcmp(r.buf, OT_LOG_BINARY_MAGIC, magic_len) != 0) {
+    fprintf(stderr, "%s is not a binary log file\n", argv[optind]);
+    free(buf);
+    return 1;
+  }
+  r.off = magic_len;
+
+  while(r.off < r.len && _decode_record(&r))
+    ;
+  if(r.off < r.len)
+    fprintf(stderr, "stopped at offset %zu of %zu\n", r.off, r.len);
+
+  free(buf);
+  return 0;
+}
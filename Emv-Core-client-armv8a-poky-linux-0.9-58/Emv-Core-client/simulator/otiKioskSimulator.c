@@ -0,0 +1,695 @@
+/*
+ * otiKioskSimulator.c
+ *
+ * Local stand-in for the Kiosk Core daemon, to run and measure the library without a reader.
+ * The JSON-RPC methods sent by libotikiosk are served with the mjson RPC code, and each payment
+ * plays a script of ReaderMessageEvent / TransactionComplete events.
+ *
+ * usage: otiKioskSimulator [options]
+ *   -u <dir>      listen on <dir>/socket_cmd and <dir>/socket_events
+ *   -t <address>  listen on TCP instead, e.g. 127.0.0.1
+ *   -c <port>     TCP commands port (default 10000)
+ *   -e <port>     TCP events port (default 10001)
+ *   -s <file>     transaction script, see below
+ *   -l <ms>       latency added to every response
+ *   -r <rate>     maximum number of messages sent per second, 0 for no limit
+ *   -S <status>   GetStatus result when no transaction is running (default Ready)
+ *   -v            print the messages
+ *
+ * The script is a JSON array of steps played after each PayTransaction / PreAuthorize, the delays
+ * are relative to the previous step:
+ *   [{"delay": 200, "method": "ReaderMessageEvent", "params": {"index": 1, "line1": "Present card", "line2": ""}},
+ *    {"delay": 500, "method": "TransactionComplete", "params": {"status": "OK", "errorCode": 0}}]
+ * ReaderMessageEvent params are sent as-is to all the events clients. TransactionComplete goes to the
+ * commands client that started the transaction, with authorizationDetails built from the requested
+ * amount unless the script provides them. The transaction ends with the script; like a Kiosk Core,
+ * the simulator runs a single transaction at a time, whichever commands client asks.
+ *
+ * Requests can also be MessagePack (see kiosk_msgpack.h): the responses and the TransactionComplete events
+ * follow the encoding of the client's last request, and the ReaderMessageEvents the encoding of the last
+ * request of any client, since the events clients never send anything.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "src/mjson.h"
+#include "src/kiosk_msgpack.h"
+#include "src/kiosk_schema.h"
+
+#define SIM_MAX_CLIENTS 16
+#define SIM_MAX_STEPS 32
+#define SIM_IN_BUF_SIZE 4096
+
+// played when no script is given
+static const char _default_script[] =
+  "[{\"delay\": 100, \"method\": \"ReaderMessageEvent\", \"params\": {\"index\": 1, \"line1\": \"Present card\", \"line2\": \"\"}},"
+  " {\"delay\": 200, \"method\": \"ReaderMessageEvent\", \"params\": {\"index\": 2, \"line1\": \"Processing\", \"line2\": \"\"}},"
+  " {\"delay\": 200, \"method\": \"TransactionComplete\", \"params\": {\"status\": \"OK\", \"errorDescription\": \"\", \"errorCode\": 0}}]";
+
+typedef struct {
+  int delay_ms;
+  bool complete; // TransactionComplete, ReaderMessageEvent otherwise
+  const char* params; // JSON object, in the script buffer
+  int params_len;
+} SimStep;
+
+typedef struct {
+  int fd; // -1 when the slot is free
+  bool is_commands;
+  struct msgpack_framer framer;
+  char in[SIM_IN_BUF_SIZE];
+  bool binary; // last request was MessagePack
+} SimClient;
+
+// message waiting for its latency or for the rate limit
+typedef struct SimMsg {
+  struct SimMsg* next;
+  SimClient* client;
+  uint64_t due_us;
+  int len;
+  char data[];
+} SimMsg;
+
+static struct {
+  bool verbose;
+  unsigned int latency_ms;
+  unsigned int rate;
+  const char* status;
+} _config = {false, 0, 0, "Ready"};
+
+static struct {
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t events;
+  uint64_t transactions;
+  uint64_t acks;
+} _stats;
+
+static volatile sig_atomic_t _running = 1;
+static SimClient _clients[SIM_MAX_CLIENTS];
+static SimStep _steps[SIM_MAX_STEPS];
+static int _nb_steps;
+static SimMsg* _queue; // sorted by due time
+static uint64_t _next_send_us; // rate limit
+static int _next_event_id = 1000;
+static bool _events_binary; // encoding of the ReaderMessageEvents
+
+// transaction in progress: like a Kiosk Core, the simulator has a single reader shared by all its clients
+static struct {
+  SimClient* client; // commands client that started it, NULL when no transaction is running
+  int step;
+  uint64_t step_due_us;
+  uint32_t amount_cents;
+} _transaction;
+
+static struct jsonrpc_ctx _rpc;
+static SimClient* _current; // client whose request is being processed
+static char* _reply; // response being built for _current
+static int _reply_len;
+
+static uint64_t _now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void _sig_handler(int sig) {
+  _running = 0;
+}
+
+static void _enqueue(SimClient* c, const char* data, int len, uint64_t due_us) {
+  SimMsg* msg = malloc(sizeof(SimMsg) + len);
+  if(msg == NULL) {
+    fprintf(stderr, "failed to allocate %d bytes\n", len);
+    return;
+  }
+  msg->client = c;
+  msg->due_us = due_us;
+  msg->len = len;
+  memcpy(msg->data, data, len);
+
+  SimMsg** p = &_queue;
+  while(*p != NULL && (*p)->due_us <= due_us)
+    p = &(*p)->next;
+  msg->next = *p;
+  *p = msg;
+}
+
+// queues a JSON message, converted to MessagePack for the clients that use it
+static void _enqueue_encoded(SimClient* c, const char* json, int len, uint64_t due_us, bool binary) {
+  if(!binary) {
+    _enqueue(c, json, len, due_us);
+    return;
+  }
+
+  char* buf;
+  int n = msgpack_from_json_alloc(json, len, &buf);
+  if(n < 0)
+    fprintf(stderr, "failed to encode %.*s\n", len, json);
+  else
+    _enqueue(c, buf, n, due_us);
+  free(buf);
+}
+
+static void _client_close(SimClient* c) {
+  if(_config.verbose)
+    printf("%s client disconnected\n", c->is_commands ? "commands" : "events");
+  close(c->fd);
+  c->fd = -1;
+  // nobody left to send the TransactionComplete to
+  if(_transaction.client == c)
+    _transaction.client = NULL;
+
+  // drop what was still queued for it
+  SimMsg** p = &_queue;
+  while(*p != NULL) {
+    SimMsg* msg = *p;
+    if(msg->client == c) {
+      *p = msg->next;
+      free(msg);
+    } else {
+      p = &msg->next;
+    }
+  }
+}
+
+static void _send_msg(SimMsg* msg) {
+  SimClient* c = msg->client;
+  if(_config.verbose && MSGPACK_IS_MAP_HEADER(msg->data[0])) {
+    char* json = NULL;
+    struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(&json);
+    int len = msgpack_to_json(msg->data, msg->len, &out);
+    printf("-> (msgpack) %.*s\n", len < 0 ? 0 : len, json);
+    free(json);
+  } else if(_config.verbose) {
+    printf("-> %.*s\n", msg->data[msg->len - 1] == '\n' ? msg->len - 1 : msg->len, msg->data);
+  }
+
+  int off = 0;
+  while(off < msg->len) {
+    int n = send(c->fd, msg->data + off, msg->len - off, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0) {
+      fprintf(stderr, "failed to send to %s client: %s\n", c->is_commands ? "commands" : "events", strerror(errno));
+      _client_close(c);
+      return;
+    }
+    off += n;
+  }
+}
+
+// sends the queued messages that are due, returns the time of the next one or 0
+static uint64_t _flush_queue(void) {
+  while(_queue != NULL) {
+    uint64_t now = _now_us();
+    uint64_t due = _queue->due_us > _next_send_us ? _queue->due_us : _next_send_us;
+    if(due > now)
+      return due;
+
+    SimMsg* msg = _queue;
+    _queue = msg->next;
+    if(_config.rate > 0)
+      _next_send_us = (_next_send_us > now ? _next_send_us : now) + 1000000 / _config.rate;
+    _send_msg(msg);
+    free(msg);
+  }
+  return 0;
+}
+
+static int _printf_event(char** out_buf, const char* fmt, ...) {
+  struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(out_buf);
+  va_list ap;
+  va_start(ap, fmt);
+  int len = mjson_vprintf(&out, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+static void _send_reader_event(const SimStep* step) {
+  char* buf = NULL;
+  int len = _printf_event(&buf, "{%Q:%Q,%Q:%Q,%Q:%.*s}\n", "jsonrpc", "2.0", "method", KIOSK_EVENT_READER_MESSAGE, "params", step->params_len, step->params);
+  uint64_t now = _now_us();
+  for(int i = 0; i < SIM_MAX_CLIENTS; i++) {
+    if(_clients[i].fd >= 0 && !_clients[i].is_commands) {
+      _enqueue_encoded(&_clients[i], buf, len, now, _events_binary);
+      _stats.events++;
+    }
+  }
+  free(buf);
+}
+
+// params is the JSON object given by the script, completed with authorizationDetails if needed
+static void _send_transaction_complete(SimClient* c, const char* params, int params_len, uint64_t due_us) {
+  const char* details = NULL;
+  int details_len = 0;
+  mjson_find(params, params_len, "$.authorizationDetails", &details, &details_len);
+
+  // members of the script object, without the braces
+  const char* members = params + 1;
+  int members_len = params_len - 2;
+  while(members_len > 0 && (members[0] == ' ' || members[0] == '\n' || members[0] == '\t' || members[0] == '\r')) {
+    members++;
+    members_len--;
+  }
+
+  char* buf = NULL;
+  int id = _next_event_id++;
+  int len;
+  if(details != NULL) {
+    len = _printf_event(&buf, "{%Q:%Q,%Q:%Q,%Q:%.*s,%Q:%d}\n", "jsonrpc", "2.0", "method", KIOSK_EVENT_TRANSACTION_COMPLETE,
+        "params", params_len, params, "id", id);
+  } else {
+    char reference[32];
+    snprintf(reference, sizeof(reference), "SIM-%06d", id);
+    // the exact amount in units, as Kiosk Core sends it
+    char amount[16];
+    snprintf(amount, sizeof(amount), "%u.%02u", _transaction.amount_cents / 100, _transaction.amount_cents % 100);
+    len = _printf_event(&buf, "{%Q:%Q,%Q:%Q,%Q:{%.*s%s%Q:{%Q:%s,%Q:%s,%Q:%Q,%Q:%Q,%Q:%Q,%Q:%Q,%Q:%Q}},%Q:%d}\n",
+        "jsonrpc", "2.0", "method", KIOSK_EVENT_TRANSACTION_COMPLETE, "params", members_len, members, members_len > 0 ? "," : "",
+        "authorizationDetails", "AmountAuthorized", amount, "AmountRequested", amount, "Transaction_Referance", reference,
+        "PartialPan", "1234", "CardType", "VISA", "Card_ID", "SIM-CARD", "CardToken", "SIM-TOKEN", "id", id);
+  }
+  _enqueue_encoded(c, buf, len, due_us, c->binary);
+  _stats.events++;
+  free(buf);
+}
+
+static void _end_transaction(void) {
+  _transaction.client = NULL;
+  if(_config.verbose)
+    printf("transaction ended\n");
+}
+
+// plays the script steps that are due, returns the time of the next one or 0
+static uint64_t _run_script(void) {
+  uint64_t now = _now_us();
+  while(_transaction.client != NULL && _transaction.step_due_us <= now) {
+    const SimStep* step = &_steps[_transaction.step];
+    if(step->complete)
+      _send_transaction_complete(_transaction.client, step->params, step->params_len, now);
+    else
+      _send_reader_event(step);
+
+    if(++_transaction.step >= _nb_steps || step->complete)
+      _end_transaction();
+    else
+      _transaction.step_due_us += (uint64_t)_steps[_transaction.step].delay_ms * 1000;
+  }
+  return _transaction.client != NULL ? _transaction.step_due_us : 0;
+}
+
+static int _rpc_sender(const char* buf, int len, void* userdata) {
+  char* p = realloc(_reply, _reply_len + len);
+  if(p == NULL)
+    return 0;
+  _reply = p;
+  memcpy(_reply + _reply_len, buf, len);
+  _reply_len += len;
+  return len;
+}
+
+// acknowledgement of a TransactionComplete event
+static void _rpc_response(const char* buf, int len, void* userdata) {
+  _stats.acks++;
+}
+
+static void _get_status(struct jsonrpc_request* r) {
+  jsonrpc_return_success(r, "%Q", _transaction.client != NULL ? "PaymentTransaction" : _config.status);
+}
+
+static void _show_message(struct jsonrpc_request* r) {
+  if(_config.verbose)
+    printf("message: %.*s\n", r->params_len, r->params);
+  jsonrpc_return_success(r, "true");
+}
+
+static void _get_kiosk_id(struct jsonrpc_request* r) {
+  jsonrpc_return_success(r, "%Q", "SIM-0001");
+}
+
+static void _get_version(struct jsonrpc_request* r) {
+  char component[16];
+  if(mjson_get_string(r->params, r->params_len, "$.SoftwareComponent", component, sizeof(component)) > 0 && strcmp(component, "Reader") == 0)
+    jsonrpc_return_success(r, "%Q", "SIM-READER 1.0");
+  else
+    jsonrpc_return_success(r, "%Q", "SIM 1.0");
+}
+
+static void _start_transaction(struct jsonrpc_request* r) {
+  if(_transaction.client != NULL) {
+    jsonrpc_return_error(r, -32000, "%Q", "transaction in progress");
+    return;
+  }
+
+  // amounts are integer cents, exact in a double
+  double amount_cents = 0;
+  mjson_get_number(r->params, r->params_len, "$.amount", &amount_cents);
+  if(amount_cents < 0 || amount_cents > UINT32_MAX || amount_cents != (uint32_t)amount_cents) {
+    jsonrpc_return_error(r, -32602, "%Q", "invalid amount");
+    return;
+  }
+  jsonrpc_return_success(r, "true");
+
+  _stats.transactions++;
+  if(_nb_steps == 0)
+    return;
+  _transaction.client = _current;
+  _transaction.amount_cents = (uint32_t)amount_cents;
+  _transaction.step = 0;
+  _transaction.step_due_us = _now_us() + (uint64_t)_config.latency_ms * 1000 + (uint64_t)_steps[0].delay_ms * 1000;
+}
+
+static void _return_true(struct jsonrpc_request* r) {
+  jsonrpc_return_success(r, "true");
+}
+
+static void _cancel_transaction(struct jsonrpc_request* r) {
+  if(_transaction.client == NULL) {
+    jsonrpc_return_success(r, "%Q", "NoTransaction");
+    return;
+  }
+
+  jsonrpc_return_success(r, "%Q", "Ok");
+  static const char cancelled[] = "{\"status\": \"Cancelled\", \"errorDescription\": \"\", \"errorCode\": 0}";
+  _transaction.amount_cents = 0;
+  // queued after the response, to the client that started the transaction
+  _send_transaction_complete(_transaction.client, cancelled, sizeof(cancelled) - 1, _now_us() + (uint64_t)_config.latency_ms * 1000);
+  _end_transaction();
+}
+
+static void _handle_frame(SimClient* c, const char* frame, int len) {
+  // MessagePack requests are served as JSON, the reply is converted back
+  bool binary = MSGPACK_IS_MAP_HEADER(frame[0]);
+  char* json = NULL;
+  if(binary) {
+    struct mjson_out out = MJSON_OUT_DYNAMIC_BUF(&json);
+    len = msgpack_to_json(frame, len, &out);
+    if(len < 0) {
+      fprintf(stderr, "invalid MessagePack message received\n");
+      free(json);
+      return;
+    }
+    frame = json;
+  }
+
+  if(_config.verbose)
+    printf("<- %s%.*s\n", binary ? "(msgpack) " : "", len, frame);
+  if(!c->is_commands) {
+    free(json);
+    return;
+  }
+
+  _stats.requests++;
+  _current = c;
+  _reply_len = 0;
+  c->binary = binary;
+  _events_binary = binary;
+  jsonrpc_ctx_process(&_rpc, frame, len, _rpc_sender, NULL);
+  if(_reply_len > 0 && c->fd >= 0) {
+    _enqueue_encoded(c, _reply, _reply_len, _now_us() + (uint64_t)_config.latency_ms * 1000, binary);
+    _stats.responses++;
+  }
+  _current = NULL;
+  free(json);
+}
+
+static bool _client_frame(const char* frame, int len, void* ud) {
+  SimClient* c = ud;
+  _handle_frame(c, frame, len);
+  return c->fd >= 0;
+}
+
+// the library sends the messages back to back, without separator
+static void _client_read(SimClient* c) {
+  int n = read(c->fd, c->in + c->framer.filled, sizeof(c->in) - c->framer.filled);
+  if(n < 0 && errno == EINTR)
+    return;
+  if(n <= 0) {
+    _client_close(c);
+    return;
+  }
+
+  if(msgpack_framer_feed(&c->framer, c->in, n, _client_frame, c) < 0) {
+    fprintf(stderr, "invalid data received, closing the client\n");
+    _client_close(c);
+    return;
+  }
+  if(c->fd >= 0 && c->framer.filled == (int)sizeof(c->in)) {
+    fprintf(stderr, "message longer than %d bytes, closing the client\n", SIM_IN_BUF_SIZE);
+    _client_close(c);
+  }
+}
+
+static void _client_accept(int listen_fd, bool is_commands) {
+  int fd = accept(listen_fd, NULL, NULL);
+  if(fd < 0)
+    return;
+
+  for(int i = 0; i < SIM_MAX_CLIENTS; i++) {
+    SimClient* c = &_clients[i];
+    if(c->fd < 0) {
+      memset(c, 0, sizeof(SimClient));
+      c->fd = fd;
+      c->is_commands = is_commands;
+      msgpack_framer_init(&c->framer);
+      if(_config.verbose)
+        printf("%s client connected\n", is_commands ? "commands" : "events");
+      return;
+    }
+  }
+  fprintf(stderr, "too many clients, connection refused\n");
+  close(fd);
+}
+
+static int _listen_unix(const char* dir, const char* name) {
+  int fd = msgpack_listen_unix(dir, name, SIM_MAX_CLIENTS);
+  if(fd < 0)
+    fprintf(stderr, "failed to listen on %s/%s: %s\n", dir, name, strerror(errno));
+  return fd;
+}
+
+static int _listen_tcp(const char* address, int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if(inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    fprintf(stderr, "invalid address %s\n", address);
+    return -1;
+  }
+
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SIM_MAX_CLIENTS) != 0) {
+    fprintf(stderr, "failed to listen on %s:%d: %s\n", address, port, strerror(errno));
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// the script buffer must stay allocated, the steps point into it
+static bool _load_script(const char* script, int len) {
+  for(_nb_steps = 0; ; _nb_steps++) {
+    char path[16];
+    const char* step;
+    int step_len;
+    snprintf(path, sizeof(path), "$[%d]", _nb_steps);
+    if(mjson_find(script, len, path, &step, &step_len) != MJSON_TOK_OBJECT)
+      break;
+    if(_nb_steps == SIM_MAX_STEPS) {
+      fprintf(stderr, "more than %d steps in the script\n", SIM_MAX_STEPS);
+      return false;
+    }
+
+    SimStep* s = &_steps[_nb_steps];
+    double delay = 0;
+    char method[32];
+    mjson_get_number(step, step_len, "$.delay", &delay);
+    s->delay_ms = delay > 0 ? (int)delay : 0;
+    if(mjson_get_string(step, step_len, "$.method", method, sizeof(method)) <= 0
+        || mjson_find(step, step_len, "$.params", &s->params, &s->params_len) != MJSON_TOK_OBJECT) {
+      fprintf(stderr, "script step %d: missing method or params\n", _nb_steps);
+      return false;
+    }
+    if(strcmp(method, KIOSK_EVENT_TRANSACTION_COMPLETE) == 0) {
+      s->complete = true;
+    } else if(strcmp(method, KIOSK_EVENT_READER_MESSAGE) != 0) {
+      fprintf(stderr, "script step %d: unknown method %s\n", _nb_steps, method);
+      return false;
+    }
+  }
+  return true;
+}
+
+static char* _read_file(const char* path, int* out_len) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL) {
+    fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* buf = size >= 0 ? malloc(size + 1) : NULL;
+  if(buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+    fprintf(stderr, "failed to read %s\n", path);
+    free(buf);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+  buf[size] = 0;
+  *out_len = (int)size;
+  return buf;
+}
+
+static void _usage(const char* prog) {
+  fprintf(stderr, "usage: %s (-u <dir> | -t <address> [-c <port>] [-e <port>]) [-s <script>] [-l <latency ms>] [-r <messages/s>] [-S <status>] [-v]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  const char* unix_dir = NULL;
+  const char* tcp_address = NULL;
+  const char* script_path = NULL;
+  int cmd_port = 10000;
+  int evt_port = 10001;
+  int opt;
+
+  while((opt = getopt(argc, argv, "u:t:c:e:s:l:r:S:v")) != -1) {
+    switch(opt) {
+    case 'u': unix_dir = optarg; break;
+    case 't': tcp_address = optarg; break;
+    case 'c': cmd_port = atoi(optarg); break;
+    case 'e': evt_port = atoi(optarg); break;
+    case 's': script_path = optarg; break;
+    case 'l': _config.latency_ms = atoi(optarg); break;
+    case 'r': _config.rate = atoi(optarg); break;
+    case 'S': _config.status = optarg; break;
+    case 'v': _config.verbose = true; break;
+    default:
+      _usage(argv[0]);
+      return 1;
+    }
+  }
+  if((unix_dir == NULL) == (tcp_address == NULL)) {
+    _usage(argv[0]);
+    return 1;
+  }
+
+  char* script = NULL;
+  int script_len = sizeof(_default_script) - 1;
+  if(script_path != NULL && (script = _read_file(script_path, &script_len)) == NULL)
+    return 1;
+  if(!_load_script(script != NULL ? script : _default_script, script_len))
+    return 1;
+
+  int cmd_fd = unix_dir != NULL ? _listen_unix(unix_dir, "socket_cmd") : _listen_tcp(tcp_address, cmd_port);
+  int evt_fd = unix_dir != NULL ? _listen_unix(unix_dir, "socket_events") : _listen_tcp(tcp_address, evt_port);
+  if(cmd_fd < 0 || evt_fd < 0)
+    return 1;
+
+  jsonrpc_ctx_init(&_rpc, _rpc_response, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_GET_STATUS, _get_status, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_SHOW_MESSAGE, _show_message, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_GET_KIOSK_ID, _get_kiosk_id, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_GET_VERSION, _get_version, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_PRE_AUTHORIZE, _start_transaction, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_PAY_TRANSACTION, _start_transaction, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_CONFIRM_TRANSACTION, _return_true, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_VOID_TRANSACTION, _return_true, NULL);
+  jsonrpc_ctx_export(&_rpc, KIOSK_METHOD_CANCEL_TRANSACTION, _cancel_transaction, NULL);
+
+  for(int i = 0; i < SIM_MAX_CLIENTS; i++)
+    _clients[i].fd = -1;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = _sig_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  printf("Kiosk Core simulator ready, %d script steps, latency %u ms, rate %u msg/s\n", _nb_steps, _config.latency_ms, _config.rate);
+  fflush(stdout);
+  uint64_t start_us = _now_us();
+
+  while(_running) {
+    struct pollfd fds[SIM_MAX_CLIENTS + 2];
+    SimClient* polled[SIM_MAX_CLIENTS];
+    int nb_fds = 0;
+    fds[nb_fds++] = (struct pollfd){cmd_fd, POLLIN, 0};
+    fds[nb_fds++] = (struct pollfd){evt_fd, POLLIN, 0};
+    for(int i = 0; i < SIM_MAX_CLIENTS; i++) {
+      if(_clients[i].fd >= 0) {
+        polled[nb_fds - 2] = &_clients[i];
+        fds[nb_fds++] = (struct pollfd){_clients[i].fd, POLLIN, 0};
+      }
+    }
+
+    // wake up for the next script step or queued message
+    uint64_t next_step = _run_script();
+    uint64_t next_msg = _flush_queue();
+    uint64_t next = next_step == 0 || (next_msg != 0 && next_msg < next_step) ? next_msg : next_step;
+    int timeout_ms = -1;
+    if(next != 0) {
+      uint64_t now = _now_us();
+      timeout_ms = next > now ? (int)((next - now + 999) / 1000) : 0;
+    }
+
+    if(poll(fds, nb_fds, timeout_ms) < 0) {
+      if(errno == EINTR)
+        continue;
+      fprintf(stderr, "poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if(fds[0].revents & POLLIN)
+      _client_accept(cmd_fd, true);
+    if(fds[1].revents & POLLIN)
+      _client_accept(evt_fd, false);
+    for(int i = 2; i < nb_fds; i++) {
+      SimClient* c = polled[i - 2];
+      if(c->fd == fds[i].fd && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        _client_read(c);
+    }
+  }
+
+  double elapsed = (_now_us() - start_us) / 1e6;
+  printf("\n%llu requests, %llu responses, %llu events, %llu transactions, %llu acknowledged in %.1f s (%.0f requests/s)\n",
+      (unsigned long long)_stats.requests, (unsigned long long)_stats.responses, (unsigned long long)_stats.events,
+      (unsigned long long)_stats.transactions, (unsigned long long)_stats.acks, elapsed, elapsed > 0 ? _stats.requests / elapsed : 0);
+
+  for(int i = 0; i < SIM_MAX_CLIENTS; i++) {
+    if(_clients[i].fd >= 0)
+      _client_close(&_clients[i]);
+  }
+  close(cmd_fd);
+  close(evt_fd);
+  if(unix_dir != NULL) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/socket_cmd", unix_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/socket_events", unix_dir);
+    unlink(path);
+  }
+  free(_reply);
+  free(script);
+  jsonrpc_ctx_free(&_rpc);
+  return 0;
+}